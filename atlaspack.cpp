@@ -0,0 +1,169 @@
+/* Offline texture atlas packer
+ *
+ * ./atlaspack atlas.tga atlas.uv image1.png image2.png ...
+ *
+ * Packs the images into one RGBA atlas and writes a UV table the game reads
+ * at startup (see readSpriteAtlas in mycode.cpp). Each sprite is named after
+ * its file name without directory or extension.
+ */
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <cstdio>
+#include <cstring>
+
+#include <SOIL/SOIL.h>
+
+using namespace std;
+
+/* Border around each sprite, the edge texels are copied into it so sampling
+   at the sprite's border never picks up a neighbour. 4 texels keep one texel
+   of border down to mip level 2, see ATLAS_MIP_LEVELS in mycode.cpp */
+#define ATLAS_PADDING 4
+#define ATLAS_MAX_SIZE 4096
+
+struct Sprite {
+	string name;
+	int width, height;
+	unsigned char* pixels;
+	int x, y; // Top left corner in the atlas, padding excluded
+};
+
+bool tallerFirst (const Sprite* a, const Sprite* b)
+{
+	if(a->height != b->height)
+		return a->height > b->height;
+	return a->name < b->name;
+}
+
+string spriteName (const char* path)
+{
+	string name = path;
+	size_t slash = name.find_last_of('/');
+	if(slash != string::npos)
+		name = name.substr(slash + 1);
+	size_t dot = name.find_last_of('.');
+	if(dot != string::npos)
+		name = name.substr(0, dot);
+	return name;
+}
+
+/* Shelf packing: sprites sorted by height fill rows left to right.
+   Returns the used height or -1 when the sprites do not fit the width */
+int packShelves (vector<Sprite*>& sprites, int width)
+{
+	int x = 0, y = 0, shelf = 0;
+	for(size_t i=0;i<sprites.size();i++){
+		int w = sprites[i]->width + 2*ATLAS_PADDING;
+		int h = sprites[i]->height + 2*ATLAS_PADDING;
+		if(w > width)
+			return -1;
+		if(x + w > width){
+			x = 0;
+			y += shelf;
+			shelf = 0;
+		}
+		sprites[i]->x = x + ATLAS_PADDING;
+		sprites[i]->y = y + ATLAS_PADDING;
+		x += w;
+		shelf = max(shelf, h);
+	}
+	return y + shelf;
+}
+
+int nextPowerOfTwo (int n)
+{
+	int p = 1;
+	while(p < n)
+		p *= 2;
+	return p;
+}
+
+/* Copy a sprite into the atlas and extrude its edges into the padding */
+void blitSprite (unsigned char* atlas, int atlasWidth, int atlasHeight, const Sprite& s)
+{
+	for(int y=-ATLAS_PADDING;y<s.height+ATLAS_PADDING;y++){
+		int sy = min(max(y, 0), s.height-1);
+		for(int x=-ATLAS_PADDING;x<s.width+ATLAS_PADDING;x++){
+			int sx = min(max(x, 0), s.width-1);
+			int ax = s.x + x, ay = s.y + y;
+			if(ax < 0 || ay < 0 || ax >= atlasWidth || ay >= atlasHeight)
+				continue;
+			memcpy(&atlas[4*(ay*atlasWidth + ax)], &s.pixels[4*(sy*s.width + sx)], 4);
+		}
+	}
+}
+
+int main (int argc, char** argv)
+{
+	if(argc < 4){
+		printf("Usage: %s atlas.tga atlas.uv image...\n", argv[0]);
+		return 1;
+	}
+
+	vector<Sprite> sprites(argc - 3);
+	long area = 0;
+	for(int i=3;i<argc;i++){
+		Sprite& s = sprites[i-3];
+		int channels;
+		s.name = spriteName(argv[i]);
+		s.pixels = SOIL_load_image(argv[i], &s.width, &s.height, &channels, SOIL_LOAD_RGBA);
+		if(!s.pixels){
+			printf("Could not load %s: %s\n", argv[i], SOIL_last_result());
+			return 1;
+		}
+		area += (long)(s.width + 2*ATLAS_PADDING) * (s.height + 2*ATLAS_PADDING);
+	}
+
+	vector<Sprite*> order;
+	for(size_t i=0;i<sprites.size();i++)
+		order.push_back(&sprites[i]);
+	sort(order.begin(), order.end(), tallerFirst);
+
+	// Smallest power of two width that gives a roughly square atlas
+	int width = 1;
+	for(size_t i=0;i<sprites.size();i++)
+		width = max(width, sprites[i].width + 2*ATLAS_PADDING);
+	width = max(nextPowerOfTwo(width), 1);
+	while((long)width * width < area)
+		width *= 2;
+	int height = packShelves(order, width);
+	while(height > width && width < ATLAS_MAX_SIZE){
+		width *= 2;
+		height = packShelves(order, width);
+	}
+	height = nextPowerOfTwo(height);
+	if(width > ATLAS_MAX_SIZE || height > ATLAS_MAX_SIZE){
+		printf("Sprites do not fit in a %dx%d atlas\n", ATLAS_MAX_SIZE, ATLAS_MAX_SIZE);
+		return 1;
+	}
+
+	vector<unsigned char> atlas(4*width*height, 0);
+	for(size_t i=0;i<sprites.size();i++)
+		blitSprite(&atlas[0], width, height, sprites[i]);
+
+	if(!SOIL_save_image(argv[1], SOIL_SAVE_TYPE_TGA, width, height, 4, &atlas[0])){
+		printf("Could not write %s\n", argv[1]);
+		return 1;
+	}
+
+	FILE* table = fopen(argv[2], "w");
+	if(!table){
+		printf("Could not write %s\n", argv[2]);
+		return 1;
+	}
+	// UVs have v = 0 at the top row, the way SOIL hands the image to glTexImage2D
+	fprintf(table, "atlas %d %d\n", width, height);
+	for(size_t i=0;i<sprites.size();i++){
+		const Sprite& s = sprites[i];
+		fprintf(table, "%s %d %d %d %d %f %f %f %f\n", s.name.c_str(), s.x, s.y, s.width, s.height,
+				(float)s.x/width, (float)s.y/height, (float)(s.x+s.width)/width, (float)(s.y+s.height)/height);
+		SOIL_free_image_data(s.pixels);
+	}
+	fclose(table);
+
+	printf("Packed %d sprites into %s (%dx%d), UVs in %s\n", (int)sprites.size(), argv[1], width, height, argv[2]);
+	return 0;
+}
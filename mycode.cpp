@@ -1,17 +1,30 @@
 #include <iostream>
 #include <cmath>
 #include <fstream>
+#include <sstream>
 #include <vector>
 #include <algorithm>
 #include <string>
+#include <cstring>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
 
 //#include <GL/gl.h>
 //#include <GL/glu.h>
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
+// Headless contexts, keep eglplatform.h from pulling in X11
+#define EGL_NO_X11
+#define MESA_EGL_NO_X11_HEADERS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
 
 #include <FTGL/ftgl.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
 #include <SOIL/SOIL.h>
 
 #define GLM_FORCE_RADIANS
@@ -23,6 +36,11 @@
 #include <mpg123.h>
 #include <unistd.h>
 #include <signal.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <errno.h>
 
 #define GAME_BIRD 0
 #define GAME_WOOD_VERTICAL 1
@@ -36,6 +54,42 @@ pid_t pid;
 
 using namespace std;
 void reshapeWindow (GLFWwindow* window, int width, int height);
+void stopRenderThread ();
+void closeDisplay (GLFWwindow* window);
+double gameTime ();
+double monotonicTime ();
+void toggleRecording ();
+void stopRecording ();
+void joinAssetWorkers ();
+int gpuPassOfLayer (int layer);
+int gpuPassChanges (int pass);
+void beginGpuPass (int pass);
+void endGpuPass ();
+void toggleProfiler ();
+void writeTraceAtExit ();
+struct RenderList;
+void recordPerfHud (RenderList& list);
+void toggleHud ();
+void toggleOverdraw ();
+void syncWidgets (RenderList& list);
+void syncHud (RenderList& list);
+struct VAO* copyHudText (vector<GLfloat>& out);
+void renderSoftware (RenderList& list);
+void stopSoftwareRenderer ();
+struct TexturePixels;
+void keepSoftwareAtlas (const TexturePixels* pixels);
+
+std::atomic<long> bufferBytes(0); // Allocated in GL buffer objects on the GL thread, shown on the HUD by the simulation thread
+
+/* --software draws every frame on the CPU without any GL context, see renderSoftware.
+   Objects, textures and programs then get made up names so render keys still tell them apart */
+int softwareRendering = 0;
+
+GLuint softwareName ()
+{
+	static GLuint next = 0;
+	return ++next;
+}
 
 class VAO {
 	public:
@@ -47,15 +101,36 @@ class VAO {
 
 		GLenum PrimitiveMode;
 		GLenum FillMode;
+		int FirstVertex; // Non zero only for objects living in the vertex stream
 		int NumVertices;
+		vector<GLfloat> Vertices; // CPU copies of the uploaded vertex data
+		vector<GLfloat> Colors;
+		vector<GLfloat> TexCoords;
 		double centerx;
 		double centery;
 		double radius;
 		double mass;
 		int type;
 		int dead;
+		glm::vec2 boundsMin; // Bounding box of Vertices, used for culling
+		glm::vec2 boundsMax;
 
 		VAO(){
+			TextureID = 0;
+			FirstVertex = 0;
+			NumVertices = 0;
+		}
+
+		void computeBounds (){
+			if(Vertices.empty()){
+				boundsMin = boundsMax = glm::vec2(0, 0);
+				return;
+			}
+			boundsMin = boundsMax = glm::vec2(Vertices[0], Vertices[1]);
+			for(size_t i=0;i+2<Vertices.size();i+=3){
+				boundsMin = glm::min(boundsMin, glm::vec2(Vertices[i], Vertices[i+1]));
+				boundsMax = glm::max(boundsMax, glm::vec2(Vertices[i], Vertices[i+1]));
+			}
 		}
 };
 //typedef struct VAO VAO;
@@ -64,51 +139,53 @@ struct GLMatrices {
 	glm::mat4 projection;
 	glm::mat4 model;
 	glm::mat4 view;
-	GLuint MatrixID;
-	GLuint TexMatrixID; // For use with texture shader
+	GLint ModelIndexID;
+	GLint TexModelIndexID; // For use with texture shader
+	GLint InstancedModelIndexID; // First slot of an instanced draw
+	GLint EllipseModelIndexID;
+	GLint GroundModelIndexID;
 } Matrices;
 
-struct FTGLFont {
-	FTFont* font;
-	GLuint fontMatrixID;
-	GLuint fontColorID;
-} GL3Font;
+/* Glyphs are drawn from a signed distance field atlas of printable ASCII, see buildGlyphAtlas */
+#define GLYPH_FIRST 32
+#define GLYPH_COUNT 95
+#define GLYPH_PIXELS 48       // Em size the glyphs are rasterised at
+#define GLYPH_SPREAD 6        // Texels the field reaches either side of an outline, also the padding
+#define GLYPH_ATLAS_WIDTH 512
+
+/* One glyph, in ems relative to the pen with y up, padding included */
+struct Glyph {
+	float advance;
+	float x0, y0, x1, y1;
+	float u0, v0, u1, v1; // Texture coordinates at (x0, y0) and (x1, y1)
+};
+
+struct GlyphAtlas {
+	Glyph glyphs[GLYPH_COUNT];
+	int width, height;
+	vector<unsigned char> pixels; // One distance per texel, 128 on the outline and more inside
+	float solidU, solidV;         // Centre of a block that is inside everywhere, for flat quads drawn with the font program
+	double seconds;               // Rasterising and building the field
+	GLuint texture;
+	GLint modelIndexID;
+} Glyphs;
 
-GLuint programID, fontProgramID, textureProgramID;;
+GLuint programID, fontProgramID, textureProgramID, instancedProgramID, ellipseProgramID, groundProgramID;
 
-/* Function to load Shaders - Use it as it is */
-GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path) {
+/* Shader sources are built into the binary, see shaderVariantSource and loadProgram */
+/* Compile and link a program from in-memory sources, names are only used for logging.
+   Returns 0 if either shader does not compile or the program does not link */
+GLuint CompileShaders(const std::string& VertexShaderCode, const std::string& FragmentShaderCode, const char * vertex_name, const char * fragment_name) {
 
 	// Create the shaders
 	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
 	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
 
-	// Read the Vertex Shader code from the file
-	std::string VertexShaderCode;
-	std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-	if(VertexShaderStream.is_open())
-	{
-		std::string Line = "";
-		while(getline(VertexShaderStream, Line))
-			VertexShaderCode += "\n" + Line;
-		VertexShaderStream.close();
-	}
-
-	// Read the Fragment Shader code from the file
-	std::string FragmentShaderCode;
-	std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-	if(FragmentShaderStream.is_open()){
-		std::string Line = "";
-		while(getline(FragmentShaderStream, Line))
-			FragmentShaderCode += "\n" + Line;
-		FragmentShaderStream.close();
-	}
-
 	GLint Result = GL_FALSE;
 	int InfoLogLength;
 
 	// Compile Vertex Shader
-	printf("Compiling shader : %s\n", vertex_file_path);
+	printf("Compiling shader : %s\n", vertex_name);
 	char const * VertexSourcePointer = VertexShaderCode.c_str();
 	glShaderSource(VertexShaderID, 1, &VertexSourcePointer , NULL);
 	glCompileShader(VertexShaderID);
@@ -116,12 +193,13 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 	// Check Vertex Shader
 	glGetShaderiv(VertexShaderID, GL_COMPILE_STATUS, &Result);
 	glGetShaderiv(VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	std::vector<char> VertexShaderErrorMessage(InfoLogLength);
+	std::vector<char> VertexShaderErrorMessage( max(InfoLogLength, int(1)) );
 	glGetShaderInfoLog(VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
 	fprintf(stdout, "%s\n", &VertexShaderErrorMessage[0]);
+	int Compiled = Result == GL_TRUE;
 
 	// Compile Fragment Shader
-	printf("Compiling shader : %s\n", fragment_file_path);
+	printf("Compiling shader : %s\n", fragment_name);
 	char const * FragmentSourcePointer = FragmentShaderCode.c_str();
 	glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer , NULL);
 	glCompileShader(FragmentShaderID);
@@ -129,15 +207,19 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 	// Check Fragment Shader
 	glGetShaderiv(FragmentShaderID, GL_COMPILE_STATUS, &Result);
 	glGetShaderiv(FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	std::vector<char> FragmentShaderErrorMessage(InfoLogLength);
+	std::vector<char> FragmentShaderErrorMessage( max(InfoLogLength, int(1)) );
 	glGetShaderInfoLog(FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
 	fprintf(stdout, "%s\n", &FragmentShaderErrorMessage[0]);
+	Compiled = Compiled && Result == GL_TRUE;
 
 	// Link the program
 	fprintf(stdout, "Linking program\n");
 	GLuint ProgramID = glCreateProgram();
 	glAttachShader(ProgramID, VertexShaderID);
 	glAttachShader(ProgramID, FragmentShaderID);
+	// Lets loadProgram store the linked binary, see the program cache
+	if(GLAD_GL_ARB_get_program_binary)
+		glProgramParameteri(ProgramID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	glLinkProgram(ProgramID);
 
 	// Check the program
@@ -150,6 +232,11 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 	glDeleteShader(VertexShaderID);
 	glDeleteShader(FragmentShaderID);
 
+	// 0 tells the caller it failed, the logs above say why
+	if(!Compiled || Result != GL_TRUE){
+		glDeleteProgram(ProgramID);
+		return 0;
+	}
 	return ProgramID;
 }
 
@@ -160,9 +247,13 @@ static void error_callback(int error, const char* description)
 
 void quit(GLFWwindow *window)
 {
-	glfwDestroyWindow(window);
-	glfwTerminate();
-	kill(pid,SIGKILL);
+	stopRenderThread();
+	stopRecording();
+	joinAssetWorkers();
+	writeTraceAtExit();
+	closeDisplay(window);
+	if(pid > 0)
+		kill(pid,SIGKILL);
 	exit(EXIT_SUCCESS);
 }
 
@@ -200,6 +291,14 @@ VAO* create3DObject (GLenum primitive_mode, int numVertices, int type, const GLf
 	vao->radius = radius;
 	vao->type = type;
 	vao->dead = 0;
+	vao->Vertices.assign(vertex_buffer_data, vertex_buffer_data + 3*numVertices);
+	vao->computeBounds();
+	vao->Colors.assign(color_buffer_data, color_buffer_data + 3*numVertices);
+	// Nothing to upload without GL, the software rasterizer reads the copies
+	if(softwareRendering){
+		vao->VertexArrayID = softwareName();
+		return vao;
+	}
 
 	// Create Vertex Array Object
 	// Should be done after CreateWindow and before any other GL calls
@@ -210,6 +309,7 @@ VAO* create3DObject (GLenum primitive_mode, int numVertices, int type, const GLf
 	glBindVertexArray (vao->VertexArrayID); // Bind the VAO 
 	glBindBuffer (GL_ARRAY_BUFFER, vao->VertexBuffer); // Bind the VBO vertices 
 	glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), vertex_buffer_data, GL_STATIC_DRAW); // Copy the vertices into VBO
+	bufferBytes += 3*numVertices*sizeof(GLfloat);
 	glVertexAttribPointer(
 			0,                  // attribute 0. Vertices
 			3,                  // size (x,y,z)
@@ -221,6 +321,7 @@ VAO* create3DObject (GLenum primitive_mode, int numVertices, int type, const GLf
 
 	glBindBuffer (GL_ARRAY_BUFFER, vao->ColorBuffer); // Bind the VBO colors 
 	glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), color_buffer_data, GL_STATIC_DRAW);  // Copy the vertex colors
+	bufferBytes += 3*numVertices*sizeof(GLfloat);
 	glVertexAttribPointer(
 			1,                  // attribute 1. Color
 			3,                  // size (r,g,b)
@@ -230,6 +331,10 @@ VAO* create3DObject (GLenum primitive_mode, int numVertices, int type, const GLf
 			(void*)0            // array buffer offset
 			);
 
+	// Attribute arrays are VAO state, enable them once here
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+
 	return vao;
 }
 
@@ -254,6 +359,13 @@ struct VAO* create3DTexturedObject (GLenum primitive_mode, int numVertices, cons
 	vao->NumVertices = numVertices;
 	vao->FillMode = fill_mode;
 	vao->TextureID = textureID;
+	vao->Vertices.assign(vertex_buffer_data, vertex_buffer_data + 3*numVertices);
+	vao->computeBounds();
+	vao->TexCoords.assign(texture_buffer_data, texture_buffer_data + 2*numVertices);
+	if(softwareRendering){
+		vao->VertexArrayID = softwareName();
+		return vao;
+	}
 
 	// Create Vertex Array Object
 	// Should be done after CreateWindow and before any other GL calls
@@ -264,6 +376,7 @@ struct VAO* create3DTexturedObject (GLenum primitive_mode, int numVertices, cons
 	glBindVertexArray (vao->VertexArrayID); // Bind the VAO
 	glBindBuffer (GL_ARRAY_BUFFER, vao->VertexBuffer); // Bind the VBO vertices
 	glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), vertex_buffer_data, GL_STATIC_DRAW); // Copy the vertices into VBO
+	bufferBytes += 3*numVertices*sizeof(GLfloat);
 	glVertexAttribPointer(
 						  0,                  // attribute 0. Vertices
 						  3,                  // size (x,y,z)
@@ -275,6 +388,7 @@ struct VAO* create3DTexturedObject (GLenum primitive_mode, int numVertices, cons
 
 	glBindBuffer (GL_ARRAY_BUFFER, vao->TextureBuffer); // Bind the VBO textures
 	glBufferData (GL_ARRAY_BUFFER, 2*numVertices*sizeof(GLfloat), texture_buffer_data, GL_STATIC_DRAW);  // Copy the vertex colors
+	bufferBytes += 2*numVertices*sizeof(GLfloat);
 	glVertexAttribPointer(
 						  2,                  // attribute 2. Textures
 						  2,                  // size (s,t)
@@ -284,6 +398,87 @@ struct VAO* create3DTexturedObject (GLenum primitive_mode, int numVertices, cons
 						  (void*)0            // array buffer offset
 						  );
 
+	// Attribute arrays are VAO state, enable them once here
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(2);
+
+	return vao;
+}
+
+/* Colour as the whole number 0xRRGGBB, exact in a float */
+GLfloat packColor (const glm::vec3& color)
+{
+	return (GLfloat)((int)(color.x*255 + 0.5f)*65536 + (int)(color.y*255 + 0.5f)*256 + (int)(color.z*255 + 0.5f));
+}
+
+/* Ellipses of a mesh drawn by the ellipse program, see createEllipseObject */
+struct Ellipse {
+	float x, y;   // Centre
+	float rx, ry; // Radii
+	glm::vec3 color;
+};
+
+/* World units of anti-aliased edge kept outside each ellipse's quad */
+#define ELLIPSE_MARGIN 2.0f
+
+/* Generate VAO and one interleaved VBO for ellipses drawn back to front, each
+   as two triangles the ellipse program cuts round, followed by flat triangles.
+   Every vertex is position, position in the ellipse scaled to the unit circle,
+   and the packed colour; flat triangles sit at the centre of that circle */
+VAO* createEllipseObject (const Ellipse* ellipses, int count, const GLfloat* triangles, const GLfloat* triangleColors, int numTriangleVertices, int type, double centerx, double centery, double radius)
+{
+	static const int corners[6][2] = { {-1,-1}, {-1,1}, {1,-1}, {-1,1}, {1,-1}, {1,1} };
+	VAO* vao = new VAO();
+	vao->PrimitiveMode = GL_TRIANGLES;
+	vao->NumVertices = 6*count + numTriangleVertices;
+	vao->FillMode = GL_FILL;
+	vao->centerx = centerx;
+	vao->centery = centery;
+	vao->radius = radius;
+	vao->type = type;
+	vao->dead = 0;
+
+	vector<GLfloat> data;
+	for(int i=0;i<count;i++){
+		const Ellipse& e = ellipses[i];
+		float mx = 1 + ELLIPSE_MARGIN/e.rx, my = 1 + ELLIPSE_MARGIN/e.ry;
+		for(int k=0;k<6;k++){
+			GLfloat v[6] = { e.x + corners[k][0]*mx*e.rx, e.y + corners[k][1]*my*e.ry, 0, corners[k][0]*mx, corners[k][1]*my, packColor(e.color) };
+			data.insert(data.end(), v, v + 6);
+			vao->Vertices.insert(vao->Vertices.end(), v, v + 3);
+			vao->TexCoords.insert(vao->TexCoords.end(), v + 3, v + 5);
+			vao->Colors.push_back(e.color.x);
+			vao->Colors.push_back(e.color.y);
+			vao->Colors.push_back(e.color.z);
+		}
+	}
+	for(int i=0;i<numTriangleVertices;i++){
+		const GLfloat* c = &triangleColors[3*i];
+		GLfloat v[6] = { triangles[3*i], triangles[3*i+1], triangles[3*i+2], 0, 0, packColor(glm::vec3(c[0], c[1], c[2])) };
+		data.insert(data.end(), v, v + 6);
+		vao->Vertices.insert(vao->Vertices.end(), v, v + 3);
+		vao->TexCoords.insert(vao->TexCoords.end(), v + 3, v + 5);
+		vao->Colors.insert(vao->Colors.end(), c, c + 3);
+	}
+	vao->computeBounds();
+	if(softwareRendering){
+		vao->VertexArrayID = softwareName();
+		return vao;
+	}
+
+	glGenVertexArrays(1, &(vao->VertexArrayID));
+	glGenBuffers(1, &(vao->VertexBuffer));
+	vao->ColorBuffer = vao->TextureBuffer = vao->VertexBuffer;
+	glBindVertexArray (vao->VertexArrayID);
+	glBindBuffer (GL_ARRAY_BUFFER, vao->VertexBuffer);
+	glBufferData (GL_ARRAY_BUFFER, data.size()*sizeof(GLfloat), &data[0], GL_STATIC_DRAW);
+	bufferBytes += data.size()*sizeof(GLfloat);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6*sizeof(GLfloat), (void*)0);
+	glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, 6*sizeof(GLfloat), (void*)(5*sizeof(GLfloat)));
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 6*sizeof(GLfloat), (void*)(3*sizeof(GLfloat)));
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glEnableVertexAttribArray(2);
 	return vao;
 }
 
@@ -307,7 +502,7 @@ void draw3DObject (VAO* vao)
 	glBindBuffer(GL_ARRAY_BUFFER, vao->ColorBuffer);
 
 	// Draw the geometry !
-	glDrawArrays(vao->PrimitiveMode, 0, vao->NumVertices); // Starting from vertex 0; 3 vertices total -> 1 triangle
+	glDrawArrays(vao->PrimitiveMode, vao->FirstVertex, vao->NumVertices); // Starting from vertex 0; 3 vertices total -> 1 triangle
 }
 
 void draw3DTexturedObject (struct VAO* vao)
@@ -332,460 +527,2642 @@ void draw3DTexturedObject (struct VAO* vao)
 	glBindBuffer(GL_ARRAY_BUFFER, vao->TextureBuffer);
 
 	// Draw the geometry !
-	glDrawArrays(vao->PrimitiveMode, 0, vao->NumVertices); // Starting from vertex 0; 3 vertices total -> 1 triangle
+	glDrawArrays(vao->PrimitiveMode, vao->FirstVertex, vao->NumVertices); // Starting from vertex 0; 3 vertices total -> 1 triangle
 
 	// Unbind Textures to be safe
 	glBindTexture(GL_TEXTURE_2D, 0);
 }
 
-/* Create an OpenGL Texture from an image */
-GLuint createTexture (const char* filename)
-{
-	GLuint TextureID;
-	// Generate Texture Buffer
-	glGenTextures(1, &TextureID);
-	// All upcoming GL_TEXTURE_2D operations now have effect on our texture buffer
-	glBindTexture(GL_TEXTURE_2D, TextureID);
-	// Set our texture parameters
-	// Set texture wrapping to GL_REPEAT
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	// Set texture filtering (interpolation)
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+/************
+ * Profiler *
+ ************/
+
+/* PROFILE_SCOPE("name") times the rest of the enclosing block on the calling
+   thread. Each thread records into its own ring, so recording takes no lock,
+   and while profiling is off a scope costs one relaxed atomic load and a
+   branch. T (or --trace FILE, at exit) writes the last Profiler.seconds as
+   Chrome trace JSON for chrome://tracing or ui.perfetto.dev */
+#define PROFILE_EVENTS 65536  // Per thread, a power of two
+#define PROFILE_THREADS 16
+#define PROFILE_SECONDS 5
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+
+struct ProfileEvent {
+	const char* name;      // Kept as a pointer, so a literal or anything that lives as long
+	const char* category;
+	long long begin, end;  // Nanoseconds, CLOCK_MONOTONIC
+};
 
-	// Load image and create OpenGL texture
-	int twidth, theight;
-	unsigned char* image = SOIL_load_image(filename, &twidth, &theight, 0, SOIL_LOAD_RGB);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, twidth, theight, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-	glGenerateMipmap(GL_TEXTURE_2D); // Generate MipMaps to use
-	SOIL_free_image_data(image); // Free the data read from file after creating opengl texture
-	glBindTexture(GL_TEXTURE_2D, 0); // Unbind texture when done, so we won't accidentily mess it up
+struct ProfileRing {
+	ProfileEvent events[PROFILE_EVENTS];
+	std::atomic<unsigned> head;  // Events ever written, only the owning thread writes
+	const char* name;
+	int id;
+};
 
-	return TextureID;
-}
+struct ScopeProfiler {
+	std::atomic<int> enabled;
+	std::atomic<int> threads;
+	std::atomic<ProfileRing*> rings[PROFILE_THREADS];
+	double seconds;     // Length of a dump, PROFILE_SECONDS unless --trace-seconds
+	const char* path;   // --trace, written at exit
+} Profiler;
 
-/**************************
- * Customizable functions *
- **************************/
+thread_local ProfileRing* profileRing = NULL;
+thread_local const char* profileThreadLabel = NULL;
 
-int pressed_state = 0, collision_state=0, zoominstate = 0, zoomoutstate = 0, panright = 0, panleft = 0, panup = 0, pandown = 0;
-int keyboard_pressed_statex = 0, keyboard_pressed_statey = 0;
-double curx,cury,initx = -380,inity = 130,speedx,speedy,strength=0.5,prevx,prevy,cannonball_size=18,gravity=0.2;
-double fireposx=-380,fireposy=130, keyboardx = -380 , keyboardy = 130;
-double pivotx=-10,pivoty=-30,angular_v[6],angle[6],woodspx[6],woodspy[6],pigspx[10], pigspy[10], piginitx[10];
-VAO  *cannonball, *gameFloor, *woodlogs[6], *pigs[10], *powerboard, *powerelement, *background, *catapult;
-float screenleft = -600.0f, screenright = 600.0f, screentop = -300.0f, screenbotton = 300.0f;
-int scoretimer[10][3],tim=5;
-int pig_wood[10];
-int panning_state=0, paninitx, paninity;
+long long profileClock ()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
 
-int score = 0;
+/* Name the calling thread in traces, its ring is only allocated once it records */
+void profileThreadName (const char* name)
+{
+	profileThreadLabel = name;
+	if(profileRing)
+		profileRing->name = name;
+}
 
-double power = 0;
-/* Executed when a regular key is pressed/released/held-down */
-/* Prefered for Keyboard events */
-void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
+void recordProfileEvent (const char* name, const char* category, long long begin, long long end)
 {
-	// Function is called first on GLFW_PRESS.
+	ProfileRing* ring = profileRing;
+	if(!ring){
+		int id = Profiler.threads++;
+		if(id >= PROFILE_THREADS)
+			return;
+		ring = profileRing = new ProfileRing();
+		ring->head = 0;
+		ring->name = profileThreadLabel;
+		ring->id = id;
+		Profiler.rings[id].store(ring, std::memory_order_release);
+	}
+	unsigned head = ring->head.load(std::memory_order_relaxed);
+	ProfileEvent& e = ring->events[head & (PROFILE_EVENTS - 1)];
+	e.name = name;
+	e.category = category;
+	e.begin = begin;
+	e.end = end;
+	ring->head.store(head + 1, std::memory_order_release);
+}
 
-	if (action == GLFW_RELEASE) {
-		switch (key) {
-			case GLFW_KEY_C:
-				//rectangle_rot_status = !rectangle_rot_status;
-				break;
-			case GLFW_KEY_KP_ADD:
-				zoominstate = 0;
-				//triangle_rot_status = !triangle_rot_status;
-				break;
-			case GLFW_KEY_KP_SUBTRACT:
-				zoomoutstate = 0;
-				break;
-			case GLFW_KEY_LEFT:
-				panleft = 0;
-				break;
-			case GLFW_KEY_RIGHT:
-				panright = 0;
-				break;
-			case GLFW_KEY_UP:
-				panup = 0;
-				break;
-			case GLFW_KEY_DOWN:
-				pandown = 0;
-				break;
-			case GLFW_KEY_X:
-				// do something ..
-				break;
-			case GLFW_KEY_A:
-				keyboard_pressed_statex = 0;
-				break;
-			case GLFW_KEY_B:
-				keyboard_pressed_statey = 0;
-				break;
-			default:
-				break;
-		}
+struct ProfileScope {
+	const char* name;
+	const char* category;
+	long long begin;
+	ProfileScope (const char* name, const char* category = "game")
+		: name(name), category(category), begin(Profiler.enabled.load(std::memory_order_relaxed) ? profileClock() : 0) {}
+	~ProfileScope ()
+	{
+		if(begin)
+			recordProfileEvent(name, category, begin, profileClock());
 	}
-	else if (action == GLFW_PRESS) {
-		switch (key) {
-			case GLFW_KEY_ESCAPE:
-				quit(window);
-				break;
-			case GLFW_KEY_KP_ADD:
-				zoominstate=1;
-				break;
-			case GLFW_KEY_KP_SUBTRACT:
-				zoomoutstate = 1;
-				break;
-			case GLFW_KEY_LEFT:
-				panleft = 1;
-				break;
-			case GLFW_KEY_RIGHT:
-				panright = 1;
-				break;
-			case GLFW_KEY_UP:
-				panup = 1;
-				break;
-			case GLFW_KEY_DOWN:
-				pandown = 1;
-				break;
-			case GLFW_KEY_A:
-				keyboard_pressed_statex = 1;
-				if(keyboard_pressed_statey==0){
-					keyboardx = fireposx;
-					keyboardy = fireposy;
-					initx = fireposx;
-					inity = fireposy;
-				}
-				break;
-			case GLFW_KEY_B:
-				keyboard_pressed_statey = 1;
-				if(keyboard_pressed_statex==0){
-					keyboardy = fireposy;
-					keyboardx = fireposx;
-					initx = fireposx;
-					inity = fireposy;
-				}
-				break;
-			case GLFW_KEY_SPACE:
-				pressed_state = 3;
-				if(sqrt((keyboardx-initx)*(keyboardx-initx)+(keyboardy-inity)*(keyboardy-inity)) > 30){
-					double angle_present = -M_PI+atan2(inity-keyboardy,initx-keyboardx);
-					keyboardx = initx + 30*cos(angle_present);
-					keyboardy = inity + 30*sin(angle_present);
-				}
-				speedx=(initx-keyboardx)*strength;
-				speedy=(inity-keyboardy)*strength;
-				break;
+};
 
-			default:
-				break;
+/* For spans that are not a block of their own: profileEnd(profileBegin(), ...) */
+long long profileBegin ()
+{
+	return Profiler.enabled.load(std::memory_order_relaxed) ? profileClock() : 0;
+}
+
+void profileEnd (long long begin, const char* name)
+{
+	if(begin)
+		recordProfileEvent(name, "game", begin, profileClock());
+}
+
+/* Complete ("X") events of every thread that ended in the last seconds */
+void writeChromeTrace (const char* path, double seconds)
+{
+	long long from = profileClock() - (long long)(seconds * 1e9);
+	FILE* file = fopen(path, "w");
+	if(!file){
+		printf("Could not write trace %s\n", path);
+		return;
+	}
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+	const char* separator = "\n";
+	int events = 0;
+	for(int t=0;t<PROFILE_THREADS;t++){
+		ProfileRing* ring = Profiler.rings[t].load(std::memory_order_acquire);
+		if(!ring)
+			continue;
+		fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+				separator, ring->id, ring->name ? ring->name : "thread");
+		separator = ",\n";
+		// The owner keeps recording meanwhile, stay an eighth of the ring clear of where it writes
+		unsigned head = ring->head.load(std::memory_order_acquire);
+		unsigned count = min(head, (unsigned)(PROFILE_EVENTS - PROFILE_EVENTS/8));
+		for(unsigned i=head-count;i!=head;i++){
+			const ProfileEvent& e = ring->events[i & (PROFILE_EVENTS - 1)];
+			if(e.end < from)
+				continue;
+			fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+					e.name, e.category, ring->id, e.begin/1000.0, (e.end - e.begin)/1000.0);
+			events++;
 		}
 	}
+	fprintf(file, "\n]}\n");
+	fclose(file);
+	printf("Trace: %d events from the last %.1f s written to %s\n", events, seconds, path);
 }
 
-/* Executed for character input (like in text boxes) */
-void keyboardChar (GLFWwindow* window, unsigned int key)
+/* T: start profiling, then dump the last seconds on every press */
+void toggleProfiler ()
 {
-	switch (key) {
-		case 'Q':
-		case 'q':
-			quit(window);
-			break;
-		default:
-			break;
+	double seconds = Profiler.seconds > 0 ? Profiler.seconds : PROFILE_SECONDS;
+	const char* path = Profiler.path ? Profiler.path : "trace.json";
+	if(!Profiler.enabled){
+		Profiler.enabled = 1;
+		printf("Profiling, press T again to write the last %.0f s to %s\n", seconds, path);
 	}
+	else
+		writeChromeTrace(path, seconds);
 }
 
-void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
+void writeTraceAtExit ()
 {
-	if(yoffset == 1){
-		screenleft /= 1.02;
-		screenright /= 1.02;
-		screentop /= 1.02;
-		screenbotton /= 1.02;
-		reshapeWindow(window, 1200, 600);
+	if(Profiler.enabled && Profiler.path)
+		writeChromeTrace(Profiler.path, Profiler.seconds > 0 ? Profiler.seconds : PROFILE_SECONDS);
+}
+
+/*****************************
+ * Persistent stream buffers *
+ *****************************/
+
+/* Every stream buffer is split into this many regions: the CPU fills one while
+   the GPU may still read the two written in the previous frames */
+#define STREAM_REGIONS 3
+/* Interleaved position + colour of streamed vertices */
+#define STREAM_VERTEX_STRIDE (6*sizeof(GLfloat))
+
+struct StreamBuffer {
+	GLuint BufferID;
+	GLenum target;
+	GLsizeiptr regionSize;
+	unsigned char* mapped; // Persistent write pointer, NULL when GL_ARB_buffer_storage is missing
+	GLsync fences[STREAM_REGIONS];
+	int region;            // Region written during the current frame
+	GLsizeiptr head;       // Bytes already handed out in that region
+	long stalls;           // Fence waits that found the GPU still reading the region
+	double bytes;          // Bytes written since creation
+	int overflowed;
+};
+
+StreamBuffer VertexStream, UniformStream;
+
+/* Allocate the storage once; it is never respecified with glBufferData afterwards */
+void initStreamBuffer (StreamBuffer* sb, GLenum target, GLsizeiptr regionSize)
+{
+	sb->target = target;
+	sb->regionSize = regionSize;
+	sb->region = 0;
+	sb->head = 0;
+	sb->stalls = 0;
+	sb->bytes = 0;
+	sb->overflowed = 0;
+	sb->mapped = NULL;
+	for(int i=0;i<STREAM_REGIONS;i++)
+		sb->fences[i] = 0;
+
+	glGenBuffers(1, &sb->BufferID);
+	glBindBuffer(target, sb->BufferID);
+	if(GLAD_GL_ARB_buffer_storage){
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(target, STREAM_REGIONS*regionSize, NULL, flags);
+		sb->mapped = (unsigned char*) glMapBufferRange(target, 0, STREAM_REGIONS*regionSize, flags);
 	}
-	else if(yoffset == -1){
-		if(screenleft >= -600.0f/1.02f)
-			screenleft *= 1.02;
-		if(screenright <= 600.0f/1.02f)
-			screenright *= 1.02;
-		if(screentop >= -300.0f/1.02f)
-			screentop *= 1.02;
-		if(screenbotton <= 300.0f/1.02f)
-			screenbotton *= 1.02;
-		reshapeWindow(window, 1200, 600);
+	else {
+		// No persistent mapping, every write maps its own range unsynchronized and the fences keep it safe
+		glBufferData(target, STREAM_REGIONS*regionSize, NULL, GL_STREAM_DRAW);
 	}
-
+	glBindBuffer(target, 0);
+	bufferBytes += STREAM_REGIONS*regionSize;
 }
 
-static void cursor_position_callback(GLFWwindow* window, double xpos, double ypos)
+/* Move on to the next region, waiting only if the GPU is still reading it */
+void beginStreamRegion (StreamBuffer* sb)
 {
-	curx = ((screenright - screenleft)/1200.0f)*xpos + screenleft;
-	cury = ((screenbotton - screentop)/600.0f)*ypos + screentop;
-	if(panning_state == 1){
-		if(paninitx - curx < 0 && screenleft >= -600 + fabs(paninitx - curx)){
-			screenleft -= fabs(paninitx - curx);
-			screenright -= fabs(paninitx - curx);
-		}
-		if(paninitx - curx > 0 && screenright <= 600 - fabs(paninitx -curx)){
-			screenleft += fabs(paninitx -curx);
-			screenright += fabs(paninitx -curx);
-		}
-		if(paninity - cury < 0  && screentop >= -300 + fabs(paninity - cury)){
-			screentop -= fabs(paninity - cury);
-			screenbotton -= fabs(paninity - cury);
-		}
-		if(paninity - cury > 0 && screenbotton <= 300 - fabs(paninity -cury)){
-			screentop += fabs(paninity - cury);
-			screenbotton += fabs(paninity -cury);
+	sb->region = (sb->region + 1) % STREAM_REGIONS;
+	sb->head = 0;
+	GLsync fence = sb->fences[sb->region];
+	if(fence){
+		GLenum result = glClientWaitSync(fence, 0, 0);
+		if(result == GL_TIMEOUT_EXPIRED){
+			sb->stalls++;
+			do {
+				result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+			} while(result == GL_TIMEOUT_EXPIRED);
 		}
-		reshapeWindow(window, 1200, 600);
+		glDeleteSync(fence);
+		sb->fences[sb->region] = 0;
 	}
-
 }
 
-int is_cannon_clicked(double mousex, double mousey) {
-	double x2=cannonball->centerx;
-	double y2=cannonball->centery;
-	double radius = cannonball->radius;
-	if(radius>sqrt((x2-mousex)*(x2-mousex)+(y2-mousey)*(y2-mousey)))
-		return true;
-	else
-		return false;
+/* Mark the region as in use by every command issued so far */
+void endStreamRegion (StreamBuffer* sb)
+{
+	sb->fences[sb->region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
 }
 
-/* Executed when a mouse button is pressed/released */
-void mouseButton (GLFWwindow* window, int button, int action, int mods)
+/* Reserve size bytes at an offset that is a multiple of align, -1 when the region is full */
+GLintptr streamAlloc (StreamBuffer* sb, GLsizeiptr size, GLsizeiptr align)
 {
-	switch (button) {
-		case GLFW_MOUSE_BUTTON_LEFT:
-			if (action == GLFW_PRESS){
-				//triangle_rot_dir *= -1;
-				if(pressed_state==0&&is_cannon_clicked(curx,cury))
-				{	
-					initx=curx,inity=cury;
-					pressed_state=1;
-				}
-			}
-			if(pressed_state==3){
-				pressed_state=0;
-				gravity = 0.2;
-				power = 0;
-				keyboardx = fireposx;
-				keyboardy = fireposy;
-			}
-			if (action == GLFW_RELEASE ){
-				//triangle_rot_dir *= -1;
-				if(pressed_state==1){
-					pressed_state=3;
-
-					if(sqrt((curx-initx)*(curx-initx)+(cury-inity)*(cury-inity)) > 30){
-						double angle_present = -M_PI+atan2(inity-cury,initx-curx);
-						curx = initx + 30*cos(angle_present);
-						cury = inity + 30*sin(angle_present);
-					}
-					speedx=(initx-curx)*strength;
-					speedy=(inity-cury)*strength;
+	GLintptr base = (GLintptr)sb->region * sb->regionSize;
+	GLintptr offset = ((base + sb->head + align - 1) / align) * align;
+	if(offset + size > base + sb->regionSize){
+		if(!sb->overflowed)
+			fprintf(stderr, "Stream buffer region of %ld bytes is full, dropping data\n", (long)sb->regionSize);
+		sb->overflowed = 1;
+		return -1;
+	}
+	sb->head = offset + size - base;
+	return offset;
+}
 
-				}
-				//printf("pressed at %lf %lf and released at %lf %lf",initx,inity,curx,cury);
-			}
-			break;
-		case GLFW_MOUSE_BUTTON_RIGHT:
-			if (action == GLFW_RELEASE) {
-				panning_state = 0;
-			}
-			if(action == GLFW_PRESS){
-				panning_state = 1;
-				paninitx = curx;
-				paninity = cury;
-			}
-			break;
-		default:
-			break;
+/* Copy data into space returned by streamAlloc */
+void streamUpload (StreamBuffer* sb, GLintptr offset, const void* data, GLsizeiptr size)
+{
+	if(sb->mapped)
+		memcpy(sb->mapped + offset, data, size);
+	else {
+		glBindBuffer(sb->target, sb->BufferID);
+		void* dst = glMapBufferRange(sb->target, offset, size, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+		memcpy(dst, data, size);
+		glUnmapBuffer(sb->target);
+		glBindBuffer(sb->target, 0);
 	}
+	sb->bytes += size;
 }
 
+void beginStreamFrame ()
+{
+	beginStreamRegion(&VertexStream);
+	beginStreamRegion(&UniformStream);
+}
 
-/* Executed when window is resized to 'width' and 'height' */
-/* Modify the bounds of the screen here in glm::ortho or Field of View in glm::Perspective */
-void reshapeWindow (GLFWwindow* window, int width, int height)
+void endStreamFrame ()
 {
-	int fbwidth=width, fbheight=height;
-	/* With Retina display on Mac OS X, GLFW's FramebufferSize
-	   is different from WindowSize */
-	glfwGetFramebufferSize(window, &fbwidth, &fbheight);
+	endStreamRegion(&VertexStream);
+	endStreamRegion(&UniformStream);
+}
 
-	GLfloat fov = 90.0f;
+/* VAO reading interleaved position/colour from the vertex stream, ranges are picked per draw */
+VAO* createStreamedObject (GLenum primitive_mode, int type)
+{
+	VAO* vao = new VAO();
+	vao->PrimitiveMode = primitive_mode;
+	vao->FillMode = GL_FILL;
+	vao->type = type;
+	vao->dead = 0;
+	vao->VertexBuffer = vao->ColorBuffer = VertexStream.BufferID;
+	if(softwareRendering){
+		vao->VertexArrayID = softwareName();
+		return vao;
+	}
 
-	// sets the viewport of openGL renderer
-	glViewport (0, 0, (GLsizei) fbwidth, (GLsizei) fbheight);
+	glGenVertexArrays(1, &(vao->VertexArrayID));
+	glBindVertexArray (vao->VertexArrayID);
+	glBindBuffer (GL_ARRAY_BUFFER, VertexStream.BufferID);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, STREAM_VERTEX_STRIDE, (void*)0);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, STREAM_VERTEX_STRIDE, (void*)(3*sizeof(GLfloat)));
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	return vao;
+}
 
-	// set the projection matrix as perspective
-	/* glMatrixMode (GL_PROJECTION);
-	   glLoadIdentity ();
-	   gluPerspective (fov, (GLfloat) fbwidth / (GLfloat) fbheight, 0.1, 500.0); */
-	// Store the projection matrix in a variable for future use
-	// Perspective projection for 3D views
-	// Matrices.projection = glm::perspective (fov, (GLfloat) fbwidth / (GLfloat) fbheight, 0.1f, 500.0f);
+/* VAO reading position/texture coordinate pairs from the vertex stream,
+   laid out like the coloured vertices with the last float unused */
+VAO* createStreamedSpriteObject (GLuint textureID)
+{
+	VAO* vao = new VAO();
+	vao->PrimitiveMode = GL_TRIANGLES;
+	vao->FillMode = GL_FILL;
+	vao->TextureID = textureID;
+	vao->dead = 0;
+	vao->VertexBuffer = vao->TextureBuffer = VertexStream.BufferID;
+	if(softwareRendering){
+		vao->VertexArrayID = softwareName();
+		return vao;
+	}
 
-	// Ortho projection for 2D views
-//	screenleft = -screenleft, screenright = -screenright, screenbotton= - screenbotton, screentop = -screentop;
-	Matrices.projection = glm::ortho(screenleft, screenright, screenbotton, screentop, 1.0f, 500.0f);
+	glGenVertexArrays(1, &(vao->VertexArrayID));
+	glBindVertexArray (vao->VertexArrayID);
+	glBindBuffer (GL_ARRAY_BUFFER, VertexStream.BufferID);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, STREAM_VERTEX_STRIDE, (void*)0);
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, STREAM_VERTEX_STRIDE, (void*)(3*sizeof(GLfloat)));
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(2);
+	return vao;
 }
 
-void createPowerElement() {
-	static GLfloat vertex_buffer_data[] = {
-		-0.5, -15.0f*0.75, 0,
-		0.5, -15.0f*0.75f, 0,
-		-0.5, 15.0f*0.75f, 0,
+/* VAO reading position/texture coordinate/packed colour from the vertex stream, see recordText */
+VAO* createStreamedTextObject (GLuint textureID)
+{
+	VAO* vao = createStreamedSpriteObject(textureID);
+	if(softwareRendering)
+		return vao;
+	glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, STREAM_VERTEX_STRIDE, (void*)(5*sizeof(GLfloat)));
+	glEnableVertexAttribArray(1);
+	return vao;
+}
 
-		0.5, -15.0f*0.75f, 0,
-		-0.5, 15.0f*0.75f, 0,
-		0.5, 15.0f*0.75f, 0
-	};
-	static GLfloat color_buffer_data[] = {
-		12.0f/255.0f,253.0f/255.0f,1.0f/255.0f,
-		12.0f/255.0f,253.0f/255.0f,1.0f/255.0f,
-		12.0f/255.0f,253.0f/255.0f,1.0f/255.0f,
-		12.0f/255.0f,253.0f/255.0f,1.0f/255.0f,
-		12.0f/255.0f,253.0f/255.0f,1.0f/255.0f,
-		12.0f/255.0f,253.0f/255.0f,1.0f/255.0f
-	};
-	powerelement = create3DObject(GL_TRIANGLES, 2*3 ,GAME_SCOREBOARD, vertex_buffer_data, color_buffer_data, -400 + 30, -270 +15, 30, GL_FILL);
+/*****************************
+ * Uniform buffer transforms *
+ *****************************/
+
+/* Binding points of the std140 blocks declared in every vertex shader */
+#define UBO_CAMERA_BINDING 0
+#define UBO_MODELS_BINDING 1
+/* Matrices per bound range of the Models block, must match model[] in the shaders.
+   256 mat4 = 16KB, the minimum GL_MAX_UNIFORM_BLOCK_SIZE every GL 3.3 driver offers */
+#define MODEL_BLOCK_SLOTS 256
+/* Model ranges that fit in one frame's region of the uniform stream */
+#define MODEL_RING_BLOCKS 64
+
+struct RenderCommand;
+
+struct ModelRing {
+	GLint alignment;   // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+	GLint blockStride; // Bytes reserved per range, a multiple of alignment
+	int count;         // Matrices staged for the next flush
+	glm::mat4 staging[MODEL_BLOCK_SLOTS];
+	vector<const RenderCommand*> pending; // Commands using staging[i], see flushRenderBatch
+} Transforms;
+
+/* Create the camera/model uniform stream and the vertex stream, call once after the context is current */
+void initTransformBuffers ()
+{
+	GLint alignment = 256;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	GLint blockSize = MODEL_BLOCK_SLOTS * sizeof(glm::mat4);
+	Transforms.alignment = alignment;
+	Transforms.blockStride = ((blockSize + alignment - 1) / alignment) * alignment;
+	Transforms.count = 0;
+
+	// One frame holds the camera plus MODEL_RING_BLOCKS model ranges
+	initStreamBuffer(&UniformStream, GL_UNIFORM_BUFFER, (MODEL_RING_BLOCKS + 1) * Transforms.blockStride);
+	initStreamBuffer(&VertexStream, GL_ARRAY_BUFFER, 16384 * STREAM_VERTEX_STRIDE);
 }
 
-void createPowerBoard(){
-	double leftoffset = -280;
-	double width = 260;
-	double topoffset = -240;
-	double height = 15;
-	double innerratio = 0.83;
+/* Attach the Camera and Models blocks of a program to the shared binding points */
+GLint bindTransformBlocks (GLuint program)
+{
+	GLuint cameraIndex = glGetUniformBlockIndex(program, "Camera");
+	GLuint modelsIndex = glGetUniformBlockIndex(program, "Models");
+	if(cameraIndex != GL_INVALID_INDEX)
+		glUniformBlockBinding(program, cameraIndex, UBO_CAMERA_BINDING);
+	if(modelsIndex != GL_INVALID_INDEX)
+		glUniformBlockBinding(program, modelsIndex, UBO_MODELS_BINDING);
+	return glGetUniformLocation(program, "modelIndex");
+}
 
-	static  GLfloat vertex_buffer_data[] = {
-		leftoffset - width, topoffset - height, 0,
-		leftoffset + width, topoffset - height, 0,
-		leftoffset - width, topoffset + height, 0,
+/* Upload the view-projection once per frame */
+void setCameraTransform (const glm::mat4& VP)
+{
+	GLintptr offset = streamAlloc(&UniformStream, sizeof(glm::mat4), Transforms.alignment);
+	if(offset < 0)
+		return;
+	streamUpload(&UniformStream, offset, &VP[0][0], sizeof(glm::mat4));
+	glBindBufferRange(GL_UNIFORM_BUFFER, UBO_CAMERA_BINDING, UniformStream.BufferID, offset, sizeof(glm::mat4));
+}
 
-		leftoffset + width, topoffset - height, 0,
-		leftoffset - width, topoffset + height, 0,
-		leftoffset + width, topoffset + height, 0,
+/***********************
+ * Render command list *
+ ***********************/
+
+/* Painter's order of the scene, everything sits at z = 0 so a later layer wins.
+   Layers below LAYER_FIRST_DYNAMIC only move with the camera and are cached, see StaticLayer */
+enum RenderLayer {
+	LAYER_BACKGROUND = 0,
+	LAYER_FLOOR,
+	LAYER_PIGS,
+	LAYER_FIRST_DYNAMIC = LAYER_PIGS,
+	LAYER_LOGS,
+	LAYER_BAND_BACK,
+	LAYER_BIRD,
+	LAYER_BAND_FRONT,
+	LAYER_WIDGETS, // Power board, power bar and score, one retained draw, see Widgets
+	LAYER_HUD     // Screen space overlay, see recordPerfHud
+};
 
-		leftoffset - width * innerratio, topoffset - height * innerratio, 0,
-		leftoffset + width * innerratio, topoffset - height * innerratio, 0,
-		leftoffset - width * innerratio, topoffset + height * innerratio, 0,
+/* Simulated objects whose transform is blended between simulation steps, see interpolateBodies */
+enum Body {
+	BODY_NONE = -1,
+	BODY_BIRD,
+	BODY_PIGS,                  // One per pig
+	BODY_LOGS = BODY_PIGS + 6,  // One per wood log
+	BODY_COUNT = BODY_LOGS + 6
+};
 
-		leftoffset + width * innerratio, topoffset - height * innerratio, 0,
-		leftoffset - width * innerratio, topoffset + height * innerratio, 0,
-		leftoffset + width * innerratio, topoffset + height * innerratio, 0,
-		
-	};
-	static GLfloat color_buffer_data[] = {
-		228.0f/255.0f,142.0f/255.0f,57.0f/255.0f,
-		228.0f/255.0f,142.0f/255.0f,57.0f/255.0f,
-		228.0f/255.0f,142.0f/255.0f,57.0f/255.0f,
-		228.0f/255.0f,142.0f/255.0f,57.0f/255.0f,
-		228.0f/255.0f,142.0f/255.0f,57.0f/255.0f,
-		228.0f/255.0f,142.0f/255.0f,57.0f/255.0f,
-		
-		123.0f/255.0f,187.0f/255.0f,70.0f/255.0f,
-		123.0f/255.0f,187.0f/255.0f,70.0f/255.0f,
-		123.0f/255.0f,187.0f/255.0f,70.0f/255.0f,
-		123.0f/255.0f,187.0f/255.0f,70.0f/255.0f,
-		123.0f/255.0f,187.0f/255.0f,70.0f/255.0f,
-		123.0f/255.0f,187.0f/255.0f,70.0f/255.0f
-	};
+struct RenderCommand {
+	unsigned long long key; // layer | depth | program | texture | vao, filled in by sortRenderList
+	GLuint program;
+	GLuint texture;
+	VAO* vao;
+	GLenum mode;    // Primitive mode, kept here as streamed commands share streamVAO/spriteVAO
+	int layer;
+	float depth;    // Orders commands inside a layer, smaller z is drawn first
+	int matrix;     // Index into RenderList::models
+	int first;      // Vertex range to draw
+	int count;
+	int body;       // Body whose transform models[matrix] is, BODY_NONE for everything else
+};
 
-	powerboard = create3DObject(GL_TRIANGLES, 4*3 ,GAME_SCOREBOARD, vertex_buffer_data, color_buffer_data, -400 + 30, -270 +15, 30, GL_FILL);
+/* Everything needed to draw one frame. Recording does not touch GL,
+   so the list can be built on any thread and handed to the GL thread */
+struct RenderList {
+	glm::mat4 VP;
+	int width, height; // Viewport, 0 keeps the current one
+	double inputTime;  // Latest input event the simulation had seen when recording
+	glm::vec4 viewBounds; // Visible x min, x max, y min, y max; culls recording and keys the static layer
+	int drawn, culled;    // Objects recorded and objects skipped by culling
+	double cpuSeconds;    // Spent simulating and recording, then submitting
+	vector<RenderCommand> commands;
+	vector<glm::mat4> models;
+	vector<GLfloat> streamVertices; // Interleaved position/colour (streamVAO), position/uv (spriteVAO) or position/uv/colour (textVAO)
+	double stepTime;                // gameTime when the simulation recorded the list
+	glm::mat4 bodies[BODY_COUNT];   // Transform of each body at this step
+	glm::mat4 previous[BODY_COUNT]; // and at the step before
+	unsigned char hasBody[BODY_COUNT], hadBody[BODY_COUNT];
+};
+
+RenderList frameList;
+VAO* streamVAO;
+VAO* spriteVAO; // Every sprite, textured from the atlas
+VAO* textVAO;   // Every glyph, from the glyph atlas
+
+/* GL state last set by the submission, so unchanged state is not sent again */
+struct RenderState {
+	GLuint program;
+	GLuint vertexArray;
+	GLuint texture;
+	GLenum fillMode;
+	GLint modelIndexID;
+	GLintptr streamBase; // First vertex of this frame's streamVertices in VertexStream
+	int drawCalls;       // Sent this frame, for the HUD
+	long vertices;
+} Submitted;
+
+void clearRenderList (RenderList& list)
+{
+	list.width = list.height = 0;
+	list.inputTime = 0;
+	list.viewBounds = glm::vec4(0, 0, 0, 0);
+	list.drawn = list.culled = 0;
+	list.cpuSeconds = 0;
+	list.commands.clear();
+	list.models.clear();
+	list.streamVertices.clear();
+	list.stepTime = 0;
+	memset(list.hasBody, 0, sizeof(list.hasBody));
+	memset(list.hadBody, 0, sizeof(list.hadBody));
 }
 
-void createPig ()
+RenderCommand& addRenderCommand (RenderList& list, GLuint program, VAO* vao, const glm::mat4& model, int layer, float depth)
 {
-	// GL3 accepts only Triangles. Quads are not supported
-	double n=30;
-	static GLfloat vertex_buffer_data[6][9*30+2*3 +9*15*2 + 9*15*2 + 9*15 + 9*15 * 2];
-	static GLfloat color_buffer_data[6][9*30+2*3 + 9*15*2 + 9*15*2 + 9*15 + 9*15 * 2];
-	double sizea[6]={18 + 5, 23 +5 , 20 + 5, 25 + 5, 20 + 5, 28 + 5},sizeb[6]={18, 23, 20, 25, 20, 28};
-	double eyeline = 0.5;
-	float angle=0;
-	for(int j=0;j<6;j++)
-		for(int i=0;i<n;i++){
-			vertex_buffer_data[j][9*i] = vertex_buffer_data[j][9*i+1] = vertex_buffer_data[j][9*i+2] = 0;
-			vertex_buffer_data[j][9*i+3]=sizea[j]*cos(angle*M_PI/180.0f);
-			vertex_buffer_data[j][9*i+4]=sizeb[j]*sin(angle*M_PI/180.0f);
-			vertex_buffer_data[j][9*i+5]=0;
-			angle += 360.0f/n;
-			vertex_buffer_data[j][9*i+6]=sizea[j]*cos(angle*M_PI/180.0f);
-			vertex_buffer_data[j][9*i+7]=sizeb[j]*sin(angle*M_PI/180.0f);
-			vertex_buffer_data[j][9*i+8]=0;
+	RenderCommand c;
+	c.key = 0;
+	c.program = program;
+	c.texture = vao ? vao->TextureID : 0;
+	c.vao = vao;
+	c.mode = vao ? vao->PrimitiveMode : GL_TRIANGLES;
+	c.layer = layer;
+	c.depth = depth;
+	c.matrix = list.models.size();
+	c.first = vao ? vao->FirstVertex : 0;
+	c.count = vao ? vao->NumVertices : 0;
+	c.body = BODY_NONE;
+	list.models.push_back(model);
+	list.commands.push_back(c);
+	list.drawn++;
+	return list.commands.back();
+}
 
-			color_buffer_data[j][9*i] = 114.0f/255.0f;
-			color_buffer_data[j][9*i+1] = 194.0f/255.0f;
-			color_buffer_data[j][9*i+2] = 65.0f/255.0f;
-			color_buffer_data[j][9*i+3] = 114.0f/255.0f;
-			color_buffer_data[j][9*i+4] = 194.0f/255.0f;
-			color_buffer_data[j][9*i+5] = 65.0f/255.0f;
-			color_buffer_data[j][9*i+6] = 114.0f/255.0f;
-			color_buffer_data[j][9*i+7] = 194.0f/255.0f;
-			color_buffer_data[j][9*i+8] = 65.0f/255.0f;
-		}
-	angle = 0;
-	float ap;
-	for(int j=0;j<6;j++,angle=0)
-		for(int i=n;i<2*n;i++){
-			if(i<n+(n/2))
-				ap = sizea[j]/2;
-			else
-				ap = -sizea[j]/2;
-			if(i==n+n/2) angle = 0;
-			vertex_buffer_data[j][9*i]=ap,vertex_buffer_data[j][9*i+1]=-0.5,vertex_buffer_data[j][9*i+2] = 0;
-			vertex_buffer_data[j][9*i+3]=ap+0.25*sizea[j]*cos(angle*M_PI/180.0f);
-			vertex_buffer_data[j][9*i+4]=-0.5+0.25*sizea[j]*sin(angle*M_PI/180.0f);
-			vertex_buffer_data[j][9*i+5]=0;
-			angle += 360.0f/(n/2);
-			vertex_buffer_data[j][9*i+6]=ap+0.25*sizea[j]*cos(angle*M_PI/180.0f);
-			vertex_buffer_data[j][9*i+7]=-0.5+0.25*sizea[j]*sin(angle*M_PI/180.0f);
-			vertex_buffer_data[j][9*i+8]=0;
+/* Whether vao's bounding box moved by model overlaps the list's view, always true if the list has no view */
+bool isVisible (RenderList& list, VAO* vao, const glm::mat4& model)
+{
+	const glm::vec4& view = list.viewBounds;
+	if(view.x >= view.y || vao->Vertices.empty())
+		return true;
 
-			color_buffer_data[j][9*i] = 1;//.0f/255.0f;
-			color_buffer_data[j][9*i+1] = 1;//194.0f/255.0f;
-			color_buffer_data[j][9*i+2] = 1;//65.0f/255.0f;
-			color_buffer_data[j][9*i+3] = 1;//114.0f/255.0f;
-			color_buffer_data[j][9*i+4] = 1;//194.0f/255.0f;
-			color_buffer_data[j][9*i+5] = 1;//65.0f/255.0f;
-			color_buffer_data[j][9*i+6] = 1;//114.0f/255.0f;
-			color_buffer_data[j][9*i+7] = 1;//194.0f/255.0f;
-			color_buffer_data[j][9*i+8] = 1;//65.0f/255.0f;
-		}
-	for(int j=0;j<6;j++,angle=0)
-		for(int i=2*n;i<3*n;i++){
-			if(i<2*n+(n/2))
-				ap = 0.41*sizea[j];
-			else
-				ap = -0.41*sizea[j];
-			if(i==2*n+n/2) angle = 0;
-			vertex_buffer_data[j][9*i]=ap,vertex_buffer_data[j][9*i+1]=-0.5,vertex_buffer_data[j][9*i+2] = 0;
-			vertex_buffer_data[j][9*i+3]=ap+0.1*sizea[j]*cos(angle*M_PI/180.0f);
-			vertex_buffer_data[j][9*i+4]=-0.5+0.1*sizea[j]*sin(angle*M_PI/180.0f);
-			vertex_buffer_data[j][9*i+5]=0;
-			angle += 360.0f/(n/2);
-			vertex_buffer_data[j][9*i+6]=ap+0.1*sizea[j]*cos(angle*M_PI/180.0f);
-			vertex_buffer_data[j][9*i+7]=-0.5+0.1*sizea[j]*sin(angle*M_PI/180.0f);
-			vertex_buffer_data[j][9*i+8]=0;
+	glm::vec2 lo, hi;
+	for(int i=0;i<4;i++){
+		glm::vec4 corner(i & 1 ? vao->boundsMax.x : vao->boundsMin.x, i & 2 ? vao->boundsMax.y : vao->boundsMin.y, 0, 1);
+		glm::vec4 p = model * corner;
+		glm::vec2 q(p.x, p.y);
+		lo = i ? glm::min(lo, q) : q;
+		hi = i ? glm::max(hi, q) : q;
+	}
+	if(hi.x < view.x || lo.x > view.y || hi.y < view.z || lo.y > view.w){
+		list.culled++;
+		return false;
+	}
+	return true;
+}
 
-			color_buffer_data[j][9*i] = 0;//.0f/255.0f;
-			color_buffer_data[j][9*i+1] = 0;//194.0f/255.0f;
-			color_buffer_data[j][9*i+2] = 0;//65.0f/255.0f;
-			color_buffer_data[j][9*i+3] = 0;//114.0f/255.0f;
-			color_buffer_data[j][9*i+4] = 0;//194.0f/255.0f;
-			color_buffer_data[j][9*i+5] = 0;//65.0f/255.0f;
-			color_buffer_data[j][9*i+6] = 0;//114.0f/255.0f;
-			color_buffer_data[j][9*i+7] = 0;//194.0f/255.0f;
-			color_buffer_data[j][9*i+8] = 0;//65.0f/255.0f;
+/* Record a draw of a static VAO */
+void recordDraw (RenderList& list, GLuint program, VAO* vao, const glm::mat4& model, int layer, float depth=0)
+{
+	if(!isVisible(list, vao, model))
+		return;
+	addRenderCommand(list, program, vao, model, layer, depth);
+}
+
+/* Record a draw of a simulated object, its transform is interpolated at submit */
+void recordBody (RenderList& list, GLuint program, VAO* vao, const glm::mat4& model, int layer, int body)
+{
+	list.bodies[body] = model;
+	list.hasBody[body] = 1;
+	if(!isVisible(list, vao, model))
+		return;
+	addRenderCommand(list, program, vao, model, layer, 0).body = body;
+}
+
+/* Record source's vertices transformed by model as dynamic geometry, uploaded to the vertex stream at submit */
+void recordStreamed (RenderList& list, GLuint program, VAO* source, const glm::mat4& model, int layer, float depth=0)
+{
+	if(!isVisible(list, source, model))
+		return;
+	int first = list.streamVertices.size() / 6;
+	for(int i=0;i<source->NumVertices;i++){
+		const GLfloat* v = &source->Vertices[3*i];
+		glm::vec4 p = model * glm::vec4(v[0], v[1], v[2], 1);
+		list.streamVertices.push_back(p.x);
+		list.streamVertices.push_back(p.y);
+		list.streamVertices.push_back(p.z);
+		list.streamVertices.push_back(source->Colors[3*i]);
+		list.streamVertices.push_back(source->Colors[3*i+1]);
+		list.streamVertices.push_back(source->Colors[3*i+2]);
+	}
+	RenderCommand& c = addRenderCommand(list, program, streamVAO, glm::mat4(1.0f), layer, depth);
+	c.first = first;
+	c.count = source->NumVertices;
+	c.mode = source->PrimitiveMode;
+}
+
+/* Append a string as one quad per glyph in the font program's vertex layout,
+   in ems from the pen at the origin of model. The colour goes in the last
+   float of each vertex, so any number of strings can be drawn with one call */
+void appendText (vector<GLfloat>& out, const char* str, const glm::vec3& color, const glm::mat4& model)
+{
+	static const int corners[6][2] = { {0,0}, {0,1}, {1,0}, {0,1}, {1,0}, {1,1} };
+	GLfloat packed = packColor(color);
+	float pen = 0;
+	for(const char* s=str;*s;s++){
+		int index = (unsigned char)*s - GLYPH_FIRST;
+		if(index < 0 || index >= GLYPH_COUNT)
+			index = '?' - GLYPH_FIRST;
+		const Glyph& g = Glyphs.glyphs[index];
+		if(g.x1 > g.x0){
+			for(int i=0;i<6;i++){
+				glm::vec4 p = model * glm::vec4(pen + (corners[i][0] ? g.x1 : g.x0), corners[i][1] ? g.y1 : g.y0, 0, 1);
+				out.push_back(p.x);
+				out.push_back(p.y);
+				out.push_back(p.z);
+				out.push_back(corners[i][0] ? g.u1 : g.u0);
+				out.push_back(corners[i][1] ? g.v1 : g.v0);
+				out.push_back(packed);
+			}
 		}
-	angle = 0;
+		pen += g.advance;
+	}
+}
+
+/* Append a flat coloured mesh transformed by model in the font program's vertex layout */
+void appendFlatMesh (vector<GLfloat>& out, VAO* source, const glm::mat4& model)
+{
+	for(int i=0;i<source->NumVertices;i++){
+		const GLfloat* v = &source->Vertices[3*i];
+		glm::vec4 p = model * glm::vec4(v[0], v[1], v[2], 1);
+		out.push_back(p.x);
+		out.push_back(p.y);
+		out.push_back(p.z);
+		out.push_back(Glyphs.solidU);
+		out.push_back(Glyphs.solidV);
+		out.push_back(packColor(glm::vec3(source->Colors[3*i], source->Colors[3*i+1], source->Colors[3*i+2])));
+	}
+}
+
+/* Record a string drawn from the glyph atlas, through the frame's vertex stream */
+void recordText (RenderList& list, const char* str, const glm::vec3& color, const glm::mat4& model, int layer, float depth=0)
+{
+	int first = list.streamVertices.size() / 6;
+	appendText(list.streamVertices, str, color, model);
+	int count = list.streamVertices.size() / 6 - first;
+	if(count == 0)
+		return;
+	RenderCommand& c = addRenderCommand(list, fontProgramID, textVAO, glm::mat4(1.0f), layer, depth);
+	c.first = first;
+	c.count = count;
+}
+
+/* Pack the 64-bit sort key: layer 8 | depth 16 | program 8 | texture 16 | vao 16 */
+unsigned long long makeRenderKey (const RenderCommand& c)
+{
+	int depth = (int)((c.depth + 512.0f) * 64.0f);
+	depth = max(0, min(65535, depth));
+	unsigned long long key = (unsigned long long)(c.layer & 0xFF) << 56;
+	key |= (unsigned long long)depth << 40;
+	key |= (unsigned long long)(c.program & 0xFF) << 32;
+	key |= (unsigned long long)(c.texture & 0xFFFF) << 16;
+	key |= (unsigned long long)(c.vao ? c.vao->VertexArrayID & 0xFFFF : 0);
+	return key;
+}
+
+bool renderKeyLess (const RenderCommand& a, const RenderCommand& b)
+{
+	return a.key < b.key;
+}
+
+/* Order commands by key; equal keys keep their recording order */
+void sortRenderList (RenderList& list)
+{
+	for(size_t i=0;i<list.commands.size();i++)
+		list.commands[i].key = makeRenderKey(list.commands[i]);
+	stable_sort(list.commands.begin(), list.commands.end(), renderKeyLess);
+}
+
+/* Whether streamed command next continues the draw started by c that ends at vertex end */
+bool canMergeDraws (const RenderCommand& next, const RenderCommand& c, int end)
+{
+	if(next.vao != c.vao || next.mode != c.mode || next.texture != c.texture || next.first != end)
+		return false;
+	// Strips and fans would join up with the previous run
+	return c.mode == GL_TRIANGLES || c.mode == GL_LINES || c.mode == GL_POINTS;
+}
+
+/* Upload the staged matrices into the next model range and issue the pending commands */
+void flushRenderBatch (RenderList& list)
+{
+	if(Transforms.count == 0)
+		return;
+
+	// The whole range is reserved since the shader declares all MODEL_BLOCK_SLOTS matrices
+	GLintptr offset = streamAlloc(&UniformStream, Transforms.blockStride, Transforms.alignment);
+	if(offset >= 0){
+		streamUpload(&UniformStream, offset, &Transforms.staging[0][0][0], Transforms.count * sizeof(glm::mat4));
+		glBindBufferRange(GL_UNIFORM_BUFFER, UBO_MODELS_BINDING, UniformStream.BufferID, offset, MODEL_BLOCK_SLOTS * sizeof(glm::mat4));
+
+		for(size_t i=0;i<Transforms.pending.size();i++){
+			const RenderCommand& c = *Transforms.pending[i];
+			glUniform1i(Submitted.modelIndexID, i);
+			if(c.vao->FillMode != Submitted.fillMode){
+				glPolygonMode (GL_FRONT_AND_BACK, c.vao->FillMode);
+				Submitted.fillMode = c.vao->FillMode;
+			}
+			if(c.vao->VertexArrayID != Submitted.vertexArray){
+				glBindVertexArray (c.vao->VertexArrayID);
+				Submitted.vertexArray = c.vao->VertexArrayID;
+			}
+			if(c.texture != Submitted.texture){
+				glBindTexture(GL_TEXTURE_2D, c.texture);
+				Submitted.texture = c.texture;
+			}
+			int first = c.first, count = c.count;
+			if(c.vao == streamVAO || c.vao == spriteVAO || c.vao == textVAO){
+				// Streamed vertices are already in world space, so runs that
+				// follow each other in the stream go out as one draw
+				while(i+1 < Transforms.pending.size() && canMergeDraws(*Transforms.pending[i+1], c, first + count)){
+					count += Transforms.pending[i+1]->count;
+					i++;
+				}
+				if(Submitted.streamBase < 0)
+					continue;
+				first += Submitted.streamBase;
+			}
+			glDrawArrays(c.mode, first, count);
+			Submitted.drawCalls++;
+			Submitted.vertices += count;
+		}
+	}
+
+	Transforms.pending.clear();
+	Transforms.count = 0;
+}
+
+GLint modelIndexLocation (GLuint program)
+{
+	if(program == textureProgramID)
+		return Matrices.TexModelIndexID;
+	if(program == fontProgramID)
+		return Glyphs.modelIndexID;
+	if(program == ellipseProgramID)
+		return Matrices.EllipseModelIndexID;
+	if(program == groundProgramID)
+		return Matrices.GroundModelIndexID;
+	return Matrices.ModelIndexID;
+}
+
+/* Queue one command for the next flush, switching program first if needed */
+void queueRenderCommand (RenderList& list, const RenderCommand& c, const glm::mat4& model)
+{
+	if(c.program != Submitted.program){
+		flushRenderBatch(list);
+		glUseProgram(c.program);
+		// Only the ellipse program blends, its edges are anti-aliased through alpha
+		if(c.program == ellipseProgramID)
+			glEnable(GL_BLEND);
+		else if(Submitted.program == ellipseProgramID)
+			glDisable(GL_BLEND);
+		Submitted.program = c.program;
+		Submitted.modelIndexID = modelIndexLocation(c.program);
+	}
+	if(Transforms.count == MODEL_BLOCK_SLOTS)
+		flushRenderBatch(list);
+	Transforms.staging[Transforms.count++] = model;
+	Transforms.pending.push_back(&c);
+}
+
+/* Issue the sorted commands [begin, end) */
+void submitCommands (RenderList& list, size_t begin, size_t end)
+{
+	for(size_t i=begin;i<end;i++){
+		// Every pass is timed on its own, its draws may not share a batch with the previous pass
+		int pass = gpuPassOfLayer(list.commands[i].layer);
+		if(gpuPassChanges(pass)){
+			flushRenderBatch(list);
+			beginGpuPass(pass);
+		}
+		queueRenderCommand(list, list.commands[i], list.models[list.commands[i].matrix]);
+	}
+	flushRenderBatch(list);
+	endGpuPass();
+}
+
+/*****************
+ * Interpolation *
+ *****************/
+
+/* Simulation step of the threaded and --fixed-tick modes, the physics was tuned for 60 steps per second */
+#define SIM_TICK (1.0/60.0)
+/* A body that moved further than this in one step was put back, not moved, and is shown where it landed */
+#define INTERPOLATE_SNAP 100.0f
+
+/* Between two simulation steps a display faster than SIM_TICK would show the
+   same positions several times and then jump. Each list carries its bodies'
+   transforms at its step and at the step before, and they are blended by how
+   far the display is into the next step */
+struct Interpolation {
+	int enabled;
+	int fixedTick;              // The single threaded loop steps at SIM_TICK instead of once per frame
+	double accumulator;         // Time the single threaded loop has not stepped yet
+	double lastFrame;
+	glm::mat4 last[BODY_COUNT]; // Transforms the simulation recorded last step
+	unsigned char hasLast[BODY_COUNT];
+} Interpolate = {1, 0};
+
+/* Called by the simulation once a step is recorded: hand the list the step before's transforms */
+void finishStep (RenderList& list)
+{
+	memcpy(list.previous, Interpolate.last, sizeof(list.previous));
+	memcpy(list.hadBody, Interpolate.hasLast, sizeof(list.hadBody));
+	memcpy(Interpolate.last, list.bodies, sizeof(Interpolate.last));
+	memcpy(Interpolate.hasLast, list.hasBody, sizeof(Interpolate.hasLast));
+	list.stepTime = gameTime();
+}
+
+/* Set the model matrix of every body in list alpha of the way from the step before to the
+   list's step. Only reads bodies and previous, so a list can be drawn again with a later alpha.
+   Matrices are blended component-wise, a step turns a body by a few degrees at most */
+void interpolateBodies (RenderList& list, float alpha)
+{
+	PROFILE_SCOPE("interpolate");
+	if(!Interpolate.enabled)
+		alpha = 1;
+	alpha = min(max(alpha, 0.0f), 1.0f);
+	for(size_t i=0;i<list.commands.size();i++){
+		const RenderCommand& c = list.commands[i];
+		if(c.body == BODY_NONE)
+			continue;
+		const glm::mat4& to = list.bodies[c.body];
+		const glm::mat4& from = list.previous[c.body];
+		float dx = to[3].x - from[3].x, dy = to[3].y - from[3].y;
+		glm::mat4& model = list.models[c.matrix];
+		model = to;
+		if(alpha < 1 && list.hadBody[c.body] && dx*dx + dy*dy < INTERPOLATE_SNAP*INTERPOLATE_SNAP){
+			for(int k=0;k<4;k++)
+				model[k] = from[k]*(1 - alpha) + to[k]*alpha;
+		}
+	}
+}
+
+/**************
+ * GPU timers *
+ **************/
+
+/* GL_TIME_ELAPSED queries around each pass of submitRenderList. A frame's
+   results are read GPU_TIMER_FRAMES frames later when the GPU is long done
+   with them, so reading never waits; one that is still not there is dropped */
+#define GPU_TIMER_FRAMES 4
+
+enum GpuPass {
+	PASS_BACKGROUND = 0,
+	PASS_FLOOR,
+	PASS_STATIC,   // Compositing the two above from the static layer cache
+	PASS_PIGS,
+	PASS_LOGS,
+	PASS_BIRD,     // Bird, catapult and band
+	PASS_WIDGETS,  // Power board, power bar and score
+	PASS_HUD,
+	PASS_COUNT
+};
+
+const char* gpuPassNames[PASS_COUNT] = {"background", "floor", "static", "pigs", "logs", "bird", "widgets", "hud"};
+
+struct GpuTimerRing {
+	int enabled;
+	GLuint queries[GPU_TIMER_FRAMES][PASS_COUNT];
+	int issued[GPU_TIMER_FRAMES][PASS_COUNT];
+	int slot;                // Frame being recorded
+	int active;              // Pass being drawn, -1 for none
+	int timing;              // Whether active's query is running, it is not when the pass came up earlier in the frame
+	double sum[PASS_COUNT];  // Milliseconds since the last report
+	int frames;              // Frames read back since the last report
+	int dropped;
+	double last;             // Milliseconds of the latest frame read back, all passes
+} GpuTimers = {1};
+
+int gpuPassOfLayer (int layer)
+{
+	switch(layer){
+		case LAYER_BACKGROUND: return PASS_BACKGROUND;
+		case LAYER_FLOOR: return PASS_FLOOR;
+		case LAYER_PIGS: return PASS_PIGS;
+		case LAYER_LOGS: return PASS_LOGS;
+		case LAYER_WIDGETS: return PASS_WIDGETS;
+		case LAYER_HUD: return PASS_HUD;
+		default: return PASS_BIRD;
+	}
+}
+
+/* Read back the frame GPU_TIMER_FRAMES ago and reuse its queries for this one */
+void beginGpuTimerFrame ()
+{
+	if(!GpuTimers.enabled)
+		return;
+	if(GpuTimers.queries[0][0] == 0){
+		glGenQueries(GPU_TIMER_FRAMES * PASS_COUNT, &GpuTimers.queries[0][0]);
+		GpuTimers.active = -1;
+	}
+	GpuTimers.slot = (GpuTimers.slot + 1) % GPU_TIMER_FRAMES;
+	int slot = GpuTimers.slot, read = 0;
+	double total = 0;
+	for(int pass=0;pass<PASS_COUNT;pass++){
+		if(!GpuTimers.issued[slot][pass])
+			continue;
+		GLint available = 0;
+		glGetQueryObjectiv(GpuTimers.queries[slot][pass], GL_QUERY_RESULT_AVAILABLE, &available);
+		if(available){
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v(GpuTimers.queries[slot][pass], GL_QUERY_RESULT, &elapsed);
+			GpuTimers.sum[pass] += elapsed / 1e6;
+			total += elapsed / 1e6;
+		}
+		else
+			GpuTimers.dropped++;
+		GpuTimers.issued[slot][pass] = 0;
+		read = 1;
+	}
+	if(read){
+		GpuTimers.frames++;
+		GpuTimers.last = total;
+	}
+}
+
+/* 1 if commands of this pass are not drawn in the current pass */
+int gpuPassChanges (int pass)
+{
+	return GpuTimers.enabled && pass != GpuTimers.active;
+}
+
+void endGpuPass ()
+{
+	if(GpuTimers.timing)
+		glEndQuery(GL_TIME_ELAPSED);
+	GpuTimers.active = -1;
+	GpuTimers.timing = 0;
+}
+
+/* Queries cannot nest, so this ends the running one. A pass seen twice in a frame
+   is timed the first time only, but still becomes the current pass */
+void beginGpuPass (int pass)
+{
+	endGpuPass();
+	if(!GpuTimers.enabled)
+		return;
+	GpuTimers.active = pass;
+	if(GpuTimers.issued[GpuTimers.slot][pass])
+		return;
+	glBeginQuery(GL_TIME_ELAPSED, GpuTimers.queries[GpuTimers.slot][pass]);
+	GpuTimers.issued[GpuTimers.slot][pass] = 1;
+	GpuTimers.timing = 1;
+}
+
+/* Average GPU milliseconds per frame of every pass since the last report */
+void reportGpuTimers (const char* mode)
+{
+	if(!GpuTimers.enabled || GpuTimers.frames == 0)
+		return;
+	double total = 0;
+	printf("%s: GPU ms/frame", mode);
+	for(int pass=0;pass<PASS_COUNT;pass++){
+		printf(" %s %.3f", gpuPassNames[pass], GpuTimers.sum[pass]/GpuTimers.frames);
+		total += GpuTimers.sum[pass];
+		GpuTimers.sum[pass] = 0;
+	}
+	printf(", total %.3f (%d results dropped)\n", total/GpuTimers.frames, GpuTimers.dropped);
+	GpuTimers.frames = GpuTimers.dropped = 0;
+}
+
+/************
+ * Overdraw *
+ ************/
+
+/* Debug view of where fill rate goes. While it is on every fragment written
+   increments the stencil of its pixel, then the stencil is shown as a heatmap
+   with one full screen quad per level. An occlusion query around each quad
+   counts the pixels at that level, so the average and maximum overdraw come
+   without reading the stencil back. Fragments a shader discards (the outside
+   of glyphs) are not counted */
+#define OVERDRAW_LEVELS 16  // The last level also holds every pixel drawn more often
+#define OVERDRAW_FRAMES 4   // Queries are read back this many frames late, like the GPU timers
+
+struct OverdrawView {
+	std::atomic<int> enabled; // Toggled by O on the input thread, read by the GL thread
+	GLuint program;
+	GLint colorID;
+	GLuint vertexArray;
+	GLuint queries[OVERDRAW_FRAMES][OVERDRAW_LEVELS + 1];
+	int issued[OVERDRAW_FRAMES];
+	int slot;
+	double fragments;  // Counted since the last report
+	double pixels;
+	int maximum;       // Highest level since the last report
+	int frames;
+	int dropped;
+} Overdraw;
+
+/* Black for untouched pixels, then blue through green, yellow and red to white */
+glm::vec3 overdrawColor (int level)
+{
+	static const glm::vec3 ramp[6] = {glm::vec3(0.0f, 0.0f, 0.6f), glm::vec3(0.0f, 0.6f, 0.9f), glm::vec3(0.1f, 0.8f, 0.2f),
+			glm::vec3(0.95f, 0.9f, 0.1f), glm::vec3(0.95f, 0.25f, 0.1f), glm::vec3(1.0f, 1.0f, 1.0f)};
+	if(level == 0)
+		return glm::vec3(0, 0, 0);
+	float t = (level - 1) * 5.0f / (OVERDRAW_LEVELS - 1);
+	int i = min((int)t, 4);
+	float f = t - i;
+	return ramp[i]*(1 - f) + ramp[i+1]*f;
+}
+
+void createOverdrawView ()
+{
+	static const char* vertex =
+		"#version 330 core\n"
+		"layout (location = 0) in vec2 vertexPosition;\n"
+		"void main () { gl_Position = vec4(vertexPosition, 0, 1); }\n";
+	static const char* fragment =
+		"#version 330 core\n"
+		"uniform vec3 levelColor;\n"
+		"out vec3 color;\n"
+		"void main () { color = levelColor; }\n";
+	Overdraw.program = CompileShaders(vertex, fragment, "overdraw vertex", "overdraw fragment");
+	Overdraw.colorID = glGetUniformLocation(Overdraw.program, "levelColor");
+
+	// The whole screen in clip space
+	static const GLfloat quad [] = {-1,-1, 1,-1, -1,1, 1,1};
+	GLuint buffer;
+	glGenVertexArrays(1, &Overdraw.vertexArray);
+	glBindVertexArray(Overdraw.vertexArray);
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+	glEnableVertexAttribArray(0);
+	glBindVertexArray(0);
+	bufferBytes += sizeof(quad);
+
+	glGenQueries(OVERDRAW_FRAMES * (OVERDRAW_LEVELS + 1), &Overdraw.queries[0][0]);
+}
+
+/* Read back the frame OVERDRAW_FRAMES ago, then count this one into the stencil */
+void beginOverdrawCount ()
+{
+	if(Overdraw.program == 0)
+		createOverdrawView();
+	Overdraw.slot = (Overdraw.slot + 1) % OVERDRAW_FRAMES;
+	int slot = Overdraw.slot;
+	if(Overdraw.issued[slot]){
+		// Queries finish in order, so the last one being done means they all are
+		GLint available = 0;
+		glGetQueryObjectiv(Overdraw.queries[slot][OVERDRAW_LEVELS], GL_QUERY_RESULT_AVAILABLE, &available);
+		if(available){
+			for(int level=0;level<=OVERDRAW_LEVELS;level++){
+				GLuint count = 0;
+				glGetQueryObjectuiv(Overdraw.queries[slot][level], GL_QUERY_RESULT, &count);
+				Overdraw.pixels += count;
+				Overdraw.fragments += (double)count * level;
+				if(count > 0)
+					Overdraw.maximum = max(Overdraw.maximum, level);
+			}
+			Overdraw.frames++;
+		}
+		else
+			Overdraw.dropped++;
+		Overdraw.issued[slot] = 0;
+	}
+	// Depth failed fragments were shaded too, so they count
+	glEnable(GL_STENCIL_TEST);
+	glStencilMask(0xFF);
+	glStencilFunc(GL_ALWAYS, 0, 0xFF);
+	glStencilOp(GL_KEEP, GL_INCR, GL_INCR);
+}
+
+/* Replace the frame with the heatmap of the counts, one quad per level */
+void drawOverdrawHeatmap ()
+{
+	int slot = Overdraw.slot;
+	glDisable(GL_DEPTH_TEST);
+	glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+	glUseProgram(Overdraw.program);
+	glBindVertexArray(Overdraw.vertexArray);
+	for(int level=0;level<=OVERDRAW_LEVELS;level++){
+		// GL_LEQUAL passes where level <= stencil
+		glStencilFunc(level < OVERDRAW_LEVELS ? GL_EQUAL : GL_LEQUAL, level, 0xFF);
+		glm::vec3 color = overdrawColor(level);
+		glUniform3fv(Overdraw.colorID, 1, &color[0]);
+		glBeginQuery(GL_SAMPLES_PASSED, Overdraw.queries[slot][level]);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		glEndQuery(GL_SAMPLES_PASSED);
+	}
+	Overdraw.issued[slot] = 1;
+	glBindVertexArray(0);
+	glDisable(GL_STENCIL_TEST);
+	glEnable(GL_DEPTH_TEST);
+}
+
+void toggleOverdraw ()
+{
+	int enabled = Overdraw.enabled ^= 1;
+	printf("Overdraw view %s\n", enabled ? "on" : "off");
+}
+
+/* Average fragments per pixel and the most any pixel got since the last report */
+void reportOverdraw (const char* mode)
+{
+	if(Overdraw.frames == 0 || Overdraw.pixels == 0)
+		return;
+	printf("%s: overdraw %.2f average, %s%d max, %.2f M fragments per frame (%d results dropped)\n", mode,
+			Overdraw.fragments/Overdraw.pixels, Overdraw.maximum >= OVERDRAW_LEVELS ? ">=" : "", Overdraw.maximum,
+			Overdraw.fragments/Overdraw.frames/1e6, Overdraw.dropped);
+	Overdraw.fragments = Overdraw.pixels = 0;
+	Overdraw.maximum = 0;
+	Overdraw.frames = Overdraw.dropped = 0;
+}
+
+/****************
+ * Static layer *
+ ****************/
+
+/* Framebuffer the frame is finally drawn into, 0 is the window */
+GLuint screenFramebuffer = 0;
+
+/* The background and floor only change when the camera does,
+   so they are drawn once into a texture and composited with a single quad */
+struct StaticLayerCache {
+	int enabled;
+	GLuint framebuffer;
+	GLuint texture;
+	int width, height;  // Size of texture
+	int valid;
+	glm::vec4 bounds;   // Screen bounds the texture was drawn with
+	VAO* quad;          // Full screen quad in normalized device coordinates
+	int redraws;
+} StaticLayer = {1, 0, 0, 0, 0, 0, glm::vec4(0, 0, 0, 0), NULL, 0};
+
+/* (Re)create the cache texture at the viewport size */
+void resizeStaticLayer (int width, int height)
+{
+	if(StaticLayer.framebuffer == 0){
+		glGenFramebuffers(1, &StaticLayer.framebuffer);
+		glGenTextures(1, &StaticLayer.texture);
+
+		static const GLfloat quad_vertex_buffer_data [] = {
+			-1,-1,0, 1,-1,0, 1,1,0,
+			1,1,0, -1,1,0, -1,-1,0
+		};
+		static const GLfloat quad_texture_buffer_data [] = {
+			0,0, 1,0, 1,1,
+			1,1, 0,1, 0,0
+		};
+		StaticLayer.quad = create3DTexturedObject(GL_TRIANGLES, 6, quad_vertex_buffer_data, quad_texture_buffer_data, StaticLayer.texture, GL_FILL);
+	}
+
+	glBindTexture(GL_TEXTURE_2D, StaticLayer.texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	// One texel per pixel, nearest keeps the composite exact
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, StaticLayer.framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, StaticLayer.texture, 0);
+	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE){
+		cout << "Static layer framebuffer incomplete, drawing static layers every frame" << endl;
+		StaticLayer.enabled = 0;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, screenFramebuffer);
+
+	StaticLayer.width = width;
+	StaticLayer.height = height;
+	StaticLayer.valid = 0;
+	// The quad's creation and the texture upload changed the bindings behind Submitted
+	Submitted.vertexArray = 0;
+	Submitted.texture = 0;
+}
+
+/* Draw the static commands [0, end) into the cache texture */
+void redrawStaticLayer (RenderList& list, size_t end)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, StaticLayer.framebuffer);
+	glViewport (0, 0, StaticLayer.width, StaticLayer.height);
+	// No depth attachment, the static layers rely on painter's order only
+	glClear (GL_COLOR_BUFFER_BIT);
+	submitCommands(list, 0, end);
+	glBindFramebuffer(GL_FRAMEBUFFER, screenFramebuffer);
+	glViewport (0, 0, StaticLayer.width, StaticLayer.height);
+
+	StaticLayer.bounds = list.viewBounds;
+	StaticLayer.valid = 1;
+	StaticLayer.redraws++;
+}
+
+/* Composite the cache over the whole viewport, returns the number of commands it replaced */
+size_t drawStaticLayer (RenderList& list)
+{
+	size_t end = 0;
+	while(end < list.commands.size() && list.commands[end].layer < LAYER_FIRST_DYNAMIC)
+		end++;
+	if(!StaticLayer.enabled || list.width <= 0 || end == 0)
+		return 0;
+
+	if(list.width != StaticLayer.width || list.height != StaticLayer.height)
+		resizeStaticLayer(list.width, list.height);
+	if(!StaticLayer.enabled)
+		return 0;
+	if(!StaticLayer.valid || StaticLayer.bounds != list.viewBounds)
+		redrawStaticLayer(list, end);
+
+	// The quad is already in clip space, undo the camera with its inverse
+	RenderCommand c;
+	c.key = 0;
+	c.program = textureProgramID;
+	c.texture = StaticLayer.texture;
+	c.vao = StaticLayer.quad;
+	c.mode = GL_TRIANGLES;
+	c.layer = LAYER_BACKGROUND;
+	c.depth = 0;
+	c.matrix = -1;
+	c.first = 0;
+	c.count = 6;
+	c.body = BODY_NONE;
+	// Keep the depth buffer clear so the quad never hides the dynamic layers
+	glDepthMask(GL_FALSE);
+	beginGpuPass(PASS_STATIC);
+	queueRenderCommand(list, c, glm::inverse(list.VP));
+	flushRenderBatch(list);
+	endGpuPass();
+	glDepthMask(GL_TRUE);
+	return end;
+}
+
+/* Sort the recorded commands and send them to GL, must run on the thread owning the context */
+void submitRenderList (RenderList& list)
+{
+	if(softwareRendering){
+		renderSoftware(list);
+		return;
+	}
+	PROFILE_SCOPE("submit");
+	double start = monotonicTime();
+	beginGpuTimerFrame();
+	if(list.width > 0)
+		glViewport (0, 0, (GLsizei) list.width, (GLsizei) list.height);
+	int overdraw = Overdraw.enabled;
+	// clear the color and depth in the frame buffer, and the stencil the overdraw is counted in
+	glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | (overdraw ? GL_STENCIL_BUFFER_BIT : 0));
+	if(overdraw)
+		beginOverdrawCount();
+
+	beginStreamFrame();
+	setCameraTransform(list.VP);
+	syncWidgets(list);
+	syncHud(list);
+
+	Submitted.program = 0;
+	Submitted.vertexArray = 0;
+	Submitted.texture = 0;
+	Submitted.fillMode = GL_FILL;
+	Submitted.streamBase = 0;
+	Submitted.drawCalls = 0;
+	Submitted.vertices = 0;
+	glPolygonMode (GL_FRONT_AND_BACK, GL_FILL);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	if(!list.streamVertices.empty()){
+		GLsizeiptr size = list.streamVertices.size() * sizeof(GLfloat);
+		GLintptr offset = streamAlloc(&VertexStream, size, STREAM_VERTEX_STRIDE);
+		if(offset >= 0){
+			streamUpload(&VertexStream, offset, &list.streamVertices[0], size);
+			Submitted.streamBase = offset / STREAM_VERTEX_STRIDE;
+		}
+		else
+			Submitted.streamBase = -1;
+	}
+
+	sortRenderList(list);
+	size_t first = drawStaticLayer(list);
+	submitCommands(list, first, list.commands.size());
+	glDisable(GL_BLEND);
+	if(overdraw)
+		drawOverdrawHeatmap();
+
+	// Unbind Textures to be safe
+	glBindTexture(GL_TEXTURE_2D, 0);
+	endStreamFrame();
+	list.cpuSeconds += monotonicTime() - start;
+}
+
+/*****************
+ * Texture cache *
+ *****************/
+
+/* Decoded textures with all their mip levels are stored in cache/ as RGBA8,
+   so later launches map the file and hand it to glTexImage2D untouched
+   instead of decoding the PNG and building mipmaps again */
+#define TEXTURE_CACHE_DIR "cache"
+#define TEXTURE_CACHE_VERSION 1
+
+struct TextureCacheHeader {
+	char magic[4];          // "TXC1"
+	int version;
+	long long sourceSize;   // Size and modification time of the image it was baked from
+	long long sourceTime;
+	int width, height;
+	int levels;             // Mip levels stored one after the other, level 0 first
+	int requestedLevels;    // Argument it was baked with, 0 for the full chain
+};
+
+struct TextureCacheStats {
+	int enabled;
+	int hits, misses;
+	double seconds;  // Spent loading textures, cache or not
+	std::mutex lock; // Guards the figures above, textures are read on the asset workers
+} TextureCache = {1, 0, 0, 0};
+
+int mipLevelCount (int width, int height, int requested)
+{
+	int levels = 1;
+	while((width > 1 || height > 1) && (requested == 0 || levels < requested)){
+		width = max(1, width/2);
+		height = max(1, height/2);
+		levels++;
+	}
+	return levels;
+}
+
+size_t mipLevelSize (int width, int height, int level)
+{
+	return (size_t)max(1, width >> level) * max(1, height >> level) * 4;
+}
+
+/* Upload levels stored back to back and limit sampling to them */
+void uploadMipLevels (const unsigned char* data, int width, int height, int levels)
+{
+	for(int level=0;level<levels;level++){
+		glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, max(1, width >> level), max(1, height >> level), 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+		data += mipLevelSize(width, height, level);
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+}
+
+/* Halve each level with a 2x2 box filter, appending to pixels which holds level 0 */
+void buildMipLevels (vector<unsigned char>& pixels, int width, int height, int levels)
+{
+	size_t src = 0;
+	for(int level=1;level<levels;level++){
+		int sw = max(1, width >> (level-1)), sh = max(1, height >> (level-1));
+		int dw = max(1, width >> level), dh = max(1, height >> level);
+		size_t dst = pixels.size();
+		pixels.resize(dst + mipLevelSize(width, height, level));
+		for(int y=0;y<dh;y++){
+			for(int x=0;x<dw;x++){
+				int x0 = min(2*x, sw-1), x1 = min(2*x+1, sw-1);
+				int y0 = min(2*y, sh-1), y1 = min(2*y+1, sh-1);
+				for(int c=0;c<4;c++){
+					int sum = pixels[src + 4*(y0*sw + x0) + c] + pixels[src + 4*(y0*sw + x1) + c]
+						+ pixels[src + 4*(y1*sw + x0) + c] + pixels[src + 4*(y1*sw + x1) + c];
+					pixels[dst + 4*(y*dw + x) + c] = (sum + 2) / 4;
+				}
+			}
+		}
+		src = dst;
+	}
+}
+
+string textureCachePath (const char* source)
+{
+	string name = source;
+	size_t slash = name.find_last_of('/');
+	if(slash != string::npos)
+		name = name.substr(slash + 1);
+	return string(TEXTURE_CACHE_DIR) + "/" + name + ".tex";
+}
+
+/* Decoded levels ready for glTexImage2D, filled by readTextureLevels on any thread */
+struct TexturePixels {
+	const char* source;
+	int width, height;
+	int levels;              // Levels in data
+	int generate;            // Levels to make with glGenerateMipmap when data only holds level 0
+	const unsigned char* data;
+	vector<unsigned char> baked;
+	unsigned char* decoded;  // SOIL image when the cache is disabled
+	void* map;               // Cache file mapping
+	size_t mapSize;
+	const char* how;
+	double seconds;          // Time spent reading and decoding
+};
+
+/* Map the baked file, returns 0 if it is missing or stale */
+int mapCachedTexture (const string& path, const struct stat& source, int requested, TexturePixels* pixels)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if(fd < 0)
+		return 0;
+	struct stat info;
+	void* map = MAP_FAILED;
+	if(fstat(fd, &info) == 0 && (size_t)info.st_size >= sizeof(TextureCacheHeader))
+		map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+		return 0;
+
+	const TextureCacheHeader* header = (const TextureCacheHeader*) map;
+	int ok = memcmp(header->magic, "TXC1", 4) == 0 && header->version == TEXTURE_CACHE_VERSION
+		&& header->sourceSize == (long long)source.st_size && header->sourceTime == (long long)source.st_mtime
+		&& header->requestedLevels == requested && header->levels > 0;
+	if(ok){
+		size_t bytes = sizeof(TextureCacheHeader);
+		for(int level=0;level<header->levels;level++)
+			bytes += mipLevelSize(header->width, header->height, level);
+		ok = bytes <= (size_t)info.st_size;
+	}
+	if(!ok){
+		munmap(map, info.st_size);
+		return 0;
+	}
+	// Uploaded straight from the mapping, released by releaseTexturePixels
+	pixels->width = header->width;
+	pixels->height = header->height;
+	pixels->levels = header->levels;
+	pixels->data = (const unsigned char*)(header + 1);
+	pixels->map = map;
+	pixels->mapSize = info.st_size;
+	return 1;
+}
+
+/* Write the baked levels next to a temporary name first so a crash never leaves half a file */
+void writeCachedTexture (const string& path, const struct stat& source, int requested, const vector<unsigned char>& pixels, int width, int height, int levels)
+{
+	if(mkdir(TEXTURE_CACHE_DIR, 0755) != 0 && errno != EEXIST)
+		return;
+	TextureCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "TXC1", 4);
+	header.version = TEXTURE_CACHE_VERSION;
+	header.sourceSize = source.st_size;
+	header.sourceTime = source.st_mtime;
+	header.width = width;
+	header.height = height;
+	header.levels = levels;
+	header.requestedLevels = requested;
+
+	string temporary = path + ".tmp";
+	FILE* file = fopen(temporary.c_str(), "wb");
+	if(!file)
+		return;
+	int ok = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(&pixels[0], 1, pixels.size(), file) == pixels.size();
+	ok = fclose(file) == 0 && ok;
+	if(ok)
+		rename(temporary.c_str(), path.c_str());
+	else
+		remove(temporary.c_str());
+}
+
+/* Get mip levels 0..levels-1 (0 for all) of an image, through the baked cache
+   unless it is disabled. No GL calls, so asset workers can run it */
+int readTextureLevels (const char* source, int levels, TexturePixels* pixels)
+{
+	double start = monotonicTime();
+	pixels->source = source;
+	pixels->generate = 0;
+	pixels->data = NULL;
+	pixels->decoded = NULL;
+	pixels->map = NULL;
+	pixels->how = "cache hit";
+	struct stat info;
+	if(stat(source, &info) != 0)
+		return 0;
+	string path = textureCachePath(source);
+
+	if(!TextureCache.enabled || !mapCachedTexture(path, info, levels, pixels)){
+		int channels;
+		unsigned char* image = SOIL_load_image(source, &pixels->width, &pixels->height, &channels, SOIL_LOAD_RGBA);
+		if(!image)
+			return 0;
+		int count = mipLevelCount(pixels->width, pixels->height, levels);
+		if(TextureCache.enabled){
+			// Cold start: bake every level on the CPU and keep them for next time
+			pixels->baked.assign(image, image + mipLevelSize(pixels->width, pixels->height, 0));
+			buildMipLevels(pixels->baked, pixels->width, pixels->height, count);
+			writeCachedTexture(path, info, levels, pixels->baked, pixels->width, pixels->height, count);
+			SOIL_free_image_data(image);
+			pixels->data = &pixels->baked[0];
+			pixels->levels = count;
+			pixels->how = "baked";
+		}
+		else{
+			pixels->decoded = image;
+			pixels->data = image;
+			pixels->levels = 1;
+			pixels->generate = count;
+			pixels->how = "decoded";
+		}
+	}
+	pixels->seconds = monotonicTime() - start;
+	std::lock_guard<std::mutex> guard(TextureCache.lock);
+	if(pixels->map)
+		TextureCache.hits++;
+	else
+		TextureCache.misses++;
+	TextureCache.seconds += pixels->seconds;
+	return 1;
+}
+
+void releaseTexturePixels (TexturePixels* pixels)
+{
+	if(pixels->map)
+		munmap(pixels->map, pixels->mapSize);
+	if(pixels->decoded)
+		SOIL_free_image_data(pixels->decoded);
+	vector<unsigned char>().swap(pixels->baked);
+	pixels->map = NULL;
+	pixels->decoded = NULL;
+	pixels->data = NULL;
+}
+
+/* Upload the levels into TextureID and leave it bound, must run on the GL thread.
+   The read was counted by readTextureLevels, this adds the upload time */
+void uploadTextureLevels (GLuint TextureID, TexturePixels* pixels)
+{
+	double start = monotonicTime();
+	glBindTexture(GL_TEXTURE_2D, TextureID);
+	uploadMipLevels(pixels->data, pixels->width, pixels->height, pixels->levels);
+	if(pixels->generate){
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, pixels->generate - 1);
+		glGenerateMipmap(GL_TEXTURE_2D);
+	}
+	double upload = monotonicTime() - start;
+
+	{
+		std::lock_guard<std::mutex> guard(TextureCache.lock);
+		TextureCache.seconds += upload;
+	}
+	printf("Texture %s (%dx%d): %s in %.2f ms, upload %.2f ms\n", pixels->source, pixels->width, pixels->height,
+			pixels->how, 1000.0*pixels->seconds, 1000.0*upload);
+}
+
+/* Texture with mip levels 0..levels-1 (0 for all) from an image, read and
+   uploaded right away. Leaves the texture bound */
+GLuint loadCachedTexture (const char* source, int levels, int* width, int* height)
+{
+	TexturePixels pixels;
+	if(!readTextureLevels(source, levels, &pixels))
+		return 0;
+	GLuint TextureID;
+	glGenTextures(1, &TextureID);
+	uploadTextureLevels(TextureID, &pixels);
+	*width = pixels.width;
+	*height = pixels.height;
+	releaseTexturePixels(&pixels);
+	return TextureID;
+}
+
+/******************
+ * Shader sources *
+ ******************/
+
+/* scene.vert, scene.frag and what they include are compiled into the binary
+   (shaders.h is made from SHADERS in the Makefile), so startup reads no
+   shader files. --shader-dir reads them from a directory instead, to edit
+   shaders without rebuilding */
+struct EmbeddedShader {
+	const char* name;
+	const char* source;
+};
+
+static const EmbeddedShader embeddedShaders[] = {
+#include "shaders.h"
+	{NULL, NULL}
+};
+
+const char* ShaderDir = NULL;
+
+/* Text of one shader file, 0 if there is no such file */
+int findShaderFile (const string& name, string* source)
+{
+	if(ShaderDir){
+		std::ifstream file((string(ShaderDir) + "/" + name).c_str(), std::ios::in | std::ios::binary);
+		if(!file.is_open())
+			return 0;
+		source->assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		return 1;
+	}
+	for(int i=0;embeddedShaders[i].name;i++){
+		if(name == embeddedShaders[i].name){
+			*source = embeddedShaders[i].source;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Replace #include "file" lines with the file, depth stops include cycles */
+int expandShaderIncludes (const string& name, string* out, string* error, int depth)
+{
+	string source;
+	if(depth > 8){
+		*error = "#include nested too deep in " + name;
+		return 0;
+	}
+	if(!findShaderFile(name, &source)){
+		*error = "no shader file " + name + (ShaderDir ? string(" in ") + ShaderDir : string(" built in"));
+		return 0;
+	}
+	std::istringstream lines(source);
+	string line;
+	while(getline(lines, line)){
+		size_t start = line.find_first_not_of(" \t");
+		if(start != string::npos && line.compare(start, 8, "#include") == 0){
+			size_t open = line.find('"', start);
+			size_t close = open == string::npos ? open : line.find('"', open + 1);
+			if(close == string::npos){
+				*error = name + ": expected #include \"file\"";
+				return 0;
+			}
+			if(!expandShaderIncludes(line.substr(open + 1, close - open - 1), out, error, depth + 1))
+				return 0;
+			continue;
+		}
+		*out += line + "\n";
+	}
+	return 1;
+}
+
+/* Source of one variant of a shader: each space separated word of defines
+   becomes a #define right after #version. Empty with error set on failure */
+string shaderVariantSource (const char* name, const char* defines, string* error)
+{
+	string source;
+	if(!expandShaderIncludes(name, &source, error, 0))
+		return "";
+	string header, define;
+	std::istringstream words(defines);
+	while(words >> define)
+		header += "#define " + define + "\n";
+	size_t version = source.find("#version");
+	size_t line = version == string::npos ? string::npos : source.find('\n', version);
+	source.insert(line == string::npos ? 0 : line + 1, header);
+	return source;
+}
+
+/*****************
+ * Program cache *
+ *****************/
+
+/* Linked programs are stored in cache/ with glGetProgramBinary. A binary is
+   only good for the driver that made it, so the key hashes the sources
+   together with GL_RENDERER and GL_VERSION, and anything that does not
+   match or that the driver rejects falls back to compiling */
+#define PROGRAM_CACHE_VERSION 1
+
+struct ProgramCacheHeader {
+	char magic[4];          // "PRG1"
+	int version;
+	unsigned long long key; // programCacheKey of what it was linked from
+	GLenum format;          // Driver specific binary format
+	int length;             // Bytes of binary after the header
+};
+
+struct ProgramCacheStats {
+	int enabled;
+	int hits, misses;
+	double seconds;  // Spent compiling and linking or loading binaries
+} ProgramCache = {1, 0, 0, 0};
+
+/* FNV-1a */
+unsigned long long hashBytes (unsigned long long hash, const char* data, size_t size)
+{
+	for(size_t i=0;i<size;i++){
+		hash ^= (unsigned char)data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+unsigned long long programCacheKey (const std::string& VertexShaderCode, const std::string& FragmentShaderCode)
+{
+	const char* parts[] = {VertexShaderCode.c_str(), FragmentShaderCode.c_str(),
+		(const char*)glGetString(GL_RENDERER), (const char*)glGetString(GL_VERSION)};
+	unsigned long long hash = 14695981039346656037ULL;
+	for(int i=0;i<4;i++)
+		hash = hashBytes(hash, parts[i] ? parts[i] : "", parts[i] ? strlen(parts[i]) + 1 : 1);
+	return hash;
+}
+
+/* One file per shader variant */
+string programCachePath (const char* variant)
+{
+	return string(TEXTURE_CACHE_DIR) + "/" + variant + ".prog";
+}
+
+/* Returns 0 if the file is missing, stale or refused by the driver */
+GLuint loadCachedProgram (const string& path, unsigned long long key)
+{
+	std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+	if(!file.is_open())
+		return 0;
+	vector<char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	if(bytes.size() < sizeof(ProgramCacheHeader))
+		return 0;
+	ProgramCacheHeader header;
+	memcpy(&header, &bytes[0], sizeof(header));
+	if(memcmp(header.magic, "PRG1", 4) != 0 || header.version != PROGRAM_CACHE_VERSION || header.key != key
+			|| header.length <= 0 || bytes.size() - sizeof(header) < (size_t)header.length)
+		return 0;
+
+	GLuint ProgramID = glCreateProgram();
+	glProgramBinary(ProgramID, header.format, &bytes[sizeof(header)], header.length);
+	GLint Result = GL_FALSE;
+	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
+	if(Result != GL_TRUE){
+		// Driver update or a format it no longer takes
+		glDeleteProgram(ProgramID);
+		return 0;
+	}
+	return ProgramID;
+}
+
+void writeCachedProgram (const string& path, unsigned long long key, GLuint ProgramID)
+{
+	GLint length = 0;
+	glGetProgramiv(ProgramID, GL_PROGRAM_BINARY_LENGTH, &length);
+	if(length <= 0)
+		return; // The driver offers no binary formats
+	vector<char> binary(length);
+	ProgramCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	glGetProgramBinary(ProgramID, length, &length, &header.format, &binary[0]);
+	if(length <= 0 || (mkdir(TEXTURE_CACHE_DIR, 0755) != 0 && errno != EEXIST))
+		return;
+	memcpy(header.magic, "PRG1", 4);
+	header.version = PROGRAM_CACHE_VERSION;
+	header.key = key;
+	header.length = length;
+
+	string temporary = path + ".tmp";
+	FILE* file = fopen(temporary.c_str(), "wb");
+	if(!file)
+		return;
+	int ok = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(&binary[0], 1, length, file) == (size_t)length;
+	ok = fclose(file) == 0 && ok;
+	if(ok)
+		rename(temporary.c_str(), path.c_str());
+	else
+		remove(temporary.c_str());
+}
+
+/* CompileShaders for a variant of scene.vert/scene.frag through the binary
+   cache, logs the time either way. Returns 0 if it does not build */
+GLuint loadProgram (const char* variant, const std::string& VertexShaderCode, const std::string& FragmentShaderCode)
+{
+	double start = monotonicTime();
+	string vertex_name = string("scene.vert [") + variant + "]";
+	string fragment_name = string("scene.frag [") + variant + "]";
+	int cached = ProgramCache.enabled && GLAD_GL_ARB_get_program_binary;
+	unsigned long long key = 0;
+	string path;
+	GLuint ProgramID = 0;
+	if(cached){
+		key = programCacheKey(VertexShaderCode, FragmentShaderCode);
+		path = programCachePath(variant);
+		ProgramID = loadCachedProgram(path, key);
+	}
+	if(ProgramID){
+		ProgramCache.hits++;
+		double seconds = monotonicTime() - start;
+		ProgramCache.seconds += seconds;
+		printf("Program %s: binary from cache in %.2f ms\n", variant, 1000.0*seconds);
+		return ProgramID;
+	}
+
+	ProgramID = CompileShaders(VertexShaderCode, FragmentShaderCode, vertex_name.c_str(), fragment_name.c_str());
+	double linked = monotonicTime();
+	if(!ProgramID)
+		return 0;
+	if(cached)
+		writeCachedProgram(path, key, ProgramID);
+	ProgramCache.misses++;
+	ProgramCache.seconds += linked - start;
+	printf("Program %s: compiled and linked in %.2f ms%s\n", variant, 1000.0*(linked - start),
+			cached ? ", binary stored" : "");
+	return ProgramID;
+}
+
+/****************
+ * Sprite atlas *
+ ****************/
+
+/* Mip levels of the atlas. atlaspack pads every sprite by ATLAS_PADDING = 4
+   texels, which still leaves a border of one texel at level 2 */
+#define ATLAS_MIP_LEVELS 3
+
+/* One rectangle of the atlas built by atlaspack, v = 0 is the top row */
+struct AtlasSprite {
+	string name;
+	int width, height;
+	float u0, v0, u1, v1;
+};
+
+struct SpriteAtlas {
+	GLuint texture;
+	int width, height;
+	vector<AtlasSprite> sprites;
+} Atlas;
+
+/* What readSpriteAtlas produced, uploaded by finishSpriteAtlas */
+struct AtlasPixels {
+	TexturePixels pixels;
+	vector<AtlasSprite> sprites;
+	int loaded;
+};
+
+/* Read the packed atlas and its UV table. Without them (atlaspack not run)
+   the fallback image becomes a one-sprite atlas so the game still starts.
+   No GL calls, runs on an asset worker */
+void readSpriteAtlas (const char* image, const char* table, const char* fallback, AtlasPixels* atlas)
+{
+	int width = 0, height = 0;
+	FILE* file = fopen(table, "r");
+	atlas->sprites.clear();
+	atlas->loaded = 0;
+	if(file && fscanf(file, "atlas %d %d", &width, &height) == 2)
+		atlas->loaded = readTextureLevels(image, ATLAS_MIP_LEVELS, &atlas->pixels);
+
+	if(atlas->loaded){
+		char name[256];
+		AtlasSprite s;
+		int x, y;
+		while(fscanf(file, "%255s %d %d %d %d %f %f %f %f", name, &x, &y, &s.width, &s.height, &s.u0, &s.v0, &s.u1, &s.v1) == 9){
+			s.name = name;
+			atlas->sprites.push_back(s);
+		}
+	}
+	else{
+		cout << "Atlas: " << image << " or " << table << " missing, using " << fallback << " alone" << endl;
+		atlas->loaded = readTextureLevels(fallback, ATLAS_MIP_LEVELS, &atlas->pixels);
+		AtlasSprite s;
+		s.name = fallback;
+		s.name = s.name.substr(0, s.name.find_last_of('.'));
+		s.width = atlas->pixels.width;
+		s.height = atlas->pixels.height;
+		s.u0 = s.v0 = 0;
+		s.u1 = s.v1 = 1;
+		if(atlas->loaded)
+			atlas->sprites.push_back(s);
+	}
+	if(file)
+		fclose(file);
+}
+
+/* Upload into Atlas.texture, generated up front so spriteVAO can refer to it before loading is done */
+void finishSpriteAtlas (AtlasPixels* atlas)
+{
+	if(!atlas->loaded){
+		cout << "SOIL loading error: '" << SOIL_last_result() << "'" << endl;
+		return;
+	}
+	if(softwareRendering)
+		keepSoftwareAtlas(&atlas->pixels);
+	else{
+		uploadTextureLevels(Atlas.texture, &atlas->pixels);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	Atlas.width = atlas->pixels.width;
+	Atlas.height = atlas->pixels.height;
+	Atlas.sprites.swap(atlas->sprites);
+	releaseTexturePixels(&atlas->pixels);
+	printf("Atlas: %d sprites in a %dx%d texture\n", (int)Atlas.sprites.size(), Atlas.width, Atlas.height);
+}
+
+const AtlasSprite* findSprite (const char* name)
+{
+	for(size_t i=0;i<Atlas.sprites.size();i++)
+		if(Atlas.sprites[i].name == name)
+			return &Atlas.sprites[i];
+	return NULL;
+}
+
+/* Record the sprite stretched over the rectangle (x0,y0)-(x1,y1) moved by model, y0 gets the sprite's top row.
+   All sprites go through spriteVAO with the atlas bound, so sprites recorded one
+   after the other in a layer are drawn together */
+void recordSprite (RenderList& list, const char* name, float x0, float y0, float x1, float y1, const glm::mat4& model, int layer, float depth=0)
+{
+	const AtlasSprite* sprite = findSprite(name);
+	if(!sprite)
+		return;
+
+	// Cull against the view like any other object
+	glm::vec4 view = list.viewBounds;
+	if(view.x < view.y){
+		glm::vec2 lo, hi;
+		for(int i=0;i<4;i++){
+			glm::vec4 p = model * glm::vec4(i & 1 ? x1 : x0, i & 2 ? y1 : y0, 0, 1);
+			glm::vec2 q(p.x, p.y);
+			lo = i ? glm::min(lo, q) : q;
+			hi = i ? glm::max(hi, q) : q;
+		}
+		if(hi.x < view.x || lo.x > view.y || hi.y < view.z || lo.y > view.w){
+			list.culled++;
+			return;
+		}
+	}
+
+	static const int corners[6][2] = { {0,0}, {0,1}, {1,0}, {0,1}, {1,0}, {1,1} };
+	int first = list.streamVertices.size() / 6;
+	for(int i=0;i<6;i++){
+		glm::vec4 p = model * glm::vec4(corners[i][0] ? x1 : x0, corners[i][1] ? y1 : y0, 0, 1);
+		list.streamVertices.push_back(p.x);
+		list.streamVertices.push_back(p.y);
+		list.streamVertices.push_back(p.z);
+		list.streamVertices.push_back(corners[i][0] ? sprite->u1 : sprite->u0);
+		list.streamVertices.push_back(corners[i][1] ? sprite->v1 : sprite->v0);
+		list.streamVertices.push_back(0);
+	}
+	RenderCommand& c = addRenderCommand(list, textureProgramID, spriteVAO, glm::mat4(1.0f), layer, depth);
+	c.first = first;
+	c.count = 6;
+}
+
+/* Create an OpenGL Texture from an image */
+GLuint createTexture (const char* filename)
+{
+	// Load image and create OpenGL texture with all its mip levels, from the baked cache when it can
+	int twidth, theight;
+	GLuint TextureID = loadCachedTexture(filename, 0, &twidth, &theight);
+	if(TextureID == 0)
+		return 0;
+	// Set our texture parameters
+	// Set texture wrapping to GL_REPEAT
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	// Set texture filtering (interpolation)
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0); // Unbind texture when done, so we won't accidentily mess it up
+
+	return TextureID;
+}
+
+/***************
+ * Glyph atlas *
+ ***************/
+
+/* Whether texel (x, y) of a glyph bitmap is inside the outline, outside the bitmap is outside */
+bool glyphInside (const FT_Bitmap& bitmap, int x, int y)
+{
+	if(x < 0 || y < 0 || x >= (int)bitmap.width || y >= (int)bitmap.rows)
+		return false;
+	return bitmap.buffer[y*bitmap.pitch + x] >= 128;
+}
+
+/* Distance field of one glyph into the atlas at (ax, ay), GLYPH_SPREAD texels of padding around the bitmap.
+   Each texel stores how far the nearest texel on the other side of the outline is, 0.5 at the outline */
+void glyphDistanceField (const FT_Bitmap& bitmap, GlyphAtlas* atlas, int ax, int ay)
+{
+	int w = bitmap.width + 2*GLYPH_SPREAD, h = bitmap.rows + 2*GLYPH_SPREAD;
+	for(int y=0;y<h;y++){
+		for(int x=0;x<w;x++){
+			int bx = x - GLYPH_SPREAD, by = y - GLYPH_SPREAD;
+			bool inside = glyphInside(bitmap, bx, by);
+			int nearest = (GLYPH_SPREAD + 1)*(GLYPH_SPREAD + 1);
+			for(int dy=-GLYPH_SPREAD;dy<=GLYPH_SPREAD;dy++)
+				for(int dx=-GLYPH_SPREAD;dx<=GLYPH_SPREAD;dx++)
+					if(dx*dx + dy*dy < nearest && glyphInside(bitmap, bx + dx, by + dy) != inside)
+						nearest = dx*dx + dy*dy;
+			// Texel centres either side of the outline are a texel apart, the outline is half way
+			float distance = min(sqrtf((float)nearest) - 0.5f, (float)GLYPH_SPREAD);
+			float value = 0.5f + (inside ? distance : -distance) / (2*GLYPH_SPREAD);
+			atlas->pixels[(ay + y)*atlas->width + ax + x] = (unsigned char)max(0, min(255, (int)(value*255 + 0.5f)));
+		}
+	}
+}
+
+/* Rasterise printable ASCII from a font file and shelf pack their distance
+   fields into one atlas, GLYPH_ATLAS_WIDTH wide. Asset worker, no GL calls */
+bool buildGlyphAtlas (const vector<unsigned char>& font, GlyphAtlas* atlas)
+{
+	double start = monotonicTime();
+	FT_Library library;
+	FT_Face face;
+	if(font.empty() || FT_Init_FreeType(&library))
+		return false;
+	if(FT_New_Memory_Face(library, &font[0], font.size(), 0, &face)){
+		FT_Done_FreeType(library);
+		return false;
+	}
+	FT_Set_Pixel_Sizes(face, 0, GLYPH_PIXELS);
+
+	atlas->width = GLYPH_ATLAS_WIDTH;
+	atlas->height = 0;
+	atlas->pixels.clear();
+	int x = 0, y = 0, shelf = 0;
+	for(int i=0;i<GLYPH_COUNT;i++){
+		Glyph& g = atlas->glyphs[i];
+		memset(&g, 0, sizeof(g));
+		if(FT_Load_Char(face, GLYPH_FIRST + i, FT_LOAD_RENDER))
+			continue;
+		const FT_Bitmap& bitmap = face->glyph->bitmap;
+		g.advance = face->glyph->advance.x / 64.0f / GLYPH_PIXELS;
+		if(bitmap.width == 0 || bitmap.rows == 0)
+			continue; // Space
+
+		int w = bitmap.width + 2*GLYPH_SPREAD, h = bitmap.rows + 2*GLYPH_SPREAD;
+		if(x + w > atlas->width){
+			x = 0;
+			y += shelf;
+			shelf = 0;
+		}
+		if(y + h > atlas->height){
+			atlas->height = y + h;
+			atlas->pixels.resize(atlas->width * atlas->height, 0);
+		}
+		glyphDistanceField(bitmap, atlas, x, y);
+
+		int left = face->glyph->bitmap_left, top = face->glyph->bitmap_top;
+		g.x0 = (float)(left - GLYPH_SPREAD) / GLYPH_PIXELS;
+		g.x1 = (float)(left + (int)bitmap.width + GLYPH_SPREAD) / GLYPH_PIXELS;
+		g.y0 = (float)(top - (int)bitmap.rows - GLYPH_SPREAD) / GLYPH_PIXELS;
+		g.y1 = (float)(top + GLYPH_SPREAD) / GLYPH_PIXELS;
+		// Row 0 of the atlas is the top of the glyphs
+		g.u0 = (float)x;
+		g.u1 = (float)(x + w);
+		g.v0 = (float)(y + h);
+		g.v1 = (float)y;
+		x += w;
+		shelf = max(shelf, h);
+	}
+	FT_Done_Face(face);
+	FT_Done_FreeType(library);
+
+	// A solid block after the glyphs, wide enough that linear filtering at its centre only sees it
+	if(x + 4 > atlas->width){
+		x = 0;
+		y += shelf;
+	}
+	if(y + 4 > atlas->height){
+		atlas->height = y + 4;
+		atlas->pixels.resize(atlas->width * atlas->height, 0);
+	}
+	for(int by=0;by<4;by++)
+		memset(&atlas->pixels[(y + by)*atlas->width + x], 255, 4);
+	atlas->solidU = (x + 2.0f) / atlas->width;
+	atlas->solidV = (y + 2.0f) / atlas->height;
+
+	// Texel positions to texture coordinates now the height is known
+	for(int i=0;i<GLYPH_COUNT;i++){
+		Glyph& g = atlas->glyphs[i];
+		if(g.x1 > g.x0){
+			g.u0 /= atlas->width;
+			g.u1 /= atlas->width;
+			g.v0 /= atlas->height;
+			g.v1 /= atlas->height;
+		}
+	}
+	atlas->seconds = monotonicTime() - start;
+	return atlas->height > 0;
+}
+
+/* Upload into Glyphs.texture, generated up front so textVAO can refer to it before loading is done */
+void uploadGlyphAtlas (GlyphAtlas* atlas)
+{
+	glBindTexture(GL_TEXTURE_2D, atlas->texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, atlas->width, atlas->height, 0, GL_RED, GL_UNSIGNED_BYTE, &atlas->pixels[0]);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	// Linear filtering is what makes the field resolve the outline between texels
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	printf("Glyph atlas (%dx%d): %d glyphs built in %.2f ms\n", atlas->width, atlas->height, GLYPH_COUNT, 1000.0*atlas->seconds);
+}
+
+/********************
+ * Retained widgets *
+ ********************/
+
+/* The power board, power bar and score keep their vertices in one buffer of
+   their own. The simulation rebuilds a widget's vertices only when the value
+   it shows changes, and the GL thread uploads the buffer only then, so on a
+   steady frame all three are one draw of an unchanged buffer */
+enum WidgetId {
+	WIDGET_BOARD = 0,
+	WIDGET_POWER,
+	WIDGET_SCORE,
+	WIDGET_COUNT
+};
+
+struct Widget {
+	int valid;
+	double value;             // What vertices show
+	vector<GLfloat> vertices; // Font program layout, see appendText
+};
+
+struct RetainedWidgets {
+	Widget widgets[WIDGET_COUNT];
+	int dirty;                // Some widget was rebuilt this step, simulation only
+	std::mutex lock;          // Guards vertices and version
+	vector<GLfloat> vertices; // Every widget in drawing order
+	long version;             // Bumped with every change of vertices
+	long uploaded;            // Version in vao's buffer, GL thread only
+	GLsizeiptr capacity;      // Bytes allocated for vao's buffer
+	VAO* vao;
+	std::atomic<int> rebuilds; // Widget rebuilds since the last report
+} Widgets;
+
+/* VAO over a buffer of its own in the layout of createStreamedTextObject */
+VAO* createWidgetObject (GLuint textureID)
+{
+	VAO* vao = new VAO();
+	vao->PrimitiveMode = GL_TRIANGLES;
+	vao->FillMode = GL_FILL;
+	vao->TextureID = textureID;
+	vao->dead = 0;
+	vao->NumVertices = 0;
+	if(softwareRendering){
+		vao->VertexArrayID = softwareName();
+		return vao;
+	}
+
+	glGenVertexArrays(1, &(vao->VertexArrayID));
+	glGenBuffers(1, &(vao->VertexBuffer));
+	vao->TextureBuffer = vao->ColorBuffer = vao->VertexBuffer;
+	glBindVertexArray (vao->VertexArrayID);
+	glBindBuffer (GL_ARRAY_BUFFER, vao->VertexBuffer);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, STREAM_VERTEX_STRIDE, (void*)0);
+	glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, STREAM_VERTEX_STRIDE, (void*)(5*sizeof(GLfloat)));
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, STREAM_VERTEX_STRIDE, (void*)(3*sizeof(GLfloat)));
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glEnableVertexAttribArray(2);
+	return vao;
+}
+
+/* Whether widget id has to be rebuilt to show value. If so its vertices are
+   cleared for the caller to append the new ones */
+bool beginWidget (int id, double value)
+{
+	Widget& w = Widgets.widgets[id];
+	if(w.valid && w.value == value)
+		return false;
+	w.valid = 1;
+	w.value = value;
+	w.vertices.clear();
+	Widgets.dirty = 1;
+	Widgets.rebuilds++;
+	return true;
+}
+
+/* Publish rebuilt widgets to the GL thread and record their single draw */
+void recordWidgets (RenderList& list)
+{
+	if(Widgets.dirty){
+		std::lock_guard<std::mutex> guard(Widgets.lock);
+		Widgets.vertices.clear();
+		for(int i=0;i<WIDGET_COUNT;i++)
+			Widgets.vertices.insert(Widgets.vertices.end(), Widgets.widgets[i].vertices.begin(), Widgets.widgets[i].vertices.end());
+		Widgets.version++;
+		Widgets.dirty = 0;
+	}
+	addRenderCommand(list, fontProgramID, Widgets.vao, glm::mat4(1.0f), LAYER_WIDGETS, 0);
+}
+
+/* GL thread: replace the contents of a createWidgetObject buffer, growing it
+   to twice what is needed when it is too small */
+void uploadRetainedVertices (VAO* vao, const vector<GLfloat>& vertices, GLsizeiptr& capacity)
+{
+	GLsizeiptr size = vertices.size() * sizeof(GLfloat);
+	glBindBuffer(GL_ARRAY_BUFFER, vao->VertexBuffer);
+	if(size > capacity){
+		glBufferData(GL_ARRAY_BUFFER, 2*size, NULL, GL_DYNAMIC_DRAW);
+		bufferBytes += 2*size - capacity;
+		capacity = 2*size;
+	}
+	if(size > 0)
+		glBufferSubData(GL_ARRAY_BUFFER, 0, size, &vertices[0]);
+	vao->NumVertices = vertices.size() / 6;
+}
+
+/* GL thread, at submit: upload the widgets if they changed since the last upload
+   and give the list's widget draw the uploaded vertex count */
+void syncWidgets (RenderList& list)
+{
+	if(!Widgets.vao)
+		return;
+	{
+		std::lock_guard<std::mutex> guard(Widgets.lock);
+		if(Widgets.uploaded != Widgets.version){
+			uploadRetainedVertices(Widgets.vao, Widgets.vertices, Widgets.capacity);
+			Widgets.uploaded = Widgets.version;
+		}
+	}
+	for(size_t i=0;i<list.commands.size();i++)
+		if(list.commands[i].vao == Widgets.vao)
+			list.commands[i].count = Widgets.vao->NumVertices;
+}
+
+/**************************
+ * Customizable functions *
+ **************************/
+
+int pressed_state = 0, collision_state=0, zoominstate = 0, zoomoutstate = 0, panright = 0, panleft = 0, panup = 0, pandown = 0;
+int keyboard_pressed_statex = 0, keyboard_pressed_statey = 0;
+double curx,cury,initx = -380,inity = 130,speedx,speedy,strength=0.5,prevx,prevy,cannonball_size=18,gravity=0.2;
+double fireposx=-380,fireposy=130, keyboardx = -380 , keyboardy = 130;
+double pivotx=-10,pivoty=-30,angular_v[6],angle[6],woodspx[6],woodspy[6],pigspx[10], pigspy[10], piginitx[10];
+VAO  *cannonball, *gameFloor, *woodlogs[6], *pigs[10], *powerboard, *powerelement, *catapult;
+VAO  *pigFans[6]; // The pigs as triangle fans, only drawn by --bench-circles
+VAO  *floorStrips; // The floor as 20 overlapping strips, only drawn by --bench-floor
+float screenleft = -600.0f, screenright = 600.0f, screentop = -300.0f, screenbotton = 300.0f;
+glm::vec4 viewBounds(-600.0f, 600.0f, -300.0f, 300.0f); // x min, x max, y min, y max of the ortho projection
+int scoretimer[10][3],tim=5;
+int pig_wood[10];
+int panning_state=0, paninitx, paninity;
+int framebufferWidth = 1200, framebufferHeight = 600;
+double lastInputTime = 0; // gameTime() of the latest input event
+
+int score = 0;
+
+double power = 0;
+/* Executed when a regular key is pressed/released/held-down */
+/* Prefered for Keyboard events */
+void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+	lastInputTime = gameTime();
+	// Function is called first on GLFW_PRESS.
+
+	if (action == GLFW_RELEASE) {
+		switch (key) {
+			case GLFW_KEY_C:
+				//rectangle_rot_status = !rectangle_rot_status;
+				break;
+			case GLFW_KEY_KP_ADD:
+				zoominstate = 0;
+				//triangle_rot_status = !triangle_rot_status;
+				break;
+			case GLFW_KEY_KP_SUBTRACT:
+				zoomoutstate = 0;
+				break;
+			case GLFW_KEY_LEFT:
+				panleft = 0;
+				break;
+			case GLFW_KEY_RIGHT:
+				panright = 0;
+				break;
+			case GLFW_KEY_UP:
+				panup = 0;
+				break;
+			case GLFW_KEY_DOWN:
+				pandown = 0;
+				break;
+			case GLFW_KEY_X:
+				// do something ..
+				break;
+			case GLFW_KEY_A:
+				keyboard_pressed_statex = 0;
+				break;
+			case GLFW_KEY_B:
+				keyboard_pressed_statey = 0;
+				break;
+			default:
+				break;
+		}
+	}
+	else if (action == GLFW_PRESS) {
+		switch (key) {
+			case GLFW_KEY_ESCAPE:
+				quit(window);
+				break;
+			case GLFW_KEY_KP_ADD:
+				zoominstate=1;
+				break;
+			case GLFW_KEY_KP_SUBTRACT:
+				zoomoutstate = 1;
+				break;
+			case GLFW_KEY_LEFT:
+				panleft = 1;
+				break;
+			case GLFW_KEY_RIGHT:
+				panright = 1;
+				break;
+			case GLFW_KEY_UP:
+				panup = 1;
+				break;
+			case GLFW_KEY_DOWN:
+				pandown = 1;
+				break;
+			case GLFW_KEY_A:
+				keyboard_pressed_statex = 1;
+				if(keyboard_pressed_statey==0){
+					keyboardx = fireposx;
+					keyboardy = fireposy;
+					initx = fireposx;
+					inity = fireposy;
+				}
+				break;
+			case GLFW_KEY_B:
+				keyboard_pressed_statey = 1;
+				if(keyboard_pressed_statex==0){
+					keyboardy = fireposy;
+					keyboardx = fireposx;
+					initx = fireposx;
+					inity = fireposy;
+				}
+				break;
+			case GLFW_KEY_R:
+				toggleRecording();
+				break;
+			case GLFW_KEY_T:
+				toggleProfiler();
+				break;
+			case GLFW_KEY_H:
+				toggleHud();
+				break;
+			case GLFW_KEY_O:
+				toggleOverdraw();
+				break;
+			case GLFW_KEY_SPACE:
+				pressed_state = 3;
+				if(sqrt((keyboardx-initx)*(keyboardx-initx)+(keyboardy-inity)*(keyboardy-inity)) > 30){
+					double angle_present = -M_PI+atan2(inity-keyboardy,initx-keyboardx);
+					keyboardx = initx + 30*cos(angle_present);
+					keyboardy = inity + 30*sin(angle_present);
+				}
+				speedx=(initx-keyboardx)*strength;
+				speedy=(inity-keyboardy)*strength;
+				break;
+
+			default:
+				break;
+		}
+	}
+}
+
+/* Executed for character input (like in text boxes) */
+void keyboardChar (GLFWwindow* window, unsigned int key)
+{
+	switch (key) {
+		case 'Q':
+		case 'q':
+			quit(window);
+			break;
+		default:
+			break;
+	}
+}
+
+void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
+{
+	lastInputTime = gameTime();
+	if(yoffset == 1){
+		screenleft /= 1.02;
+		screenright /= 1.02;
+		screentop /= 1.02;
+		screenbotton /= 1.02;
+		reshapeWindow(window, 1200, 600);
+	}
+	else if(yoffset == -1){
+		if(screenleft >= -600.0f/1.02f)
+			screenleft *= 1.02;
+		if(screenright <= 600.0f/1.02f)
+			screenright *= 1.02;
+		if(screentop >= -300.0f/1.02f)
+			screentop *= 1.02;
+		if(screenbotton <= 300.0f/1.02f)
+			screenbotton *= 1.02;
+		reshapeWindow(window, 1200, 600);
+	}
+
+}
+
+static void cursor_position_callback(GLFWwindow* window, double xpos, double ypos)
+{
+	lastInputTime = gameTime();
+	curx = ((screenright - screenleft)/1200.0f)*xpos + screenleft;
+	cury = ((screenbotton - screentop)/600.0f)*ypos + screentop;
+	if(panning_state == 1){
+		if(paninitx - curx < 0 && screenleft >= -600 + fabs(paninitx - curx)){
+			screenleft -= fabs(paninitx - curx);
+			screenright -= fabs(paninitx - curx);
+		}
+		if(paninitx - curx > 0 && screenright <= 600 - fabs(paninitx -curx)){
+			screenleft += fabs(paninitx -curx);
+			screenright += fabs(paninitx -curx);
+		}
+		if(paninity - cury < 0  && screentop >= -300 + fabs(paninity - cury)){
+			screentop -= fabs(paninity - cury);
+			screenbotton -= fabs(paninity - cury);
+		}
+		if(paninity - cury > 0 && screenbotton <= 300 - fabs(paninity -cury)){
+			screentop += fabs(paninity - cury);
+			screenbotton += fabs(paninity -cury);
+		}
+		reshapeWindow(window, 1200, 600);
+	}
+
+}
+
+int is_cannon_clicked(double mousex, double mousey) {
+	double x2=cannonball->centerx;
+	double y2=cannonball->centery;
+	double radius = cannonball->radius;
+	if(radius>sqrt((x2-mousex)*(x2-mousex)+(y2-mousey)*(y2-mousey)))
+		return true;
+	else
+		return false;
+}
+
+/* Executed when a mouse button is pressed/released */
+void mouseButton (GLFWwindow* window, int button, int action, int mods)
+{
+	lastInputTime = gameTime();
+	switch (button) {
+		case GLFW_MOUSE_BUTTON_LEFT:
+			if (action == GLFW_PRESS){
+				//triangle_rot_dir *= -1;
+				if(pressed_state==0&&is_cannon_clicked(curx,cury))
+				{	
+					initx=curx,inity=cury;
+					pressed_state=1;
+				}
+			}
+			if(pressed_state==3){
+				pressed_state=0;
+				gravity = 0.2;
+				power = 0;
+				keyboardx = fireposx;
+				keyboardy = fireposy;
+			}
+			if (action == GLFW_RELEASE ){
+				//triangle_rot_dir *= -1;
+				if(pressed_state==1){
+					pressed_state=3;
+
+					if(sqrt((curx-initx)*(curx-initx)+(cury-inity)*(cury-inity)) > 30){
+						double angle_present = -M_PI+atan2(inity-cury,initx-curx);
+						curx = initx + 30*cos(angle_present);
+						cury = inity + 30*sin(angle_present);
+					}
+					speedx=(initx-curx)*strength;
+					speedy=(inity-cury)*strength;
+
+				}
+				//printf("pressed at %lf %lf and released at %lf %lf",initx,inity,curx,cury);
+			}
+			break;
+		case GLFW_MOUSE_BUTTON_RIGHT:
+			if (action == GLFW_RELEASE) {
+				panning_state = 0;
+			}
+			if(action == GLFW_PRESS){
+				panning_state = 1;
+				paninitx = curx;
+				paninity = cury;
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+
+/* Executed when window is resized to 'width' and 'height' */
+/* Modify the bounds of the screen here in glm::ortho or Field of View in glm::Perspective */
+void reshapeWindow (GLFWwindow* window, int width, int height)
+{
+	int fbwidth=width, fbheight=height;
+	/* With Retina display on Mac OS X, GLFW's FramebufferSize
+	   is different from WindowSize. Headless runs have no window */
+	if(window)
+		glfwGetFramebufferSize(window, &fbwidth, &fbheight);
+
+	GLfloat fov = 90.0f;
+
+	// sets the viewport of openGL renderer, applied by submitRenderList on the thread owning the context
+	framebufferWidth = fbwidth;
+	framebufferHeight = fbheight;
+
+	// set the projection matrix as perspective
+	/* glMatrixMode (GL_PROJECTION);
+	   glLoadIdentity ();
+	   gluPerspective (fov, (GLfloat) fbwidth / (GLfloat) fbheight, 0.1, 500.0); */
+	// Store the projection matrix in a variable for future use
+	// Perspective projection for 3D views
+	// Matrices.projection = glm::perspective (fov, (GLfloat) fbwidth / (GLfloat) fbheight, 0.1f, 500.0f);
+
+	// Ortho projection for 2D views
+//	screenleft = -screenleft, screenright = -screenright, screenbotton= - screenbotton, screentop = -screentop;
+	Matrices.projection = glm::ortho(screenleft, screenright, screenbotton, screentop, 1.0f, 500.0f);
+	// What the projection shows, objects outside are culled while recording
+	viewBounds = glm::vec4(min(screenleft, screenright), max(screenleft, screenright),
+			min(screentop, screenbotton), max(screentop, screenbotton));
+}
+
+void createPowerElement() {
+	static GLfloat vertex_buffer_data[] = {
+		-0.5, -15.0f*0.75, 0,
+		0.5, -15.0f*0.75f, 0,
+		-0.5, 15.0f*0.75f, 0,
+
+		0.5, -15.0f*0.75f, 0,
+		-0.5, 15.0f*0.75f, 0,
+		0.5, 15.0f*0.75f, 0
+	};
+	static GLfloat color_buffer_data[] = {
+		12.0f/255.0f,253.0f/255.0f,1.0f/255.0f,
+		12.0f/255.0f,253.0f/255.0f,1.0f/255.0f,
+		12.0f/255.0f,253.0f/255.0f,1.0f/255.0f,
+		12.0f/255.0f,253.0f/255.0f,1.0f/255.0f,
+		12.0f/255.0f,253.0f/255.0f,1.0f/255.0f,
+		12.0f/255.0f,253.0f/255.0f,1.0f/255.0f
+	};
+	powerelement = create3DObject(GL_TRIANGLES, 2*3 ,GAME_SCOREBOARD, vertex_buffer_data, color_buffer_data, -400 + 30, -270 +15, 30, GL_FILL);
+}
+
+void createPowerBoard(){
+	double leftoffset = -280;
+	double width = 260;
+	double topoffset = -240;
+	double height = 15;
+	double innerratio = 0.83;
+
+	static  GLfloat vertex_buffer_data[] = {
+		leftoffset - width, topoffset - height, 0,
+		leftoffset + width, topoffset - height, 0,
+		leftoffset - width, topoffset + height, 0,
+
+		leftoffset + width, topoffset - height, 0,
+		leftoffset - width, topoffset + height, 0,
+		leftoffset + width, topoffset + height, 0,
+
+		leftoffset - width * innerratio, topoffset - height * innerratio, 0,
+		leftoffset + width * innerratio, topoffset - height * innerratio, 0,
+		leftoffset - width * innerratio, topoffset + height * innerratio, 0,
+
+		leftoffset + width * innerratio, topoffset - height * innerratio, 0,
+		leftoffset - width * innerratio, topoffset + height * innerratio, 0,
+		leftoffset + width * innerratio, topoffset + height * innerratio, 0,
+		
+	};
+	static GLfloat color_buffer_data[] = {
+		228.0f/255.0f,142.0f/255.0f,57.0f/255.0f,
+		228.0f/255.0f,142.0f/255.0f,57.0f/255.0f,
+		228.0f/255.0f,142.0f/255.0f,57.0f/255.0f,
+		228.0f/255.0f,142.0f/255.0f,57.0f/255.0f,
+		228.0f/255.0f,142.0f/255.0f,57.0f/255.0f,
+		228.0f/255.0f,142.0f/255.0f,57.0f/255.0f,
+		
+		123.0f/255.0f,187.0f/255.0f,70.0f/255.0f,
+		123.0f/255.0f,187.0f/255.0f,70.0f/255.0f,
+		123.0f/255.0f,187.0f/255.0f,70.0f/255.0f,
+		123.0f/255.0f,187.0f/255.0f,70.0f/255.0f,
+		123.0f/255.0f,187.0f/255.0f,70.0f/255.0f,
+		123.0f/255.0f,187.0f/255.0f,70.0f/255.0f
+	};
+
+	powerboard = create3DObject(GL_TRIANGLES, 4*3 ,GAME_SCOREBOARD, vertex_buffer_data, color_buffer_data, -400 + 30, -270 +15, 30, GL_FILL);
+}
+
+void createPig ()
+{
+	// GL3 accepts only Triangles. Quads are not supported
+	double n=30;
+	static GLfloat vertex_buffer_data[6][9*30+2*3 +9*15*2 + 9*15*2 + 9*15 + 9*15 * 2];
+	static GLfloat color_buffer_data[6][9*30+2*3 + 9*15*2 + 9*15*2 + 9*15 + 9*15 * 2];
+	double sizea[6]={18 + 5, 23 +5 , 20 + 5, 25 + 5, 20 + 5, 28 + 5},sizeb[6]={18, 23, 20, 25, 20, 28};
+	double eyeline = 0.5;
+	float angle=0;
+	for(int j=0;j<6;j++)
+		for(int i=0;i<n;i++){
+			vertex_buffer_data[j][9*i] = vertex_buffer_data[j][9*i+1] = vertex_buffer_data[j][9*i+2] = 0;
+			vertex_buffer_data[j][9*i+3]=sizea[j]*cos(angle*M_PI/180.0f);
+			vertex_buffer_data[j][9*i+4]=sizeb[j]*sin(angle*M_PI/180.0f);
+			vertex_buffer_data[j][9*i+5]=0;
+			angle += 360.0f/n;
+			vertex_buffer_data[j][9*i+6]=sizea[j]*cos(angle*M_PI/180.0f);
+			vertex_buffer_data[j][9*i+7]=sizeb[j]*sin(angle*M_PI/180.0f);
+			vertex_buffer_data[j][9*i+8]=0;
+
+			color_buffer_data[j][9*i] = 114.0f/255.0f;
+			color_buffer_data[j][9*i+1] = 194.0f/255.0f;
+			color_buffer_data[j][9*i+2] = 65.0f/255.0f;
+			color_buffer_data[j][9*i+3] = 114.0f/255.0f;
+			color_buffer_data[j][9*i+4] = 194.0f/255.0f;
+			color_buffer_data[j][9*i+5] = 65.0f/255.0f;
+			color_buffer_data[j][9*i+6] = 114.0f/255.0f;
+			color_buffer_data[j][9*i+7] = 194.0f/255.0f;
+			color_buffer_data[j][9*i+8] = 65.0f/255.0f;
+		}
+	angle = 0;
+	float ap;
+	for(int j=0;j<6;j++,angle=0)
+		for(int i=n;i<2*n;i++){
+			if(i<n+(n/2))
+				ap = sizea[j]/2;
+			else
+				ap = -sizea[j]/2;
+			if(i==n+n/2) angle = 0;
+			vertex_buffer_data[j][9*i]=ap,vertex_buffer_data[j][9*i+1]=-0.5,vertex_buffer_data[j][9*i+2] = 0;
+			vertex_buffer_data[j][9*i+3]=ap+0.25*sizea[j]*cos(angle*M_PI/180.0f);
+			vertex_buffer_data[j][9*i+4]=-0.5+0.25*sizea[j]*sin(angle*M_PI/180.0f);
+			vertex_buffer_data[j][9*i+5]=0;
+			angle += 360.0f/(n/2);
+			vertex_buffer_data[j][9*i+6]=ap+0.25*sizea[j]*cos(angle*M_PI/180.0f);
+			vertex_buffer_data[j][9*i+7]=-0.5+0.25*sizea[j]*sin(angle*M_PI/180.0f);
+			vertex_buffer_data[j][9*i+8]=0;
+
+			color_buffer_data[j][9*i] = 1;//.0f/255.0f;
+			color_buffer_data[j][9*i+1] = 1;//194.0f/255.0f;
+			color_buffer_data[j][9*i+2] = 1;//65.0f/255.0f;
+			color_buffer_data[j][9*i+3] = 1;//114.0f/255.0f;
+			color_buffer_data[j][9*i+4] = 1;//194.0f/255.0f;
+			color_buffer_data[j][9*i+5] = 1;//65.0f/255.0f;
+			color_buffer_data[j][9*i+6] = 1;//114.0f/255.0f;
+			color_buffer_data[j][9*i+7] = 1;//194.0f/255.0f;
+			color_buffer_data[j][9*i+8] = 1;//65.0f/255.0f;
+		}
+	for(int j=0;j<6;j++,angle=0)
+		for(int i=2*n;i<3*n;i++){
+			if(i<2*n+(n/2))
+				ap = 0.41*sizea[j];
+			else
+				ap = -0.41*sizea[j];
+			if(i==2*n+n/2) angle = 0;
+			vertex_buffer_data[j][9*i]=ap,vertex_buffer_data[j][9*i+1]=-0.5,vertex_buffer_data[j][9*i+2] = 0;
+			vertex_buffer_data[j][9*i+3]=ap+0.1*sizea[j]*cos(angle*M_PI/180.0f);
+			vertex_buffer_data[j][9*i+4]=-0.5+0.1*sizea[j]*sin(angle*M_PI/180.0f);
+			vertex_buffer_data[j][9*i+5]=0;
+			angle += 360.0f/(n/2);
+			vertex_buffer_data[j][9*i+6]=ap+0.1*sizea[j]*cos(angle*M_PI/180.0f);
+			vertex_buffer_data[j][9*i+7]=-0.5+0.1*sizea[j]*sin(angle*M_PI/180.0f);
+			vertex_buffer_data[j][9*i+8]=0;
+
+			color_buffer_data[j][9*i] = 0;//.0f/255.0f;
+			color_buffer_data[j][9*i+1] = 0;//194.0f/255.0f;
+			color_buffer_data[j][9*i+2] = 0;//65.0f/255.0f;
+			color_buffer_data[j][9*i+3] = 0;//114.0f/255.0f;
+			color_buffer_data[j][9*i+4] = 0;//194.0f/255.0f;
+			color_buffer_data[j][9*i+5] = 0;//65.0f/255.0f;
+			color_buffer_data[j][9*i+6] = 0;//114.0f/255.0f;
+			color_buffer_data[j][9*i+7] = 0;//194.0f/255.0f;
+			color_buffer_data[j][9*i+8] = 0;//65.0f/255.0f;
+		}
+	angle = 0;
 	for(int j=0;j<6;j++,angle=0)
 		for(int i=3*n;i<3*n + n/2;i++){
 			vertex_buffer_data[j][9*i]=0,vertex_buffer_data[j][9*i+1]=5,vertex_buffer_data[j][9*i+2] = 0;
@@ -807,691 +3184,2270 @@ void createPig ()
 			color_buffer_data[j][9*i+7] = 233.0f/255.0f;
 			color_buffer_data[j][9*i+8] = 1.0f/255.0f;
 		}
-	angle = 0;
-	for(int j=0;j<6;j++,angle=0)
-		for(int i=3*n + n/2;i<4*n + n/2;i++){
-			if(i<4*n)
-				ap = 0.1*sizea[j];
-			else
-				ap = -0.1*sizea[j];
-			if(i==4*n) angle = 0;
-			vertex_buffer_data[j][9*i]=ap,vertex_buffer_data[j][9*i+1]=5,vertex_buffer_data[j][9*i+2] = 0;
-			vertex_buffer_data[j][9*i+3]=ap+0.08*sizea[j]*cos(angle*M_PI/180.0f);
-			vertex_buffer_data[j][9*i+4]=5+0.08*sizea[j]*sin(angle*M_PI/180.0f);
-			vertex_buffer_data[j][9*i+5]=0;
-			angle += 360.0f/(n/2);
-			vertex_buffer_data[j][9*i+6]=ap+0.08*sizea[j]*cos(angle*M_PI/180.0f);
-			vertex_buffer_data[j][9*i+7]=5+0.08*sizea[j]*sin(angle*M_PI/180.0f);
-			vertex_buffer_data[j][9*i+8]=0;
-//rgb(31,55,24)
-			color_buffer_data[j][9*i] = 31.0f/255.0f;
-			color_buffer_data[j][9*i+1] = 55.0f/255.0f;
-			color_buffer_data[j][9*i+2] = 24.0/255.0f;
-			color_buffer_data[j][9*i+3] = 31.0f/255.0f;
-			color_buffer_data[j][9*i+4] = 55.0f/255.0f;
-			color_buffer_data[j][9*i+5] = 24.0f/255.0f;
-			color_buffer_data[j][9*i+6] = 31.0f/255.0f;
-			color_buffer_data[j][9*i+7] = 55.0f/255.0f;
-			color_buffer_data[j][9*i+8] = 24.0f/255.0f;
+	angle = 0;
+	for(int j=0;j<6;j++,angle=0)
+		for(int i=3*n + n/2;i<4*n + n/2;i++){
+			if(i<4*n)
+				ap = 0.1*sizea[j];
+			else
+				ap = -0.1*sizea[j];
+			if(i==4*n) angle = 0;
+			vertex_buffer_data[j][9*i]=ap,vertex_buffer_data[j][9*i+1]=5,vertex_buffer_data[j][9*i+2] = 0;
+			vertex_buffer_data[j][9*i+3]=ap+0.08*sizea[j]*cos(angle*M_PI/180.0f);
+			vertex_buffer_data[j][9*i+4]=5+0.08*sizea[j]*sin(angle*M_PI/180.0f);
+			vertex_buffer_data[j][9*i+5]=0;
+			angle += 360.0f/(n/2);
+			vertex_buffer_data[j][9*i+6]=ap+0.08*sizea[j]*cos(angle*M_PI/180.0f);
+			vertex_buffer_data[j][9*i+7]=5+0.08*sizea[j]*sin(angle*M_PI/180.0f);
+			vertex_buffer_data[j][9*i+8]=0;
+//rgb(31,55,24)
+			color_buffer_data[j][9*i] = 31.0f/255.0f;
+			color_buffer_data[j][9*i+1] = 55.0f/255.0f;
+			color_buffer_data[j][9*i+2] = 24.0/255.0f;
+			color_buffer_data[j][9*i+3] = 31.0f/255.0f;
+			color_buffer_data[j][9*i+4] = 55.0f/255.0f;
+			color_buffer_data[j][9*i+5] = 24.0f/255.0f;
+			color_buffer_data[j][9*i+6] = 31.0f/255.0f;
+			color_buffer_data[j][9*i+7] = 55.0f/255.0f;
+			color_buffer_data[j][9*i+8] = 24.0f/255.0f;
+		}
+	piginitx[0]=50, piginitx[1]=345, piginitx[2] = 415, piginitx[3] = 280, piginitx[4] = 70,piginitx[5] = 100;
+	// create3DObject creates and returns a handle to a VAO that can be used later
+	pigFans[0] = create3DObject(GL_TRIANGLES, 4*n*3 + (n/2) *3  ,GAME_PIG, vertex_buffer_data[0], color_buffer_data[0], 50, 200-sizeb[0], sizea[0], GL_FILL);
+	pigFans[1] = create3DObject(GL_TRIANGLES, 4*n*3 + (n/2) *3 ,GAME_PIG, vertex_buffer_data[1], color_buffer_data[1], 345, 200-50-sizeb[1], sizea[1], GL_FILL);
+	pigFans[2] = create3DObject(GL_TRIANGLES, 4*n*3 + (n/2) *3  ,GAME_PIG, vertex_buffer_data[2], color_buffer_data[2], 415, 200-sizeb[2], sizea[2], GL_FILL);
+	pigFans[3] = create3DObject(GL_TRIANGLES, 4*n*3 + (n/2) *3  ,GAME_PIG, vertex_buffer_data[3], color_buffer_data[3], 280, 200-50-40-sizeb[3], sizea[3], GL_FILL);
+	pigFans[4] = create3DObject(GL_TRIANGLES, 4*n*3 + (n/2) *3  ,GAME_PIG, vertex_buffer_data[4], color_buffer_data[4], 70, -110 - 10- sizeb[4], sizea[4], GL_FILL);
+	pigFans[5] = create3DObject(GL_TRIANGLES, 4*n*3 + (n/2) *3  ,GAME_PIG, vertex_buffer_data[5], color_buffer_data[5], 100, -210 - 10- sizeb[5], sizea[4], GL_FILL);
+
+	// The same pigs as one quad per ellipse, cut round by the ellipse program
+	for(int j=0;j<6;j++){
+		float a = sizea[j], b = sizeb[j];
+		Ellipse parts[8] = {
+			{0, 0, a, b, glm::vec3(114.0f/255.0f, 194.0f/255.0f, 65.0f/255.0f)},  // Body
+			{a/2, -0.5f, 0.25f*a, 0.25f*a, glm::vec3(1, 1, 1)},                  // Eyes
+			{-a/2, -0.5f, 0.25f*a, 0.25f*a, glm::vec3(1, 1, 1)},
+			{0.41f*a, -0.5f, 0.1f*a, 0.1f*a, glm::vec3(0, 0, 0)},                // Pupils
+			{-0.41f*a, -0.5f, 0.1f*a, 0.1f*a, glm::vec3(0, 0, 0)},
+			{0, 5, 0.25f*a, 0.25f*a, glm::vec3(167.0f/255.0f, 233.0f/255.0f, 1.0f/255.0f)},   // Snout
+			{0.1f*a, 5, 0.08f*a, 0.08f*a, glm::vec3(31.0f/255.0f, 55.0f/255.0f, 24.0f/255.0f)}, // Nostrils
+			{-0.1f*a, 5, 0.08f*a, 0.08f*a, glm::vec3(31.0f/255.0f, 55.0f/255.0f, 24.0f/255.0f)}
+		};
+		pigs[j] = createEllipseObject(parts, 8, NULL, NULL, 0, GAME_PIG, pigFans[j]->centerx, pigFans[j]->centery, pigFans[j]->radius);
+	}
+
+	pig_wood[3] = 1;
+	pig_wood[1] = 2;
+}
+// Creates the rectangle object used in this sample code
+void createCannonball ()
+{
+	// Body, eye and pupil are ellipses, the beak one flat triangle on top
+	float size = cannonball_size;
+	Ellipse parts[3] = {
+		{0, 0, size, size, glm::vec3(214.0f/255.0f, 1.0f/255.0f, 14.0f/255.0f)},
+		{5, -2, 0.25f*size, 0.5f*size, glm::vec3(1, 1, 1)},
+		{5, 0, 0.15f*size, 0.15f*size, glm::vec3(0, 0, 0)}
+	};
+	float tip = 360.0f/20 * M_PI/180.0f;
+	GLfloat beak[9] = {
+		size*cosf(tip), size*sinf(tip), 0,
+		size + 10, -2, 0,
+		size*cosf(tip), -size*sinf(tip), 0
+	};
+	GLfloat beakColors[9];
+	for(int i=0;i<9;i+=3){
+		beakColors[i] = 252.0f/255.0f;
+		beakColors[i+1] = 187.0f/255.0f;
+		beakColors[i+2] = 35.0f/255.0f;
+	}
+	// createEllipseObject creates and returns a handle to a VAO that can be used later
+	cannonball = createEllipseObject(parts, 3, beak, beakColors, 3, GAME_BIRD, 0, 0, cannonball_size);
+}
+
+void createGameFloor ()
+{
+	static GLfloat vertex_buffer_data [20*18];
+
+	double base=200;
+	for(int i=0;i<20;i++){
+		vertex_buffer_data[18*i]=-600,vertex_buffer_data[18*i+1]=base,vertex_buffer_data[18*i+2]=0;
+		vertex_buffer_data[18*i+3]=-600,vertex_buffer_data[18*i+4]=base+10,vertex_buffer_data[18*i+5]=0;
+		vertex_buffer_data[18*i+6]=600,vertex_buffer_data[18*i+7]=base,vertex_buffer_data[18*i+8]=0;
+		vertex_buffer_data[18*i+9]=600,vertex_buffer_data[18*i+10]=base+10,vertex_buffer_data[18*i+11]=0;
+		vertex_buffer_data[18*i+12]=-600,vertex_buffer_data[18*i+13]=base+10,vertex_buffer_data[18*i+14]=0;
+		vertex_buffer_data[18*i+15]=600,vertex_buffer_data[18*i+16]=base,vertex_buffer_data[18*i+17]=0;
+		base+=5;
+	}
+
+	static  GLfloat color_buffer_data [20*18]; 
+	double gred=133.0/255.0f,ggreen=183.0/255.0f,gblue=52.0/255.0f;
+	for(int i=0;i<20;i++){
+		color_buffer_data[18*i]=gred,color_buffer_data[18*i+1]=ggreen,color_buffer_data[18*i+2]=gblue;
+		color_buffer_data[18*i+3]=gred,color_buffer_data[18*i+4]=ggreen,color_buffer_data[18*i+5]=gblue;
+		color_buffer_data[18*i+6]=gred,color_buffer_data[18*i+7]=ggreen,color_buffer_data[18*i+8]=gblue;
+		color_buffer_data[18*i+9]=gred,color_buffer_data[18*i+10]=ggreen,color_buffer_data[18*i+11]=gblue;
+		color_buffer_data[18*i+12]=gred,color_buffer_data[18*i+13]=ggreen,color_buffer_data[18*i+14]=gblue;
+		color_buffer_data[18*i+15]=gred,color_buffer_data[18*i+16]=ggreen,color_buffer_data[18*i+17]=gblue;
+		ggreen+=10.0f/255.0f;
+		gred+=2.5f/255.0f;
+	}
+	floorStrips = create3DObject(GL_TRIANGLES, 20*6, GAME_WOOD_HORIZONTAL, vertex_buffer_data, color_buffer_data, GL_FILL, fireposx, fireposy, 25);
+
+	// What the game draws: one quad over the strips, the ground program colours
+	// each pixel with the strip that was drawn last at its height
+	GLfloat quad_buffer_data [] = {
+		-600, 200, 0,
+		-600, base+5, 0,
+		600, 200, 0,
+		-600, base+5, 0,
+		600, 200, 0,
+		600, base+5, 0
+	};
+	gameFloor = create3DObject(GL_TRIANGLES, 6, quad_buffer_data, 133.0/255.0f, 183.0/255.0f, 52.0/255.0f, fireposx, fireposy, 25, GL_FILL);
+}
+
+GLfloat woodsizex[6],woodsizey[6];
+void createWoodLogs(){
+
+
+	static GLfloat vertex_buffer_data[6][18];
+	woodsizex[0] = 10;
+	woodsizey[0] = 30;
+	woodsizex[1] = 35;
+	woodsizey[1] = 20;
+	woodsizex[2] = 75;
+	woodsizey[2] = 25;
+	woodsizex[3] = 10;
+	woodsizey[3] = 100;
+	woodsizex[4] = 50;
+	woodsizey[4] = 10;
+	woodsizex[5] = 50;
+	woodsizey[5] = 10;
+
+	for(int i=0;i<=5;i++){
+		vertex_buffer_data[i][0] = vertex_buffer_data[i][3] = vertex_buffer_data[i][12] = -woodsizex[i];
+		vertex_buffer_data[i][6] = vertex_buffer_data[i][9] = vertex_buffer_data[i][15] = woodsizex[i];
+		vertex_buffer_data[i][1] = vertex_buffer_data[i][7] = vertex_buffer_data[i][10] = woodsizey[i];
+		vertex_buffer_data[i][4] = vertex_buffer_data[i][13] = vertex_buffer_data[i][16] = -woodsizey[i];
+	}
+	static const GLfloat color_buffer_data [] = {
+		228.0f/255.0f,142.0f/255.0f,57.0f/255.0f,
+		228.0f/255.0f,142.0f/255.0f,57.0f/255.0f,
+		228.0f/255.0f,142.0f/255.0f,57.0f/255.0f,
+		228.0f/255.0f,142.0f/255.0f,57.0f/255.0f,
+		228.0f/255.0f,142.0f/255.0f,57.0f/255.0f,
+		228.0f/255.0f,142.0f/255.0f,57.0f/255.0f
+	};
+	static const GLfloat color_buffer_data3 [] = {
+		212.0f/255.0f,121.0f/255.0f,52.0f/255.0f,
+		212.0f/255.0f,121.0f/255.0f,52.0f/255.0f,
+		212.0f/255.0f,121.0f/255.0f,52.0f/255.0f,
+		212.0f/255.0f,121.0f/255.0f,52.0f/255.0f,
+		212.0f/255.0f,121.0f/255.0f,52.0f/255.0f,
+		212.0f/255.0f,121.0f/255.0f,52.0f/255.0f
+	};
+	woodlogs[0] = create3DObject(GL_TRIANGLES, 6, GAME_WOOD_VERTICAL, vertex_buffer_data[0], color_buffer_data, GL_FILL, 0, 0, 25);
+	woodlogs[1] = create3DObject(GL_TRIANGLES, 6, GAME_WOOD_HORIZONTAL, vertex_buffer_data[1], color_buffer_data, 280, 130, 25, GL_FILL);
+	woodlogs[2] = create3DObject(GL_TRIANGLES, 6, GAME_WOOD_HORIZONTAL, vertex_buffer_data[2], color_buffer_data3, 310, 175, 25, GL_FILL);
+	woodlogs[3] = create3DObject(GL_TRIANGLES, 6, GAME_WOOD_VERTICAL, vertex_buffer_data[3], color_buffer_data3, 150, -200, 25, GL_FILL);
+	woodlogs[4] = create3DObject(GL_TRIANGLES, 6, GAME_WOOD_VERTICAL, vertex_buffer_data[4], color_buffer_data3, 90, -110, 25, GL_FILL);
+	woodlogs[5] = create3DObject(GL_TRIANGLES, 6, GAME_WOOD_VERTICAL, vertex_buffer_data[4], color_buffer_data3, 90, -210, 25, GL_FILL);
+
+}
+
+void createCatapult(){
+	static const GLfloat vertex_buffer_data[] = {
+		-0.5, -4, 0,
+		-0.5, 4, 0,
+		0.5, -4, 0,
+
+		-0.5, 4, 0,
+		0.5, -4, 0,
+		0.5, 4, 0
+	};
+
+	static const GLfloat color_buffer_data[] = {
+		86.0f/255.0f,38.0f/255.0f,15.0f/255.0f,
+		86.0f/255.0f,38.0f/255.0f,15.0f/255.0f,
+		86.0f/255.0f,38.0f/255.0f,15.0f/255.0f,
+		86.0f/255.0f,38.0f/255.0f,15.0f/255.0f,
+		86.0f/255.0f,38.0f/255.0f,15.0f/255.0f,
+		86.0f/255.0f,38.0f/255.0f,15.0f/255.0f
+	};
+	catapult = create3DObject(GL_TRIANGLES, 2*3 ,GAME_WOOD_HORIZONTAL, vertex_buffer_data, color_buffer_data, 50, 200, 0, GL_FILL);
+}
+float camera_rotation_angle = 90;
+float rectangle_rotation = 0;
+int lineorfill=GL_FILL;
+/* Render the scene with openGL */
+/* Edit this function according to your assignment */
+
+VAO *temp ;
+void createtemp(){
+	static const GLfloat vertex_buffer_data [] = {
+		0, 0, 0,
+		0, -100, 0,
+		100, 0, 0
+	};
+	 static const GLfloat color_buffer_data [] ={
+		 1,0,0,1,0,0,1,0,0};
+	temp = create3DObject(GL_TRIANGLES, 3 ,GAME_WOOD_HORIZONTAL, vertex_buffer_data, color_buffer_data, 50, 200, 0, GL_FILL);
+}
+
+/* Advance the game by one step and record what it looks like into list. No GL calls in here */
+void simulateFrame (RenderList& list)
+{
+	PROFILE_SCOPE("simulate");
+	double start = monotonicTime();
+	clearRenderList(list);
+	list.width = framebufferWidth;
+	list.height = framebufferHeight;
+	list.inputTime = lastInputTime;
+
+	// Eye - Location of camera. Don't change unless you are sure!!
+	glm::vec3 eye ( 5*cos(camera_rotation_angle*M_PI/180.0f), 0, 5*sin(camera_rotation_angle*M_PI/180.0f) );
+	// Target - Where is the camera looking at.  Don't change unless you are sure!!
+	glm::vec3 target (0, 0, 0);
+	// Up - Up vector defines tilt of camera.  Don't change unless you are sure!!
+	glm::vec3 up (0, 1, 0);
+
+	// Compute Camera matrix (view)
+	//Matrices.view = glm::lookAt( eye, target, up ); // Rotating Camera for 3D
+	//  Don't change unless you are sure!!
+	Matrices.view = glm::lookAt(glm::vec3(0,0,3), glm::vec3(0,0,0), glm::vec3(0,1,0)); // Fixed camera for 2D (ortho) in XY plane
+
+	// Compute ViewProject matrix as view/camera might not be changed for this frame (basic scenario)
+	//  Don't change unless you are sure!!
+	glm::mat4 VP = Matrices.projection * Matrices.view;
+
+	// The view-projection goes once for the whole frame through the Camera block,
+	// each command below only carries its model matrix and the GPU does VP * M
+	//  Don't change unless you are sure!!
+	list.VP = VP;
+	list.viewBounds = viewBounds;
+
+	
+	//Displaying background using texture
+	Matrices.model = glm::mat4(1.0f);
+	recordSprite(list, "background", -600, -300, 600, 300, Matrices.model, LAYER_BACKGROUND);
+	
+	
+	// Load identity to model matrix
+	Matrices.model = glm::mat4(1.0f);
+
+	/* Render your scene */
+
+	//glm::mat4 translateTriangle = glm::translate (glm::vec3(-2.0f, 0.0f, 0.0f)); // glTranslatef
+	//glm::mat4 rotateTriangle = glm::rotate((float)(triangle_rotation*M_PI/180.0f), glm::vec3(0,0,1));  // rotate about vector (1,0,0)
+	//glm::mat4 triangleTransform = translateTriangle * rotateTriangle;
+	//  Matrices.model *= triangleTransform; 
+	// recordDraw records the VAO given to it with the current model matrix
+	//  recordDraw(list, programID, triangle, Matrices.model, LAYER_PIGS);
+
+	// Pop matrix to undo transformations till last push matrix instead of recomputing model matrix
+	// glPopMatrix ();
+	//Displaying pigs and counting them for score 
+	int cnt = 0;
+	for(int i=0;i<6;i++){
+		if(!pigs[i]->dead){
+			double x1 = cannonball->centerx,y1 = cannonball->centery, x2 = pigs[i]->centerx, y2 = pigs[i]->centery;
+			if(pigs[i]->radius + cannonball->radius > sqrt((x2-x1)*(x2-x1)+(y2-y1)*(y2-y1))){
+				pigs[i]->dead = 1;
+				scoretimer[i][0] = pigs[i]->centerx; 
+				scoretimer[i][1] = pigs[i]->centery; 
+				scoretimer[i][2] = tim;
+				speedx = 0.1*speedx;
+				speedy = 0.1*speedy;
+			}
+
+			Matrices.model = glm::mat4(1.0f);
+			glm::mat4 translatePig = glm::translate(glm::vec3(pigs[i]->centerx + pigspx[i],pigs[i]->centery + pigspy[i],0));
+			pigs[i]->centerx += pigspx[i];
+			pigs[i]->centery += pigspy[i];
+			glm::mat4 rotatePig = glm::rotate((float)((pigs[i]->centerx-piginitx[i])/pigs[i]->radius),glm::vec3(0,0,1));
+			pigspx[i]/= 1.02;
+			Matrices.model *= (translatePig*rotatePig);
+			recordBody(list, ellipseProgramID, pigs[i], Matrices.model, LAYER_PIGS, BODY_PIGS + i);
+
+		}
+		else
+			cnt++;
+	}
+
+	//Displaying game floor
+	Matrices.model = glm::mat4(1.0f);
+	recordDraw(list, groundProgramID, gameFloor, Matrices.model, LAYER_FLOOR);
+	
+
+	//Checking collisions between pigs and wood logs
+	long long physics = profileBegin();
+	Matrices.model = glm::mat4(1.0f);
+	glm::mat4 translateWoodlog,rotateWoodlog;
+	translateWoodlog = glm::translate(glm::vec3(0,170,0));
+	if(collision_state==1){
+		if(pivotx == -10){
+			translateWoodlog = glm::translate(glm::vec3(10,200,0));
+			glm::mat4 translateWoodlog2 = glm::translate(glm::vec3(pivotx,pivoty,0));
+			rotateWoodlog = glm::rotate((float)(angle[0]*M_PI/180.0f), glm::vec3(0,0,1));
+			angle[0] += angular_v[0];
+			angular_v[0] += 0.3;
+			angle[0] = min(angle[0],90.0);
+			Matrices.model *= (translateWoodlog*rotateWoodlog*translateWoodlog2);
+			if(angle[0] >= 45){
+				pigs[0]->dead = 1;
+				scoretimer[0][0]=pigs[0]->centerx;
+				scoretimer[0][1]=pigs[0]->centery;
+				scoretimer[0][2]=tim;
+			}
+		}
+		else{
+			translateWoodlog = glm::translate(glm::vec3(-10,200,0));
+			glm::mat4 translateWoodlog2 = glm::translate(glm::vec3(pivotx,pivoty,0));
+			rotateWoodlog = glm::rotate((float)(angle[0]*M_PI/180.0f), glm::vec3(0,0,1));
+			angle[0] -= angular_v[0];
+			angular_v[0] += 0.3;
+			angle[0] = max(angle[0],-90.0);
+			Matrices.model *= (translateWoodlog*rotateWoodlog*translateWoodlog2);
+			if(angle[0] >= 45){
+				pigs[0]->dead = 1;
+				scoretimer[0][0]=pigs[0]->centerx;
+				scoretimer[0][1]=pigs[0]->centery;
+				scoretimer[0][2]=tim;
+			}
+		}
+	}
+	else
+		Matrices.model *= translateWoodlog;
+	recordBody(list, programID, woodlogs[0], Matrices.model, LAYER_LOGS, BODY_LOGS);
+
+	//Displaying wood logs
+	for(int i=1;i<=5;i++){
+		Matrices.model = glm::mat4(1.0f);
+		translateWoodlog = glm::translate(glm::vec3(woodlogs[i]->centerx + woodspx[i],woodlogs[i]->centery,0));
+		woodlogs[i]->centerx += woodspx[i];
+		woodspx[i] /= 1.02;
+		Matrices.model *= translateWoodlog;
+		recordBody(list, programID, woodlogs[i], Matrices.model, LAYER_LOGS, BODY_LOGS + i);
+		if(i<=2&&woodlogs[i]->centerx + woodsizex[i] > pigs[i]->centerx - pigs[i]->radius){
+			pigspx[i] = woodspx[i]*0.95;
+			woodspx[i]=woodspx[i]*0.9;
+			pigs[i]->centerx = woodlogs[i]->centerx + woodsizex[i] + pigs[i]->radius;
+		}
+	}
+
+	//Checking collisions between pigs and pigs
+	for(int i=0;i<4;i++) {
+		if(pig_wood[i]!=0){
+			int j = pig_wood[i];
+			
+			if(j==1){
+				if(pigs[i]->centerx+pigs[i]->radius<woodlogs[j]->centerx - woodsizex[j])
+					pigspy[i]+=gravity/3.0f;
+				if((pigs[i]->centery+pigs[i]->radius > woodlogs[j+1]->centery - woodsizey[j+1])
+						||pigs[i]->centery + pigs[i]->radius > 200){
+					pigs[i]->dead=1;
+					scoretimer[i][0] = pigs[i]->centerx; 
+					scoretimer[i][1] = pigs[i]->centery; 
+					scoretimer[i][2] = tim;
+				}
+
+			}
+			if(j==2){
+				if(pigs[i]->centerx-pigs[i]->radius>woodlogs[j]->centerx + woodsizex[j])
+					pigspy[i]+=gravity/3.0f;
+				double x1 = pigs[i]->centerx, y1 = pigs[i]->centery, x2 = pigs[i+1]->centerx, y2 = pigs[i+1]->centery;
+				if(sqrt((x1-x2)*(x1-x2)+(y1-y2)*(y1-y2)) < pigs[i]->radius + pigs[i+1]->radius)
+				{
+					pigs[i]->dead=pigs[i+1]->dead = 1;
+					scoretimer[i][0] = pigs[i]->centerx; 
+					scoretimer[i][1] = pigs[i]->centery; 
+					scoretimer[i][2]=tim;
+					scoretimer[i+1][0] = pigs[i+1]->centerx; 
+					scoretimer[i+1][1] = pigs[i+1]->centery; 
+					scoretimer[i+1][2]=tim;
+				}
+				if(pigs[i]->centery+pigs[i]->radius>200){
+					pigs[i]->dead=1;
+					scoretimer[i][0] = pigs[i]->centerx; 
+					scoretimer[i][1] = pigs[i]->centery; 
+					scoretimer[i][2]=tim;
+				}
+				
+			}
+		}
+	}
+
+	profileEnd(physics, "physics: pigs and logs");
+
+	//Controlling bird using keyboard
+	if(keyboard_pressed_statex == 1){
+		keyboardy -= 2;
+		if(keyboardx < fireposx)
+			keyboardx += 2;
+		else if(keyboardx > fireposx)
+			keyboardx -= 2;
+		curx = keyboardx;
+		cury = keyboardy;
+	}
+	if(keyboard_pressed_statey == 1){
+		keyboardy += 2;
+		if(keyboardx < fireposx)
+			keyboardx -=2;
+		else if(keyboardx >fireposx)
+			keyboardx += 2;
+		curx = keyboardx;
+		cury = keyboardy;
+	}
+		
+	//Limiting the power with which bird can be shot
+	if(pressed_state==1 || keyboard_pressed_statex == 1 || keyboard_pressed_statey == 1)
+		if(sqrt((curx-initx)*(curx-initx)+(cury-inity)*(cury-inity)) > 70){
+			double angle_present = -M_PI+atan2(inity-cury,initx-curx);
+			curx = initx + 70*cos(angle_present);
+			cury = inity + 70*sin(angle_present);
+		}
+	
+	//Displaying catapult
+	Matrices.model = glm::mat4(1.0f);
+	glm::mat4 translateCatapult = glm::translate(glm::vec3(-0.5, -4, 0));
+	glm::mat4 translateCatapult2 = glm::translate(glm::vec3(fireposx-10 , fireposy+10 , 0));
+	glm::mat4 rotateCatapult = glm::rotate((float)(atan2(-cury+fireposy+10 ,-curx+fireposx-10)), glm::vec3(0,0,1));
+	double scalelength2 = sqrt((fireposx-10 - curx)*(fireposx -10 -curx) + (fireposy+10 - cury)*(fireposy+10-cury));
+	glm::mat4 scaleCatapult = glm::scale(glm::vec3(scalelength2 , 1, 1));
+	if(pressed_state == 1 || keyboard_pressed_statex == 1 || keyboard_pressed_statey == 1)
+		Matrices.model *= (translateCatapult2 * rotateCatapult *  scaleCatapult * translateCatapult);
+	else
+		Matrices.model *= translateCatapult;
+	if(pressed_state==1)
+		recordStreamed(list, programID, catapult, Matrices.model, LAYER_BAND_BACK);
+
+	//Displaying the bird
+	Matrices.model = glm::mat4(1.0f);
+	glm::mat4 translateRectangle;// = glm::translate (glm::vec3(curx, cury, 0));        // glTranslatef
+	glm::mat4 rotateRectangle; // rotate about vector (-1,1,1)
+	if(pressed_state==0 && keyboard_pressed_statex == 0 && keyboard_pressed_statey == 0){
+		translateRectangle = glm::translate (glm::vec3(fireposx, fireposy, 0));        // glTranslatef
+		cannonball->centerx = fireposx;
+		cannonball->centery = fireposy;
+		cannonball->radius = cannonball_size;
+	}
+	else if(pressed_state==1 || keyboard_pressed_statex == 1 || keyboard_pressed_statey == 1){
+		if(sqrt((curx-initx)*(curx-initx)+(cury-inity)*(cury-inity)) > 70){
+			double angle_present = -M_PI+atan2(inity-cury,initx-curx);
+			curx = initx + 70*cos(angle_present);
+			cury = inity + 70*sin(angle_present);
+		}
+		power = sqrt((curx-initx)*(curx-initx) + (cury-inity)*(cury-inity));
+		translateRectangle = glm::translate (glm::vec3(curx, cury, 0));        // glTranslatef
+		cannonball->centerx = curx;
+		cannonball->centery = cury;
+		cannonball->radius = cannonball_size;
+	}
+	else {
+		translateRectangle = glm::translate (glm::vec3(initx, inity, 0));        // glTranslatef
+		cannonball->centerx = initx;
+		cannonball->centery = inity;
+		cannonball->radius = cannonball_size;
+	}
+	if(collision_state == 0 && cannonball->centerx >= -10 - cannonball_size && cannonball->centerx <= -10 + 20 + cannonball_size && cannonball->centery >= 140 - cannonball_size ){
+		collision_state=1;
+		angle[0] = 0.1;
+		angular_v[0] = speedx*0.2;
+		if(cannonball->centerx > 10){
+			pivotx = 10;
+			angle[0] = -0.1;
+			angular_v[0] = -speedx*0.2;
+		}
+		if(cannonball->centery < 140 && cannonball->centerx > -10 - cannonball_size/2 && (cannonball->centerx < 10 + cannonball_size/2)){
+			speedy = -0.5*speedy;
+			inity = 140 - cannonball_size - 1;
 		}
-	piginitx[0]=50, piginitx[1]=345, piginitx[2] = 415, piginitx[3] = 280, piginitx[4] = 70,piginitx[5] = 100;
-	// create3DObject creates and returns a handle to a VAO that can be used later
-	pigs[0] = create3DObject(GL_TRIANGLES, 4*n*3 + (n/2) *3  ,GAME_PIG, vertex_buffer_data[0], color_buffer_data[0], 50, 200-sizeb[0], sizea[0], GL_FILL);
-	pigs[1] = create3DObject(GL_TRIANGLES, 4*n*3 + (n/2) *3 ,GAME_PIG, vertex_buffer_data[1], color_buffer_data[1], 345, 200-50-sizeb[1], sizea[1], GL_FILL);
-	pigs[2] = create3DObject(GL_TRIANGLES, 4*n*3 + (n/2) *3  ,GAME_PIG, vertex_buffer_data[2], color_buffer_data[2], 415, 200-sizeb[2], sizea[2], GL_FILL);
-	pigs[3] = create3DObject(GL_TRIANGLES, 4*n*3 + (n/2) *3  ,GAME_PIG, vertex_buffer_data[3], color_buffer_data[3], 280, 200-50-40-sizeb[3], sizea[3], GL_FILL);
-	pigs[4] = create3DObject(GL_TRIANGLES, 4*n*3 + (n/2) *3  ,GAME_PIG, vertex_buffer_data[4], color_buffer_data[4], 70, -110 - 10- sizeb[4], sizea[4], GL_FILL);
-	pigs[5] = create3DObject(GL_TRIANGLES, 4*n*3 + (n/2) *3  ,GAME_PIG, vertex_buffer_data[5], color_buffer_data[5], 100, -210 - 10- sizeb[5], sizea[4], GL_FILL);
+		else{
+			speedx = -0.5*speedx;
+		}
+	}
 
-	pig_wood[3] = 1;
-	pig_wood[1] = 2;
+	for(int i=1;i<=5;i++){
+		double x = cannonball->centerx,y = cannonball->centery;
+		if(x >= woodlogs[i]->centerx - woodsizex[i] - cannonball_size && x <= woodlogs[i]->centerx + woodsizex[i] + cannonball_size && y >= woodlogs[i]->centery - woodsizey[i] - cannonball_size && y <= woodlogs[i]->centery + woodsizey[i]) {
+			if(cannonball->centery < woodlogs[i]->centery - woodsizey[i] && cannonball->centerx > woodlogs[i]->centerx - woodsizex[i] - cannonball_size/2 ){
+				speedy = -0.25*speedy, speedx = 0.25*speedx;
+				inity = woodlogs[i]->centery - woodsizey[i] - cannonball_size - 1;
+			}
+			else {
+				if(i==1){
+					woodspx[1] = speedx * 0.1;
+					woodspx[2] = woodspx[1] * 0.1;
+				}
+				else if(i==2){
+					woodspx[2] = speedx * 0.05;
+					woodspx[1] = woodspx[2] * 0.5;
+				}
+				speedx = -0.25*speedx, speedy = 0.25*speedy;
+				initx = woodlogs[i]->centerx - woodsizex[i] - cannonball_size - 1;
+			}
+			break;
+		}
+	}
+	if(pressed_state==3) 
+		rotateRectangle = glm::rotate((float)(atan2(-prevy+inity,-prevx+initx)), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
+	else
+		rotateRectangle = glm::rotate((float)(atan2(-cury+inity,-curx+initx)), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
+
+	if(pressed_state==3 || pressed_state==1 || keyboard_pressed_statex == 1 || keyboard_pressed_statey)  Matrices.model *= (translateRectangle * rotateRectangle);
+	else  Matrices.model *= (translateRectangle );
+
+	// recordBody records the VAO given to it with the current model matrix
+	recordBody(list, ellipseProgramID, cannonball, Matrices.model, LAYER_BIRD, BODY_BIRD);
+
+
+	//Displaying power
+	Matrices.model = glm::mat4(1.0f);
+	translateCatapult = glm::translate(glm::vec3(-0.5, -4, 0));
+	translateCatapult2 = glm::translate(glm::vec3(fireposx + 20, fireposy + 15, 0));
+	rotateCatapult = glm::rotate((float)(atan2(-cury+fireposy + 15,-curx+fireposx + 20)), glm::vec3(0,0,1));
+	double scalelength = sqrt((fireposx+20 - curx)*(fireposx + 20 -curx) + (fireposy+15 - cury)*(fireposy+15-cury));
+	scaleCatapult = glm::scale(glm::vec3(scalelength , 1, 1));
+	if(pressed_state == 1 || keyboard_pressed_statex == 1 || keyboard_pressed_statey == 1)
+		Matrices.model *= (translateCatapult2 * rotateCatapult *  scaleCatapult * translateCatapult);
+	else
+		Matrices.model *= translateCatapult;
+	if(pressed_state ==1) recordStreamed(list, programID, catapult, Matrices.model, LAYER_BAND_FRONT);
+
+	//Displaying power board and power, rebuilt only when the power changes
+	if(beginWidget(WIDGET_BOARD, 0))
+		appendFlatMesh(Widgets.widgets[WIDGET_BOARD].vertices, powerboard, glm::mat4(1.0f));
+	if(beginWidget(WIDGET_POWER, power)){
+		Matrices.model = glm::mat4(1.0f);
+		glm::mat4 scalePower = glm::scale(glm::vec3(power*6,1,1));
+		glm::mat4 translatePower = glm::translate(glm::vec3(-400 - ( 90 - power * 3), -240, 0));
+		Matrices.model *= ( translatePower * scalePower);
+		appendFlatMesh(Widgets.widgets[WIDGET_POWER].vertices, powerelement, Matrices.model);
+	}
+
+
+	// Increment angles
+	float increments = 1;
+	physics = profileBegin();
+
+	if(pressed_state==3){
+		prevx=initx,prevy=inity;
+		initx=initx+speedx,inity=inity+speedy,speedy+=gravity;
+		inity=min(200-cannonball_size,inity);
+		if(inity==200-cannonball_size)
+			speedy=-0.8*speedy,speedx=0.7*speedx;
+		if(fabs(speedx)<=0.05&&fabs(speedy)<=0.05){
+				pressed_state=0;
+				gravity = 0.2;
+				power = 0;
+			
+		}
+	}
+	profileEnd(physics, "physics: bird");
+
+	//Rendering score
+	
+	// Render font on screen
+	static int fontScale = 1;
+	// Glyphs are in ems, FTGL's glyphs used to come out at half their size
+	float fontScaleValue = 25 + 0.125*sinf(fontScale*M_PI/180.0f);
+	glm::vec3 fontColor = glm::vec3(228.0f/255.0f,142.0f/255.0f,57.0f/255.0f);//getRGBfromHue (fontScale);
+				
+
+
+
+	// Text is drawn with the font Shaders
+	Matrices.view = glm::lookAt(glm::vec3(0,0,3), glm::vec3(0,0,0), glm::vec3(0,1,0)); // Fixed camera for 2D (ortho) in XY plane
+
+	// Transform the text
+	Matrices.model = glm::mat4(1.0f);
+	glm::mat4 translateText = glm::translate(glm::vec3(400,-250,0));
+	glm::mat4 scaleText = glm::scale(glm::vec3(fontScaleValue,fontScaleValue,fontScaleValue));
+	glm::mat4 rotateText = glm::rotate((float)M_PI, glm::vec3(1,0,0));
+	Matrices.model *= (translateText * scaleText * rotateText);
+	
+	score = cnt * 100;
+	// Render font, only when the score changed
+	if(beginWidget(WIDGET_SCORE, score)){
+		char str[32];
+		snprintf(str, sizeof(str), "SCORE: %d", score);
+		appendText(Widgets.widgets[WIDGET_SCORE].vertices, str, fontColor, Matrices.model);
+	}
+	recordWidgets(list);
+	for(int i=0;i<6;i++){
+		if(scoretimer[i][3]>0){
+			Matrices.model = glm::mat4(1.0f);
+			//cout<<scoretimer[i][0]<<" "<<scoretimer[i][1]<<endl;
+			glm::mat4 translateText = glm::translate(glm::vec3(400,0,0));
+			Matrices.model *=  ( translateText *scaleText * rotateText);
+	//		recordText(list, "100", fontColor, Matrices.model, LAYER_WIDGETS);
+		}
+	}
+
+	recordPerfHud(list);
+	finishStep(list);
+	list.cpuSeconds = monotonicTime() - start;
 }
-// Creates the rectangle object used in this sample code
-void createCannonball ()
+
+/* Single threaded frame: simulate, then sort the recorded commands by state and send them to GL */
+void draw ()
 {
-	// GL3 accepts only Triangles. Quads are not supported
-	double n=20;
-	static GLfloat vertex_buffer_data[9*20 + 2*3 + 2*9*20 + 9*20];
-	static GLfloat color_buffer_data [9*20 + 2*3 + 2*9*20 +9*20];
-	float angle=0;
-	for(int i=0;i<n;i++){
-		vertex_buffer_data[9*i] = vertex_buffer_data[9*i+1] = vertex_buffer_data[9*i+2] = 0;
-		vertex_buffer_data[9*i+3]=cannonball_size*cos(angle*M_PI/180.0f);
-		vertex_buffer_data[9*i+4]=cannonball_size*sin(angle*M_PI/180.0f);
-		vertex_buffer_data[9*i+5]=0;
-		angle += 360.0f/n;
-		vertex_buffer_data[9*i+6]=cannonball_size*cos(angle*M_PI/180.0f);
-		vertex_buffer_data[9*i+7]=cannonball_size*sin(angle*M_PI/180.0f);
-		vertex_buffer_data[9*i+8]=0;
-
-		color_buffer_data[9*i] = 214.0f/255.0f;
-		color_buffer_data[9*i+1] = 1.0f/255.0f;
-		color_buffer_data[9*i+2] = 14.0f/255.0f;
-		color_buffer_data[9*i+3] = 214.0f/255.0f;
-		color_buffer_data[9*i+4] = 1.0f/255.0f;
-		color_buffer_data[9*i+5] = 14.0f/255.0f;
-		color_buffer_data[9*i+6] = 214.0f/255.0f;
-		color_buffer_data[9*i+7] = 1.0f/255.0f;
-		color_buffer_data[9*i+8] = 14.0f/255.0f;
-	}
-	angle= 0;
-	for(int i=n;i<n+n;i++){
-		vertex_buffer_data[9*i] =5; vertex_buffer_data[9*i+1] =-2; vertex_buffer_data[9*i+2] = 0;
-		vertex_buffer_data[9*i+3]=5+cannonball_size*0.25*cos(angle*M_PI/180.0f);
-		vertex_buffer_data[9*i+4]=-2+cannonball_size*0.5*sin(angle*M_PI/180.0f);
-		vertex_buffer_data[9*i+5]=0;
-		angle += 360.0f/(n);
-		vertex_buffer_data[9*i+6]=5+cannonball_size*0.25*cos(angle*M_PI/180.0f);
-		vertex_buffer_data[9*i+7]=-2+cannonball_size*0.5*sin(angle*M_PI/180.0f);
-		vertex_buffer_data[9*i+8]=0;
-
-		color_buffer_data[9*i] = 1;
-		color_buffer_data[9*i+1] = 1;
-		color_buffer_data[9*i+2] = 1;
-		color_buffer_data[9*i+3] = 1;
-		color_buffer_data[9*i+4] = 1;
-		color_buffer_data[9*i+5] = 1;
-		color_buffer_data[9*i+6] = 1;
-		color_buffer_data[9*i+7] = 1;
-		color_buffer_data[9*i+8] = 1;
-	}
-	angle =0 ;
-	for(int i=2*n;i<2*n+n;i++){
-		vertex_buffer_data[9*i] = 5;vertex_buffer_data[9*i+1] =0; vertex_buffer_data[9*i+2] = 0;
-		vertex_buffer_data[9*i+3]=5+0.15*cannonball_size*cos(angle*M_PI/180.0f);
-		vertex_buffer_data[9*i+4]=0.15*cannonball_size*sin(angle*M_PI/180.0f);
-		vertex_buffer_data[9*i+5]=0;
-		angle += 360.0f/n;
-		vertex_buffer_data[9*i+6]=5+0.15*cannonball_size*cos(angle*M_PI/180.0f);
-		vertex_buffer_data[9*i+7]=0.15*cannonball_size*sin(angle*M_PI/180.0f);
-		vertex_buffer_data[9*i+8]=0;
-
-		color_buffer_data[9*i] = 0;
-		color_buffer_data[9*i+1] = 0;
-		color_buffer_data[9*i+2] = 0;
-		color_buffer_data[9*i+3] = 0;
-		color_buffer_data[9*i+4] = 0;
-		color_buffer_data[9*i+5] = 0;
-		color_buffer_data[9*i+6] = 0;
-		color_buffer_data[9*i+7] = 0;
-		color_buffer_data[9*i+8] = 0;
-	}
-
-	for(int i=9*3*n;i<9*(3*n+2);i+=3){
-		color_buffer_data[i] =252.0f/255.0f;
-		color_buffer_data[i+1] = 187.0f/255.0f;
-		color_buffer_data[i+2] = 35.0f/255.0f;
-	}
-
-	vertex_buffer_data[9*20*3] = cannonball_size*cos((360.0f/n) *M_PI/180.0f);
-	vertex_buffer_data[9*20*3+1] = cannonball_size*sin((360.0f/n) *M_PI/180.0f);
-	vertex_buffer_data[9*20*3+2] = 0;
-	vertex_buffer_data[9*20*3+3] = cannonball_size+10;
-	vertex_buffer_data[9*20*3+4] = -2;
-	vertex_buffer_data[9*20*3+5] = 0;
-	vertex_buffer_data[9*20*3+6] = cannonball_size*cos((360.0f/n) *M_PI/180.0f);
-	vertex_buffer_data[9*20*3+7] = -cannonball_size*sin((360.0f/n) *M_PI/180.0f);
-	vertex_buffer_data[9*20*3+8] = 0;
-	// create3DObject creates and returns a handle to a VAO that can be used later
-	cannonball = create3DObject(GL_TRIANGLES, 3*n*3 + 2*3, GAME_BIRD, vertex_buffer_data, color_buffer_data,  0, 0, cannonball_size, GL_FILL);
+	PROFILE_SCOPE("draw");
+	if(!Interpolate.fixedTick){
+		simulateFrame(frameList);
+		submitRenderList(frameList);
+		return;
+	}
+
+	// --fixed-tick: as many steps as the time since the last frame holds, then draw between the last two
+	double now = gameTime();
+	Interpolate.accumulator += Interpolate.lastFrame > 0 ? min(now - Interpolate.lastFrame, 0.25) : SIM_TICK;
+	Interpolate.lastFrame = now;
+	while(Interpolate.accumulator >= SIM_TICK){
+		simulateFrame(frameList);
+		Interpolate.accumulator -= SIM_TICK;
+	}
+	interpolateBodies(frameList, Interpolate.accumulator/SIM_TICK);
+	submitRenderList(frameList);
 }
 
-void createGameFloor ()
+/****************
+ * Frame pacing *
+ ****************/
+
+/* --pacing picks how presentFrame waits between frames:
+   vsync     swap interval 1, the default
+   adaptive  swap interval -1 where the driver offers swap_control_tear: vsync,
+             but a late frame is shown at once instead of waiting a whole refresh
+   uncapped  swap interval 0, as fast as possible, for benchmarks
+   cap       swap interval 0 and a limiter at --fps-cap N (default 60). It sleeps
+             until PACING_SPIN before the deadline and spins the rest, since
+             usleep alone overshoots by up to a scheduler tick */
+#define PACING_SPIN 0.002
+
+enum PacingMode {
+	PACING_VSYNC = 0,
+	PACING_ADAPTIVE,
+	PACING_UNCAPPED,
+	PACING_CAP
+};
+
+const char* pacingNames[] = {"vsync", "adaptive", "uncapped", "cap"};
+
+struct FramePacing {
+	int mode;
+	double cap;         // Frames per second with PACING_CAP
+	double deadline;    // monotonicTime() the next capped frame is due
+	double lastPresent;
+	double lastInterval;
+	double jitterSum, jitterMax; // |interval - previous interval|
+	double intervalSum;
+	int intervals;
+} Pacing = {PACING_VSYNC, 60};
+
+/* Swap interval for the current mode, needs the window's context current */
+int pacingSwapInterval ()
 {
-	static GLfloat vertex_buffer_data [20*18];
+	if(Pacing.mode == PACING_VSYNC)
+		return 1;
+	if(Pacing.mode != PACING_ADAPTIVE)
+		return 0;
+	if(glfwExtensionSupported("GLX_EXT_swap_control_tear") || glfwExtensionSupported("WGL_EXT_swap_control_tear"))
+		return -1;
+	static int warned = 0;
+	if(!warned++)
+		printf("Adaptive vsync is not supported here, using vsync\n");
+	return 1;
+}
 
-	double base=200;
-	for(int i=0;i<20;i++){
-		vertex_buffer_data[18*i]=-600,vertex_buffer_data[18*i+1]=base,vertex_buffer_data[18*i+2]=0;
-		vertex_buffer_data[18*i+3]=-600,vertex_buffer_data[18*i+4]=base+10,vertex_buffer_data[18*i+5]=0;
-		vertex_buffer_data[18*i+6]=600,vertex_buffer_data[18*i+7]=base,vertex_buffer_data[18*i+8]=0;
-		vertex_buffer_data[18*i+9]=600,vertex_buffer_data[18*i+10]=base+10,vertex_buffer_data[18*i+11]=0;
-		vertex_buffer_data[18*i+12]=-600,vertex_buffer_data[18*i+13]=base+10,vertex_buffer_data[18*i+14]=0;
-		vertex_buffer_data[18*i+15]=600,vertex_buffer_data[18*i+16]=base,vertex_buffer_data[18*i+17]=0;
-		base+=5;
+/* Called by presentFrame right before the swap */
+void paceFrame ()
+{
+	if(Pacing.mode != PACING_CAP || Pacing.cap <= 0)
+		return;
+	double now = monotonicTime();
+	Pacing.deadline = Pacing.deadline == 0 ? now : Pacing.deadline + 1.0/Pacing.cap;
+	if(Pacing.deadline < now - 0.1){
+		// Far behind, start over rather than rush out the missed frames
+		Pacing.deadline = now;
+		return;
 	}
+	double wait = Pacing.deadline - now;
+	if(wait > PACING_SPIN)
+		usleep((useconds_t)((wait - PACING_SPIN)*1e6));
+	while(monotonicTime() < Pacing.deadline)
+		;
+}
 
-	static  GLfloat color_buffer_data [20*18]; 
-	double gred=133.0/255.0f,ggreen=183.0/255.0f,gblue=52.0/255.0f;
-	for(int i=0;i<20;i++){
-		color_buffer_data[18*i]=gred,color_buffer_data[18*i+1]=ggreen,color_buffer_data[18*i+2]=gblue;
-		color_buffer_data[18*i+3]=gred,color_buffer_data[18*i+4]=ggreen,color_buffer_data[18*i+5]=gblue;
-		color_buffer_data[18*i+6]=gred,color_buffer_data[18*i+7]=ggreen,color_buffer_data[18*i+8]=gblue;
-		color_buffer_data[18*i+9]=gred,color_buffer_data[18*i+10]=ggreen,color_buffer_data[18*i+11]=gblue;
-		color_buffer_data[18*i+12]=gred,color_buffer_data[18*i+13]=ggreen,color_buffer_data[18*i+14]=gblue;
-		color_buffer_data[18*i+15]=gred,color_buffer_data[18*i+16]=ggreen,color_buffer_data[18*i+17]=gblue;
-		ggreen+=10.0f/255.0f;
-		gred+=2.5f/255.0f;
+/* Called by presentFrame right after the swap */
+void measureFramePacing ()
+{
+	double now = monotonicTime();
+	if(Pacing.lastPresent > 0){
+		double interval = now - Pacing.lastPresent;
+		if(Pacing.lastInterval > 0){
+			double jitter = fabs(interval - Pacing.lastInterval);
+			Pacing.jitterSum += jitter;
+			Pacing.jitterMax = max(Pacing.jitterMax, jitter);
+			Pacing.intervalSum += interval;
+			Pacing.intervals++;
+		}
+		Pacing.lastInterval = interval;
 	}
-	gameFloor = create3DObject(GL_TRIANGLES, 20*6, GAME_WOOD_HORIZONTAL, vertex_buffer_data, color_buffer_data, GL_FILL, fireposx, fireposy, 25);
+	Pacing.lastPresent = now;
 }
 
-GLfloat woodsizex[6],woodsizey[6];
-void createWoodLogs(){
+void reportFramePacing (const char* mode)
+{
+	if(Pacing.intervals == 0)
+		return;
+	printf("%s: %s pacing, %.2f ms between frames, jitter %.3f ms average, %.3f ms worst\n", mode, pacingNames[Pacing.mode],
+			1000.0*Pacing.intervalSum/Pacing.intervals, 1000.0*Pacing.jitterSum/Pacing.intervals, 1000.0*Pacing.jitterMax);
+	Pacing.jitterSum = Pacing.jitterMax = Pacing.intervalSum = 0;
+	Pacing.intervals = 0;
+}
 
+/*******************
+ * Display backend *
+ *******************/
+
+/* With --headless there is no window: a surfaceless EGL context renders into
+   an FBO, so the game runs on machines without a display or a GPU (Mesa llvmpipe) */
+struct HeadlessDisplay {
+	int enabled;
+	int width, height;
+	EGLDisplay display;
+	EGLContext context;
+	GLuint framebuffer;
+	GLuint colorBuffer;
+	GLuint depthBuffer;
+	double startTime;
+} Headless;
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+double monotonicTime ()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec*1e-9;
+}
 
-	static GLfloat vertex_buffer_data[6][18];
-	woodsizex[0] = 10;
-	woodsizey[0] = 30;
-	woodsizex[1] = 35;
-	woodsizey[1] = 20;
-	woodsizex[2] = 75;
-	woodsizey[2] = 25;
-	woodsizex[3] = 10;
-	woodsizey[3] = 100;
-	woodsizex[4] = 50;
-	woodsizey[4] = 10;
-	woodsizex[5] = 50;
-	woodsizey[5] = 10;
+/* Seconds since start, glfwGetTime() needs glfwInit which needs a display */
+double gameTime ()
+{
+	if(!Headless.enabled && !softwareRendering)
+		return glfwGetTime();
+	return monotonicTime() - Headless.startTime;
+}
 
-	for(int i=0;i<=5;i++){
-		vertex_buffer_data[i][0] = vertex_buffer_data[i][3] = vertex_buffer_data[i][12] = -woodsizex[i];
-		vertex_buffer_data[i][6] = vertex_buffer_data[i][9] = vertex_buffer_data[i][15] = woodsizex[i];
-		vertex_buffer_data[i][1] = vertex_buffer_data[i][7] = vertex_buffer_data[i][10] = woodsizey[i];
-		vertex_buffer_data[i][4] = vertex_buffer_data[i][13] = vertex_buffer_data[i][16] = -woodsizey[i];
+/* Create a GL 3.3 core context without any surface and a width x height FBO to draw into */
+int initHeadless (int width, int height)
+{
+	Headless.startTime = monotonicTime();
+
+	// Mesa's surfaceless platform needs neither X11 nor a GPU
+	EGLDisplay display = EGL_NO_DISPLAY;
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if(getPlatformDisplay)
+		display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	if(display == EGL_NO_DISPLAY)
+		display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+	EGLint major, minor;
+	if(display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)){
+		cout << "Headless: could not initialise an EGL display" << endl;
+		return 0;
 	}
-	static const GLfloat color_buffer_data [] = {
-		228.0f/255.0f,142.0f/255.0f,57.0f/255.0f,
-		228.0f/255.0f,142.0f/255.0f,57.0f/255.0f,
-		228.0f/255.0f,142.0f/255.0f,57.0f/255.0f,
-		228.0f/255.0f,142.0f/255.0f,57.0f/255.0f,
-		228.0f/255.0f,142.0f/255.0f,57.0f/255.0f,
-		228.0f/255.0f,142.0f/255.0f,57.0f/255.0f
+	const char* extensions = eglQueryString(display, EGL_EXTENSIONS);
+	if(!extensions || !strstr(extensions, "EGL_KHR_surfaceless_context")){
+		cout << "Headless: EGL_KHR_surfaceless_context is not supported" << endl;
+		eglTerminate(display);
+		return 0;
+	}
+
+	static const EGLint configAttribs[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_NONE
 	};
-	static const GLfloat color_buffer_data3 [] = {
-		212.0f/255.0f,121.0f/255.0f,52.0f/255.0f,
-		212.0f/255.0f,121.0f/255.0f,52.0f/255.0f,
-		212.0f/255.0f,121.0f/255.0f,52.0f/255.0f,
-		212.0f/255.0f,121.0f/255.0f,52.0f/255.0f,
-		212.0f/255.0f,121.0f/255.0f,52.0f/255.0f,
-		212.0f/255.0f,121.0f/255.0f,52.0f/255.0f
+	static const EGLint contextAttribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION_KHR, 3,
+		EGL_CONTEXT_MINOR_VERSION_KHR, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+		EGL_NONE
 	};
-	woodlogs[0] = create3DObject(GL_TRIANGLES, 6, GAME_WOOD_VERTICAL, vertex_buffer_data[0], color_buffer_data, GL_FILL, 0, 0, 25);
-	woodlogs[1] = create3DObject(GL_TRIANGLES, 6, GAME_WOOD_HORIZONTAL, vertex_buffer_data[1], color_buffer_data, 280, 130, 25, GL_FILL);
-	woodlogs[2] = create3DObject(GL_TRIANGLES, 6, GAME_WOOD_HORIZONTAL, vertex_buffer_data[2], color_buffer_data3, 310, 175, 25, GL_FILL);
-	woodlogs[3] = create3DObject(GL_TRIANGLES, 6, GAME_WOOD_VERTICAL, vertex_buffer_data[3], color_buffer_data3, 150, -200, 25, GL_FILL);
-	woodlogs[4] = create3DObject(GL_TRIANGLES, 6, GAME_WOOD_VERTICAL, vertex_buffer_data[4], color_buffer_data3, 90, -110, 25, GL_FILL);
-	woodlogs[5] = create3DObject(GL_TRIANGLES, 6, GAME_WOOD_VERTICAL, vertex_buffer_data[4], color_buffer_data3, 90, -210, 25, GL_FILL);
+	EGLConfig config;
+	EGLint configs = 0;
+	if(!eglBindAPI(EGL_OPENGL_API) || !eglChooseConfig(display, configAttribs, &config, 1, &configs) || configs < 1){
+		cout << "Headless: no EGL config for desktop OpenGL" << endl;
+		eglTerminate(display);
+		return 0;
+	}
+	EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
+	if(context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)){
+		cout << "Headless: could not create an OpenGL 3.3 core context" << endl;
+		eglTerminate(display);
+		return 0;
+	}
+	gladLoadGLLoader((GLADloadproc) eglGetProcAddress);
+
+	// Stands in for the window's back buffer, depth and stencil included
+	glGenFramebuffers(1, &Headless.framebuffer);
+	glGenRenderbuffers(1, &Headless.colorBuffer);
+	glGenRenderbuffers(1, &Headless.depthBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, Headless.colorBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, Headless.depthBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, Headless.framebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, Headless.colorBuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, Headless.depthBuffer);
+	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE){
+		cout << "Headless: framebuffer incomplete" << endl;
+		return 0;
+	}
+	screenFramebuffer = Headless.framebuffer;
+
+	Headless.enabled = 1;
+	Headless.width = width;
+	Headless.height = height;
+	Headless.display = display;
+	Headless.context = context;
+	cout << "Headless: " << width << "x" << height << " offscreen, EGL " << major << "." << minor << endl;
+	return 1;
+}
+
+/* Bind the GL context to the calling thread, window is NULL when headless */
+void makeContextCurrent (GLFWwindow* window)
+{
+	if(softwareRendering)
+		return;
+	if(Headless.enabled){
+		eglMakeCurrent(Headless.display, EGL_NO_SURFACE, EGL_NO_SURFACE, Headless.context);
+		return;
+	}
+	glfwMakeContextCurrent(window);
+	glfwSwapInterval( pacingSwapInterval() );
+}
+
+void releaseContext (GLFWwindow* window)
+{
+	if(softwareRendering)
+		return;
+	if(Headless.enabled)
+		eglMakeCurrent(Headless.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	else
+		glfwMakeContextCurrent(NULL);
+}
+
+/* End of a frame: swap the window, or wait for the offscreen frame to be finished.
+   A software frame is finished when renderSoftware returns */
+void presentFrame (GLFWwindow* window)
+{
+	PROFILE_SCOPE("swap");
+	paceFrame();
+	if(Headless.enabled)
+		glFinish();
+	else if(window)
+		glfwSwapBuffers(window);
+	measureFramePacing();
+}
+
+/* Input callbacks run from in here, there is none headless */
+void pollEvents (GLFWwindow* window)
+{
+	if(!window)
+		return;
+	PROFILE_SCOPE("poll events");
+	glfwPollEvents();
+}
 
+void closeDisplay (GLFWwindow* window)
+{
+	if(softwareRendering){
+		stopSoftwareRenderer();
+		return;
+	}
+	if(!Headless.enabled){
+		if(window)
+			glfwDestroyWindow(window);
+		glfwTerminate();
+		return;
+	}
+	eglMakeCurrent(Headless.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	eglDestroyContext(Headless.display, Headless.context);
+	eglTerminate(Headless.display);
+	Headless.enabled = 0;
 }
 
-void createBackground(GLuint textureID){
-	static const GLfloat vertex_buffer_data[] = {
-		-600, -300, 0,
-		-600, 300, 0,
-		600, -300, 0,
+/***********************
+ * Software rasterizer *
+ ***********************/
+
+/* --software draws the render list on the CPU with no GL context at all, so
+   thumbnails, goldens and recordings come out the same on any machine, with
+   or without Mesa. Commands become triangles in drawing order, binned into
+   tiles of SOFTWARE_TILE pixels. One thread draws a tile from start to end,
+   so threads never share a pixel and the image does not depend on how many
+   there are. Coverage is tested four pixels at a time against integer edge
+   functions, and the shading follows the scene.frag variants */
+#define SOFTWARE_TILE 64
+#define SOFTWARE_SUBPIXEL 16        // Vertices are snapped to 1/16 pixel
+#define SOFTWARE_GUARD_BAND 8192.0f // Pixels off screen vertices are clamped to, keeps edge values in 32 bits per tile
+#define SOFTWARE_ATTRIBUTES 5
+#define SOFTWARE_MAX_LEVELS 16
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Which scene.frag variant a triangle is shaded like, and its attributes */
+enum SoftwareShader {
+	SHADE_FLAT = 0,  // r, g, b
+	SHADE_TEXTURED,  // u, v
+	SHADE_FONT,      // u, v, r, g, b
+	SHADE_ELLIPSE,   // position in the unit circle, r, g, b
+	SHADE_GROUND     // height in the floor mesh
+};
 
-		-600, 300, 0,
-		600, -300, 0,
-		600, 300, 0
-	};
+const int softwareAttributeCount[] = {3, 2, 5, 5, 1};
 
-	static const GLfloat texture_buffer_data[] = {
-		0,0,
-		0,1,
-		1,0,
+/* Mip levels one after the other, level 0 first */
+struct SoftwareTexture {
+	int width, height;
+	int levels;
+	int channels;
+	const unsigned char* data;
+	size_t offsets[SOFTWARE_MAX_LEVELS];
+	vector<unsigned char> storage; // data, unless it points at pixels kept elsewhere
+};
 
-		0,1,
-		1,0,
-		1,1
-	};
+/* A triangle set up for the tiles. Edge k is A*x + B*y + C at a point in
+   subpixel units, 0 or more inside. An attribute at the centre of pixel
+   (x, y) is attr + dadx*x + dady*y */
+struct SoftwareTriangle {
+	long long A[3], B[3], C[3];
+	int x0, y0, x1, y1; // Pixels it may cover, x1 and y1 excluded
+	float attr[SOFTWARE_ATTRIBUTES];
+	float dadx[SOFTWARE_ATTRIBUTES], dady[SOFTWARE_ATTRIBUTES];
+	int shader;
+	const SoftwareTexture* texture;
+	int level;          // Mip level SHADE_TEXTURED samples
+	int constant;       // SHADE_FLAT in one colour, every pixel gets color
+	unsigned char color[4];
+};
 
-	background = create3DTexturedObject(GL_TRIANGLES, 6, vertex_buffer_data, texture_buffer_data, textureID, GL_FILL);
+struct SoftwareRasterizer {
+	int threads;        // --software-threads, 0 for one per core
+	int width, height;
+	int tilesX, tilesY;
+	vector<unsigned char> pixels; // RGBA, top row first like captured frames
+	SoftwareTexture atlas, glyphs;
+	vector<SoftwareTriangle> triangles;
+	vector< vector<int> > bins;   // Triangles touching each tile, in drawing order
+	vector<GLfloat> widgets;      // This frame's copy of the retained widget vertices
+	vector<GLfloat> hudText;      // And of the HUD text
+	vector<std::thread> workers;
+	std::mutex lock;
+	std::condition_variable wake, finished;
+	long frame;                   // Bumped to hand the workers a frame
+	int busy;                     // Workers still drawing it
+	int running;
+	std::atomic<int> nextTile;
+	double setupSeconds, rasterSeconds; // Since the last report
+	long triangleCount;
+	int frames;
+} Software;
+
+void setSoftwareTexture (SoftwareTexture* texture, const unsigned char* data, int width, int height, int levels, int channels)
+{
+	texture->data = data;
+	texture->width = width;
+	texture->height = height;
+	texture->levels = min(levels, SOFTWARE_MAX_LEVELS);
+	texture->channels = channels;
+	size_t offset = 0;
+	for(int level=0;level<texture->levels;level++){
+		texture->offsets[level] = offset;
+		offset += (size_t)max(1, width >> level) * max(1, height >> level) * channels;
+	}
 }
 
-void createCatapult(){
-	static const GLfloat vertex_buffer_data[] = {
-		-0.5, -4, 0,
-		-0.5, 4, 0,
-		0.5, -4, 0,
+/* Copy the atlas before finishSpriteAtlas releases it, with the mip levels
+   glGenerateMipmap would have made when the texture cache is off */
+void keepSoftwareAtlas (const TexturePixels* pixels)
+{
+	SoftwareTexture& atlas = Software.atlas;
+	size_t size = 0;
+	for(int level=0;level<pixels->levels;level++)
+		size += mipLevelSize(pixels->width, pixels->height, level);
+	atlas.storage.assign(pixels->data, pixels->data + size);
+	int levels = pixels->levels;
+	if(pixels->generate){
+		buildMipLevels(atlas.storage, pixels->width, pixels->height, pixels->generate);
+		levels = pixels->generate;
+	}
+	setSoftwareTexture(&atlas, &atlas.storage[0], pixels->width, pixels->height, levels, 4);
+}
 
-		-0.5, 4, 0,
-		0.5, -4, 0,
-		0.5, 4, 0
-	};
+/* The glyph field stays in Glyphs.pixels */
+void keepSoftwareGlyphs ()
+{
+	setSoftwareTexture(&Software.glyphs, &Glyphs.pixels[0], Glyphs.width, Glyphs.height, 1, 1);
+}
 
-	static const GLfloat color_buffer_data[] = {
-		86.0f/255.0f,38.0f/255.0f,15.0f/255.0f,
-		86.0f/255.0f,38.0f/255.0f,15.0f/255.0f,
-		86.0f/255.0f,38.0f/255.0f,15.0f/255.0f,
-		86.0f/255.0f,38.0f/255.0f,15.0f/255.0f,
-		86.0f/255.0f,38.0f/255.0f,15.0f/255.0f,
-		86.0f/255.0f,38.0f/255.0f,15.0f/255.0f
-	};
-	catapult = create3DObject(GL_TRIANGLES, 2*3 ,GAME_WOOD_HORIZONTAL, vertex_buffer_data, color_buffer_data, 50, 200, 0, GL_FILL);
+/* GL_NEAREST, clamped to the edge. Truncating instead of flooring only
+   differs between -1 and 0, which the clamp turns into 0 either way */
+inline const unsigned char* softwareTexel (const SoftwareTexture* texture, int level, float u, float v)
+{
+	int width = max(1, texture->width >> level), height = max(1, texture->height >> level);
+	int x = min(max((int)(u*width), 0), width - 1);
+	int y = min(max((int)(v*height), 0), height - 1);
+	return texture->data + texture->offsets[level] + ((size_t)y*width + x)*texture->channels;
 }
-float camera_rotation_angle = 90;
-float rectangle_rotation = 0;
-int lineorfill=GL_FILL;
-/* Render the scene with openGL */
-/* Edit this function according to your assignment */
 
-VAO *temp ;
-void createtemp(){
-	static const GLfloat vertex_buffer_data [] = {
-		0, 0, 0,
-		0, -100, 0,
-		100, 0, 0
-	};
-	 static const GLfloat color_buffer_data [] ={
-		 1,0,0,1,0,0,1,0,0};
-	temp = create3DObject(GL_TRIANGLES, 3 ,GAME_WOOD_HORIZONTAL, vertex_buffer_data, color_buffer_data, 50, 200, 0, GL_FILL);
+/* GL_LINEAR from level 0 of a one channel texture, clamped to the edge, 0 to 1 */
+float softwareSampleLinear (const SoftwareTexture* texture, float u, float v)
+{
+	float x = u*texture->width - 0.5f, y = v*texture->height - 0.5f;
+	int x0 = (int)floorf(x), y0 = (int)floorf(y);
+	float fx = x - x0, fy = y - y0;
+	int xa = min(max(x0, 0), texture->width - 1), xb = min(max(x0 + 1, 0), texture->width - 1);
+	int ya = min(max(y0, 0), texture->height - 1), yb = min(max(y0 + 1, 0), texture->height - 1);
+	const unsigned char* top = texture->data + (size_t)ya*texture->width;
+	const unsigned char* bottom = texture->data + (size_t)yb*texture->width;
+	float upper = top[xa] + (top[xb] - top[xa])*fx;
+	float lower = bottom[xa] + (bottom[xb] - bottom[xa])*fx;
+	return (upper + (lower - upper)*fy) / 255.0f;
 }
 
-void draw ()
+int softwareShaderOf (GLuint program)
 {
-	// clear the color and depth in the frame buffer
-	glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	if(program == textureProgramID)
+		return SHADE_TEXTURED;
+	if(program == fontProgramID)
+		return SHADE_FONT;
+	if(program == ellipseProgramID)
+		return SHADE_ELLIPSE;
+	if(program == groundProgramID)
+		return SHADE_GROUND;
+	return SHADE_FLAT;
+}
 
+/* Level GL_NEAREST_MIPMAP_NEAREST picks from the texels covered per pixel,
+   constant over a triangle as the projection is orthographic */
+int softwareMipLevel (const SoftwareTriangle& t)
+{
+	const SoftwareTexture* texture = t.texture;
+	float ux = t.dadx[0]*texture->width, vx = t.dadx[1]*texture->height;
+	float uy = t.dady[0]*texture->width, vy = t.dady[1]*texture->height;
+	float rho = max(sqrtf(ux*ux + vx*vx), sqrtf(uy*uy + vy*vy));
+	float lambda = rho > 0 ? log2f(rho) : 0;
+	if(lambda <= 0.5f)
+		return 0;
+	return min((int)ceilf(lambda + 0.5f) - 1, texture->levels - 1);
+}
 
-	// use the loaded shader program
-	// Don't change unless you know what you are doing
-	glUseProgram (programID);
+inline void writeSoftwareColor (unsigned char* dst, float r, float g, float b)
+{
+	dst[0] = (unsigned char)(min(max(r, 0.0f), 1.0f)*255 + 0.5f);
+	dst[1] = (unsigned char)(min(max(g, 0.0f), 1.0f)*255 + 0.5f);
+	dst[2] = (unsigned char)(min(max(b, 0.0f), 1.0f)*255 + 0.5f);
+	dst[3] = 255;
+}
 
-	// Eye - Location of camera. Don't change unless you are sure!!
-	glm::vec3 eye ( 5*cos(camera_rotation_angle*M_PI/180.0f), 0, 5*sin(camera_rotation_angle*M_PI/180.0f) );
-	// Target - Where is the camera looking at.  Don't change unless you are sure!!
-	glm::vec3 target (0, 0, 0);
-	// Up - Up vector defines tilt of camera.  Don't change unless you are sure!!
-	glm::vec3 up (0, 1, 0);
+/* Set up a triangle from window positions in pixels and bin it */
+void addSoftwareTriangle (glm::vec2 position[3], float attributes[3][SOFTWARE_ATTRIBUTES], int shader, const SoftwareTexture* texture)
+{
+	long long x[3], y[3];
+	for(int i=0;i<3;i++){
+		x[i] = (long long)floorf(min(max(position[i].x, -SOFTWARE_GUARD_BAND), SOFTWARE_GUARD_BAND)*SOFTWARE_SUBPIXEL + 0.5f);
+		y[i] = (long long)floorf(min(max(position[i].y, -SOFTWARE_GUARD_BAND), SOFTWARE_GUARD_BAND)*SOFTWARE_SUBPIXEL + 0.5f);
+	}
+	long long area = (x[1] - x[0])*(y[2] - y[0]) - (y[1] - y[0])*(x[2] - x[0]);
+	if(area == 0)
+		return;
+	// Either winding is drawn, the edges want the positive one
+	int order[3] = {0, 1, 2};
+	if(area < 0){
+		order[1] = 2;
+		order[2] = 1;
+	}
 
-	// Compute Camera matrix (view)
-	//Matrices.view = glm::lookAt( eye, target, up ); // Rotating Camera for 3D
-	//  Don't change unless you are sure!!
-	Matrices.view = glm::lookAt(glm::vec3(0,0,3), glm::vec3(0,0,0), glm::vec3(0,1,0)); // Fixed camera for 2D (ortho) in XY plane
+	SoftwareTriangle t;
+	long long minX = x[0], maxX = x[0], minY = y[0], maxY = y[0];
+	for(int i=1;i<3;i++){
+		minX = min(minX, x[i]);
+		maxX = max(maxX, x[i]);
+		minY = min(minY, y[i]);
+		maxY = max(maxY, y[i]);
+	}
+	// Pixels whose centre is inside the bounds
+	t.x0 = max(0, (int)ceil((double)minX/SOFTWARE_SUBPIXEL - 0.5));
+	t.y0 = max(0, (int)ceil((double)minY/SOFTWARE_SUBPIXEL - 0.5));
+	t.x1 = min(Software.width, (int)floor((double)maxX/SOFTWARE_SUBPIXEL - 0.5) + 1);
+	t.y1 = min(Software.height, (int)floor((double)maxY/SOFTWARE_SUBPIXEL - 0.5) + 1);
+	if(t.x0 >= t.x1 || t.y0 >= t.y1)
+		return;
+
+	for(int k=0;k<3;k++){
+		int a = order[k], b = order[(k+1)%3];
+		long long dx = x[b] - x[a], dy = y[b] - y[a];
+		t.A[k] = -dy;
+		t.B[k] = dx;
+		t.C[k] = dy*x[a] - dx*y[a];
+		// A pixel centre on an edge belongs to one of the two triangles sharing it:
+		// the one that runs the edge this way round
+		if(!(dy > 0 || (dy == 0 && dx < 0)))
+			t.C[k] -= 1;
+	}
 
-	// Compute ViewProject matrix as view/camera might not be changed for this frame (basic scenario)
-	//  Don't change unless you are sure!!
-	glm::mat4 VP = Matrices.projection * Matrices.view;
+	// Attributes as planes over the snapped positions, in pixels
+	double px[3], py[3];
+	for(int i=0;i<3;i++){
+		px[i] = (double)x[i]/SOFTWARE_SUBPIXEL;
+		py[i] = (double)y[i]/SOFTWARE_SUBPIXEL;
+	}
+	double x1 = px[1] - px[0], y1 = py[1] - py[0], x2 = px[2] - px[0], y2 = py[2] - py[0];
+	double det = x1*y2 - x2*y1;
+	for(int k=0;k<SOFTWARE_ATTRIBUTES;k++){
+		double a0 = attributes[0][k], a1 = attributes[1][k] - a0, a2 = attributes[2][k] - a0;
+		double dadx = (a1*y2 - a2*y1) / det;
+		double dady = (a2*x1 - a1*x2) / det;
+		t.dadx[k] = dadx;
+		t.dady[k] = dady;
+		t.attr[k] = a0 + dadx*(0.5 - px[0]) + dady*(0.5 - py[0]);
+	}
+	t.shader = shader;
+	t.texture = texture;
+	t.level = shader == SHADE_TEXTURED ? softwareMipLevel(t) : 0;
+	t.constant = shader == SHADE_FLAT;
+	for(int k=0;k<3;k++)
+		t.constant &= t.dadx[k] == 0 && t.dady[k] == 0;
+	if(t.constant)
+		writeSoftwareColor(t.color, t.attr[0], t.attr[1], t.attr[2]);
+
+	int index = Software.triangles.size();
+	Software.triangles.push_back(t);
+	for(int ty=t.y0/SOFTWARE_TILE;ty<=(t.y1-1)/SOFTWARE_TILE;ty++)
+		for(int tx=t.x0/SOFTWARE_TILE;tx<=(t.x1-1)/SOFTWARE_TILE;tx++)
+			Software.bins[ty*Software.tilesX + tx].push_back(index);
+}
 
-	// Send our transformation to the currently bound shader, in the "MVP" uniform
-	// For each model you render, since the MVP will be different (at least the M part)
-	//  Don't change unless you are sure!!
-	glm::mat4 MVP;	// MVP = Projection * View * Model
+/* One fragment of t with attributes a, like the scene.frag variant it stands for */
+inline void shadeSoftwarePixel (const SoftwareTriangle& t, const float* a, unsigned char* dst)
+{
+	switch(t.shader){
+		case SHADE_TEXTURED: {
+			const unsigned char* texel = softwareTexel(t.texture, t.level, a[0], a[1]);
+			// Cut out by alpha below 0.5
+			if(texel[3] < 128)
+				return;
+			memcpy(dst, texel, 3);
+			dst[3] = 255;
+			return;
+		}
+		case SHADE_FONT:
+			if(softwareSampleLinear(t.texture, a[0], a[1]) < 0.5f)
+				return;
+			writeSoftwareColor(dst, a[2], a[3], a[4]);
+			return;
+		case SHADE_ELLIPSE: {
+			// Edge distance in pixels through the gradient of the distance in the unit circle,
+			// which is what fwidth estimates. Flat triangles sit at the centre, fully covered
+			float length = sqrtf(a[0]*a[0] + a[1]*a[1]);
+			float coverage = 1;
+			if(length > 1e-6f){
+				float ddx = (a[0]*t.dadx[0] + a[1]*t.dadx[1]) / length;
+				float ddy = (a[0]*t.dady[0] + a[1]*t.dady[1]) / length;
+				coverage = min(max(0.5f - (length - 1) / max(fabsf(ddx) + fabsf(ddy), 1e-5f), 0.0f), 1.0f);
+			}
+			if(coverage <= 0)
+				return;
+			// GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA
+			float color[4] = {a[2], a[3], a[4], coverage};
+			for(int c=0;c<4;c++){
+				float blended = color[c]*coverage + dst[c]/255.0f*(1 - coverage);
+				dst[c] = (unsigned char)(min(max(blended, 0.0f), 1.0f)*255 + 0.5f);
+			}
+			return;
+		}
+		case SHADE_GROUND: {
+			float band = min(max(floorf((a[0] - 200.0f) / 5.0f), 0.0f), 19.0f);
+			writeSoftwareColor(dst, (133.0f + 2.5f*band) / 255.0f, (183.0f + 10.0f*band) / 255.0f, 52.0f / 255.0f);
+			return;
+		}
+		default:
+			writeSoftwareColor(dst, a[0], a[1], a[2]);
+	}
+}
 
-	
-	//Displaying background using texture
-	glUseProgram(textureProgramID);
+/* Bit i set when pixel i of the four starting at the edge values e (one
+   step of a apart) is inside every edge. live is how many edges take part */
+int softwareCoverage (const int* e, const int* a, int live)
+{
+#ifdef __SSE2__
+	__m128i outside = _mm_setzero_si128();
+	for(int k=0;k<live;k++){
+		__m128i values = _mm_add_epi32(_mm_set1_epi32(e[k]), _mm_setr_epi32(0, a[k], 2*a[k], 3*a[k]));
+		outside = _mm_or_si128(outside, values);
+	}
+	// Negative values have their sign bit set
+	return ~_mm_movemask_ps(_mm_castsi128_ps(outside)) & 0xF;
+#else
+	int mask = 0;
+	for(int i=0;i<4;i++){
+		int inside = 1;
+		for(int k=0;k<live;k++)
+			inside &= e[k] + i*a[k] >= 0;
+		mask |= inside << i;
+	}
+	return mask;
+#endif
+}
 
-	Matrices.model = glm::mat4(1.0f);
-	MVP = VP * Matrices.model;
-	glUniformMatrix4fv(Matrices.TexMatrixID, 1, GL_FALSE, &MVP[0][0]);
-	glUniform1i(glGetUniformLocation(textureProgramID, "texSampler"), 0);
-	draw3DTexturedObject(background);
-	
-	
-	glUseProgram (programID);
-	// Load identity to model matrix
-	Matrices.model = glm::mat4(1.0f);
+/* Clear one tile to the sky colour and draw every triangle binned into it */
+void rasterizeSoftwareTile (int tile)
+{
+	int left = (tile % Software.tilesX)*SOFTWARE_TILE, top = (tile / Software.tilesX)*SOFTWARE_TILE;
+	int right = min(left + SOFTWARE_TILE, Software.width), bottom = min(top + SOFTWARE_TILE, Software.height);
+	static const unsigned char sky[4] = {156, 205, 237, 0};
+	unsigned char* first = &Software.pixels[4*((size_t)top*Software.width + left)];
+	for(int x=left;x<right;x++)
+		memcpy(first + 4*(x - left), sky, 4);
+	for(int y=top+1;y<bottom;y++)
+		memcpy(&Software.pixels[4*((size_t)y*Software.width + left)], first, 4*(right - left));
+
+	const vector<int>& bin = Software.bins[tile];
+	for(size_t n=0;n<bin.size();n++){
+		const SoftwareTriangle& t = Software.triangles[bin[n]];
+		int x0 = max(t.x0, left), x1 = min(t.x1, right);
+		int y0 = max(t.y0, top), y1 = min(t.y1, bottom);
+		if(x0 >= x1 || y0 >= y1)
+			continue;
+
+		// Edge values at the first pixel centre. An edge that is inside all over the
+		// rectangle drops out, one outside all over it leaves nothing to draw. The
+		// rest cross the rectangle, so their values within it fit in 32 bits
+		int e[3] = {0, 0, 0}, a[3] = {0, 0, 0}, b[3] = {0, 0, 0}, live = 0, reject = 0;
+		for(int k=0;k<3;k++){
+			long long value = t.A[k]*(x0*SOFTWARE_SUBPIXEL + SOFTWARE_SUBPIXEL/2) + t.B[k]*(y0*SOFTWARE_SUBPIXEL + SOFTWARE_SUBPIXEL/2) + t.C[k];
+			long long stepX = t.A[k]*SOFTWARE_SUBPIXEL, stepY = t.B[k]*SOFTWARE_SUBPIXEL;
+			long long spanX = stepX*(x1 - 1 - x0), spanY = stepY*(y1 - 1 - y0);
+			if(value + max(spanX, 0LL) + max(spanY, 0LL) < 0){
+				reject = 1;
+				break;
+			}
+			if(value + min(spanX, 0LL) + min(spanY, 0LL) >= 0)
+				continue;
+			e[live] = (int)value;
+			a[live] = (int)stepX;
+			b[live] = (int)stepY;
+			live++;
+		}
+		if(reject)
+			continue;
+
+		int attributes = softwareAttributeCount[t.shader];
+		for(int y=y0;y<y1;y++){
+			int row[3] = {e[0], e[1], e[2]};
+			unsigned char* dst = &Software.pixels[4*((size_t)y*Software.width + x0)];
+			for(int x=x0;x<x1;x+=4){
+				int mask = softwareCoverage(row, a, live);
+				if(x1 - x < 4)
+					mask &= (1 << (x1 - x)) - 1;
+				for(int k=0;k<live;k++)
+					row[k] += 4*a[k];
+				if(!mask)
+					continue;
+				if(t.constant){
+					for(int i=0;mask;i++,mask>>=1)
+						if(mask & 1)
+							memcpy(dst + 4*(x - x0 + i), t.color, 4);
+					continue;
+				}
+				float values[SOFTWARE_ATTRIBUTES];
+				for(int k=0;k<attributes;k++)
+					values[k] = t.attr[k] + t.dadx[k]*x + t.dady[k]*y;
+				for(int i=0;mask;i++,mask>>=1){
+					if(mask & 1)
+						shadeSoftwarePixel(t, values, dst + 4*(x - x0 + i));
+					for(int k=0;k<attributes;k++)
+						values[k] += t.dadx[k];
+				}
+			}
+			for(int k=0;k<live;k++)
+				e[k] += b[k];
+		}
+	}
+}
 
-	/* Render your scene */
+void drawSoftwareTiles ()
+{
+	int tiles = Software.tilesX * Software.tilesY, tile;
+	while((tile = Software.nextTile++) < tiles)
+		rasterizeSoftwareTile(tile);
+}
 
-	//glm::mat4 translateTriangle = glm::translate (glm::vec3(-2.0f, 0.0f, 0.0f)); // glTranslatef
-	//glm::mat4 rotateTriangle = glm::rotate((float)(triangle_rotation*M_PI/180.0f), glm::vec3(0,0,1));  // rotate about vector (1,0,0)
-	//glm::mat4 triangleTransform = translateTriangle * rotateTriangle;
-	//  Matrices.model *= triangleTransform; 
-	MVP = VP * Matrices.model; // MVP = p * V * M
+void softwareWorkerMain ()
+{
+	profileThreadName("software raster");
+	long seen = 0;
+	while(1){
+		{
+			std::unique_lock<std::mutex> guard(Software.lock);
+			while(Software.frame == seen && Software.running)
+				Software.wake.wait(guard);
+			if(!Software.running)
+				return;
+			seen = Software.frame;
+		}
+		drawSoftwareTiles();
+		std::lock_guard<std::mutex> guard(Software.lock);
+		if(--Software.busy == 0)
+			Software.finished.notify_one();
+	}
+}
 
-	//  Don't change unless you are sure!!
-	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-	// draw3DObject draws the VAO given to it using current MVP matrix
-	//  draw3DObject(triangle);
+/* Position and attributes of vertex n of command c. Streamed and widget vertices
+   are six floats in the layout of the VAO they are drawn through */
+void fetchSoftwareVertex (const RenderCommand& c, const GLfloat* stream, int n, int shader, GLfloat* position, float* attributes)
+{
+	if(stream){
+		const GLfloat* v = stream + 6*n;
+		memcpy(position, v, 3*sizeof(GLfloat));
+		if(shader == SHADE_FLAT){
+			memcpy(attributes, v + 3, 3*sizeof(GLfloat));
+			return;
+		}
+		attributes[0] = v[3];
+		attributes[1] = v[4];
+		if(shader == SHADE_FONT){
+			// Unpacked like the vertex shader does, see packColor
+			int packed = (int)v[5];
+			attributes[2] = (packed >> 16) / 255.0f;
+			attributes[3] = ((packed >> 8) & 0xFF) / 255.0f;
+			attributes[4] = (packed & 0xFF) / 255.0f;
+		}
+		return;
+	}
+	const VAO* vao = c.vao;
+	memcpy(position, &vao->Vertices[3*n], 3*sizeof(GLfloat));
+	switch(shader){
+		case SHADE_TEXTURED:
+			memcpy(attributes, &vao->TexCoords[2*n], 2*sizeof(GLfloat));
+			break;
+		case SHADE_ELLIPSE:
+		case SHADE_FONT:
+			memcpy(attributes, &vao->TexCoords[2*n], 2*sizeof(GLfloat));
+			memcpy(attributes + 2, &vao->Colors[3*n], 3*sizeof(GLfloat));
+			break;
+		case SHADE_GROUND:
+			attributes[0] = position[1];
+			break;
+		default:
+			memcpy(attributes, &vao->Colors[3*n], 3*sizeof(GLfloat));
+	}
+}
 
-	// Pop matrix to undo transformations till last push matrix instead of recomputing model matrix
-	// glPopMatrix ();
-	//Displaying pigs and counting them for score 
-	int cnt = 0;
-	for(int i=0;i<6;i++){
-		if(!pigs[i]->dead){
-			double x1 = cannonball->centerx,y1 = cannonball->centery, x2 = pigs[i]->centerx, y2 = pigs[i]->centery;
-			if(pigs[i]->radius + cannonball->radius > sqrt((x2-x1)*(x2-x1)+(y2-y1)*(y2-y1))){
-				pigs[i]->dead = 1;
-				scoretimer[i][0] = pigs[i]->centerx; 
-				scoretimer[i][1] = pigs[i]->centery; 
-				scoretimer[i][2] = tim;
-				speedx = 0.1*speedx;
-				speedy = 0.1*speedy;
+/* Turn the commands into binned triangles on this thread, then draw the
+   tiles on every thread. Stands in for submitRenderList */
+void renderSoftware (RenderList& list)
+{
+	PROFILE_SCOPE("software render");
+	double start = monotonicTime();
+	{
+		std::lock_guard<std::mutex> guard(Widgets.lock);
+		Software.widgets = Widgets.vertices;
+	}
+	VAO* hudVAO = copyHudText(Software.hudText);
+	sortRenderList(list);
+	Software.triangles.clear();
+	for(size_t i=0;i<Software.bins.size();i++)
+		Software.bins[i].clear();
+
+	Submitted.drawCalls = 0;
+	Submitted.vertices = 0;
+	for(size_t i=0;i<list.commands.size();i++){
+		const RenderCommand& c = list.commands[i];
+		int shader = softwareShaderOf(c.program);
+		const SoftwareTexture* texture = shader == SHADE_TEXTURED ? &Software.atlas : &Software.glyphs;
+		if((shader == SHADE_TEXTURED || shader == SHADE_FONT) && !texture->data)
+			continue;
+		const GLfloat* stream = NULL;
+		int first = c.first, count = c.count;
+		if(c.vao == streamVAO || c.vao == spriteVAO || c.vao == textVAO)
+			stream = &list.streamVertices[0];
+		else if(c.vao == Widgets.vao){
+			stream = Software.widgets.empty() ? NULL : &Software.widgets[0];
+			first = 0;
+			count = Software.widgets.size() / 6;
+		}
+		else if(c.vao == hudVAO){
+			stream = Software.hudText.empty() ? NULL : &Software.hudText[0];
+			first = 0;
+			count = Software.hudText.size() / 6;
+		}
+		if(!stream && c.vao->Vertices.empty())
+			continue;
+
+		glm::mat4 MVP = list.VP * list.models[c.matrix];
+		int triangles = c.mode == GL_TRIANGLES ? count/3 : (c.mode == GL_TRIANGLE_STRIP || c.mode == GL_TRIANGLE_FAN) ? count - 2 : 0;
+		for(int n=0;n<triangles;n++){
+			int corners[3] = {3*n, 3*n + 1, 3*n + 2};
+			if(c.mode == GL_TRIANGLE_STRIP){
+				// Every other triangle of a strip runs backwards
+				corners[0] = n + (n & 1);
+				corners[1] = n + 1 - (n & 1);
+				corners[2] = n + 2;
+			}
+			else if(c.mode == GL_TRIANGLE_FAN){
+				corners[0] = 0;
+				corners[1] = n + 1;
+				corners[2] = n + 2;
 			}
+			glm::vec2 window[3];
+			float attributes[3][SOFTWARE_ATTRIBUTES] = {};
+			for(int k=0;k<3;k++){
+				GLfloat p[3];
+				fetchSoftwareVertex(c, stream, first + corners[k], shader, p, attributes[k]);
+				glm::vec4 clip = MVP * glm::vec4(p[0], p[1], p[2], 1);
+				window[k] = glm::vec2((clip.x/clip.w + 1)*0.5f*Software.width, (1 - clip.y/clip.w)*0.5f*Software.height);
+			}
+			addSoftwareTriangle(window, attributes, shader, texture);
+		}
+		Submitted.drawCalls++;
+		Submitted.vertices += count;
+	}
+	double setup = monotonicTime();
 
-			Matrices.model = glm::mat4(1.0f);
-			glm::mat4 translatePig = glm::translate(glm::vec3(pigs[i]->centerx + pigspx[i],pigs[i]->centery + pigspy[i],0));
-			pigs[i]->centerx += pigspx[i];
-			pigs[i]->centery += pigspy[i];
-			glm::mat4 rotatePig = glm::rotate((float)((pigs[i]->centerx-piginitx[i])/pigs[i]->radius),glm::vec3(0,0,1));
-			pigspx[i]/= 1.02;
-			Matrices.model *= (translatePig*rotatePig);
-			MVP = VP  * Matrices.model; 
-			glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-			draw3DObject(pigs[i]);
+	{
+		std::lock_guard<std::mutex> guard(Software.lock);
+		Software.nextTile = 0;
+		Software.busy = Software.workers.size();
+		Software.frame++;
+	}
+	Software.wake.notify_all();
+	drawSoftwareTiles();
+	{
+		std::unique_lock<std::mutex> guard(Software.lock);
+		while(Software.busy > 0)
+			Software.finished.wait(guard);
+	}
 
-		}
-		else
-			cnt++;
+	Software.setupSeconds += setup - start;
+	Software.rasterSeconds += monotonicTime() - setup;
+	Software.triangleCount += Software.triangles.size();
+	Software.frames++;
+	list.cpuSeconds += monotonicTime() - start;
+}
+
+/* The frame just drawn into rgba, the bottom width x height pixels like glReadPixels from (0, 0) */
+void copySoftwareFrame (unsigned char* rgba, int width, int height)
+{
+	int skip = Software.height - height;
+	for(int y=0;y<height;y++)
+		memcpy(rgba + (size_t)y*width*4, &Software.pixels[4*(size_t)(y + skip)*Software.width], width*4);
+}
+
+/* Frames of width x height drawn by this thread and --software-threads - 1 (one per core) more */
+void initSoftwareRenderer (int width, int height)
+{
+	Headless.startTime = monotonicTime();
+	Software.width = width;
+	Software.height = height;
+	Software.tilesX = (width + SOFTWARE_TILE - 1) / SOFTWARE_TILE;
+	Software.tilesY = (height + SOFTWARE_TILE - 1) / SOFTWARE_TILE;
+	Software.pixels.assign(4*(size_t)width*height, 0);
+	Software.bins.resize(Software.tilesX * Software.tilesY);
+	Software.running = 1;
+	int threads = Software.threads > 0 ? Software.threads : max(1, (int)std::thread::hardware_concurrency());
+	for(int i=1;i<threads;i++)
+		Software.workers.push_back(std::thread(softwareWorkerMain));
+	printf("Software: %dx%d in %d tiles of %d pixels on %d threads, %s edge functions\n", width, height,
+			Software.tilesX * Software.tilesY, SOFTWARE_TILE, threads,
+#ifdef __SSE2__
+			"SSE2"
+#else
+			"scalar"
+#endif
+			);
+}
+
+void stopSoftwareRenderer ()
+{
+	{
+		std::lock_guard<std::mutex> guard(Software.lock);
+		Software.running = 0;
 	}
+	Software.wake.notify_all();
+	for(size_t i=0;i<Software.workers.size();i++)
+		Software.workers[i].join();
+	Software.workers.clear();
+}
 
-	//Displaying game floor
-	Matrices.model = glm::mat4(1.0f);
-	MVP = VP * Matrices.model;
-	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-	draw3DObject(gameFloor);
-	
-	//Displaying power board
-	Matrices.model = glm::mat4(1.0f);
-	MVP = VP * Matrices.model;
-	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-	draw3DObject(powerboard);
+/* Milliseconds per frame turning commands into triangles and drawing the tiles */
+void reportSoftware (const char* mode)
+{
+	if(!softwareRendering || Software.frames == 0)
+		return;
+	printf("%s: software %.2f ms setup, %.2f ms raster per frame, %ld triangles per frame\n", mode,
+			1000.0*Software.setupSeconds/Software.frames, 1000.0*Software.rasterSeconds/Software.frames,
+			Software.triangleCount/Software.frames);
+	Software.setupSeconds = Software.rasterSeconds = 0;
+	Software.triangleCount = 0;
+	Software.frames = 0;
+}
 
-	//Checking collisions between pigs and wood logs
-	Matrices.model = glm::mat4(1.0f);
-	glm::mat4 translateWoodlog,rotateWoodlog;
-	translateWoodlog = glm::translate(glm::vec3(0,170,0));
-	if(collision_state==1){
-		if(pivotx == -10){
-			translateWoodlog = glm::translate(glm::vec3(10,200,0));
-			glm::mat4 translateWoodlog2 = glm::translate(glm::vec3(pivotx,pivoty,0));
-			rotateWoodlog = glm::rotate((float)(angle[0]*M_PI/180.0f), glm::vec3(0,0,1));
-			angle[0] += angular_v[0];
-			angular_v[0] += 0.3;
-			angle[0] = min(angle[0],90.0);
-			Matrices.model *= (translateWoodlog*rotateWoodlog*translateWoodlog2);
-			if(angle[0] >= 45){
-				pigs[0]->dead = 1;
-				scoretimer[0][0]=pigs[0]->centerx;
-				scoretimer[0][1]=pigs[0]->centery;
-				scoretimer[0][2]=tim;
-			}
-		}
-		else{
-			translateWoodlog = glm::translate(glm::vec3(-10,200,0));
-			glm::mat4 translateWoodlog2 = glm::translate(glm::vec3(pivotx,pivoty,0));
-			rotateWoodlog = glm::rotate((float)(angle[0]*M_PI/180.0f), glm::vec3(0,0,1));
-			angle[0] -= angular_v[0];
-			angular_v[0] += 0.3;
-			angle[0] = max(angle[0],-90.0);
-			Matrices.model *= (translateWoodlog*rotateWoodlog*translateWoodlog2);
-			if(angle[0] >= 45){
-				pigs[0]->dead = 1;
-				scoretimer[0][0]=pigs[0]->centerx;
-				scoretimer[0][1]=pigs[0]->centery;
-				scoretimer[0][2]=tim;
-			}
+/*****************
+ * Frame capture *
+ *****************/
+
+/* Frames in flight between glReadPixels and the CPU copy */
+#define CAPTURE_RING 3
+
+/* glReadPixels into a pixel pack buffer returns at once, the copy is made
+   by the GPU and picked up a few frames later once its fence has signalled */
+struct FrameCapture {
+	int width, height;
+	GLuint pbo[CAPTURE_RING];
+	GLsync fence[CAPTURE_RING];
+	long frame[CAPTURE_RING]; // Frame number read into each slot
+	int head;     // Next slot to read into
+	int tail;     // Oldest slot in flight
+	int inFlight;
+	long dropped; // Frames not captured because every slot was busy
+	vector<unsigned char> copies[CAPTURE_RING]; // --software: the frames themselves, copied at once
+} Capture;
+
+void initFrameCapture (int width, int height)
+{
+	if(softwareRendering){
+		Capture.width = width;
+		Capture.height = height;
+		Capture.head = Capture.tail = Capture.inFlight = 0;
+		Capture.dropped = 0;
+		for(int i=0;i<CAPTURE_RING;i++)
+			Capture.copies[i].resize(width*height*4);
+		return;
+	}
+	if(Capture.pbo[0]){
+		for(int i=0;i<CAPTURE_RING;i++)
+			if(Capture.fence[i])
+				glDeleteSync(Capture.fence[i]);
+		glDeleteBuffers(CAPTURE_RING, Capture.pbo);
+	}
+	Capture.width = width;
+	Capture.height = height;
+	Capture.head = Capture.tail = Capture.inFlight = 0;
+	Capture.dropped = 0;
+	glGenBuffers(CAPTURE_RING, Capture.pbo);
+	for(int i=0;i<CAPTURE_RING;i++){
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, Capture.pbo[i]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, width*height*4, NULL, GL_STREAM_READ);
+		Capture.fence[i] = 0;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+/* Queue a read of the frame just drawn, call before presentFrame. Never waits,
+   returns 0 and drops the frame if all slots are still in flight */
+int captureFrame (long frame)
+{
+	if(Capture.inFlight == CAPTURE_RING){
+		Capture.dropped++;
+		return 0;
+	}
+	int slot = Capture.head;
+	if(softwareRendering)
+		copySoftwareFrame(&Capture.copies[slot][0], Capture.width, Capture.height);
+	else{
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, screenFramebuffer);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, Capture.pbo[slot]);
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glReadPixels(0, 0, Capture.width, Capture.height, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		Capture.fence[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+	Capture.frame[slot] = frame;
+	Capture.head = (slot + 1) % CAPTURE_RING;
+	Capture.inFlight++;
+	return 1;
+}
+
+/* Copy the oldest finished capture into rgba (width*height*4 bytes), top row first,
+   or just release it if rgba is NULL. With wait it blocks until that capture is
+   done, otherwise returns 0 if it is not yet */
+int collectFrameInto (unsigned char* rgba, long* frame, int wait)
+{
+	if(Capture.inFlight == 0)
+		return 0;
+	int slot = Capture.tail;
+	if(softwareRendering){
+		if(rgba)
+			memcpy(rgba, &Capture.copies[slot][0], Capture.copies[slot].size());
+		*frame = Capture.frame[slot];
+		Capture.tail = (slot + 1) % CAPTURE_RING;
+		Capture.inFlight--;
+		return 1;
+	}
+	GLenum result = glClientWaitSync(Capture.fence[slot], wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? 1000000000 : 0);
+	if(result == GL_TIMEOUT_EXPIRED || result == GL_WAIT_FAILED)
+		return 0;
+	glDeleteSync(Capture.fence[slot]);
+	Capture.fence[slot] = 0;
+
+	*frame = Capture.frame[slot];
+	Capture.tail = (slot + 1) % CAPTURE_RING;
+	Capture.inFlight--;
+	if(!rgba)
+		return 1;
+
+	int stride = Capture.width * 4;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, Capture.pbo[slot]);
+	const unsigned char* pixels = (const unsigned char*) glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, stride * Capture.height, GL_MAP_READ_BIT);
+	if(pixels){
+		// GL rows start at the bottom
+		for(int y=0;y<Capture.height;y++)
+			memcpy(&rgba[y*stride], pixels + (Capture.height-1-y)*stride, stride);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	return pixels != NULL;
+}
+
+int collectFrame (vector<unsigned char>& rgba, long* frame, int wait)
+{
+	rgba.resize(Capture.width * Capture.height * 4);
+	return collectFrameInto(&rgba[0], frame, wait);
+}
+
+/*******
+ * PNG *
+ *******/
+
+/* SOIL reads PNG but only writes BMP/TGA/DDS. The writer below stores the
+   image uncompressed inside the zlib stream, which every PNG reader accepts */
+
+unsigned long crc32Update (unsigned long crc, const unsigned char* data, size_t size)
+{
+	static unsigned long table[256];
+	if(table[1] == 0){
+		for(unsigned long n=0;n<256;n++){
+			unsigned long c = n;
+			for(int k=0;k<8;k++)
+				c = c & 1 ? 0xEDB88320UL ^ (c >> 1) : c >> 1;
+			table[n] = c;
 		}
 	}
-	else
-		Matrices.model *= translateWoodlog;
-	MVP = VP * Matrices.model;
-	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-	draw3DObject(woodlogs[0]);
+	crc ^= 0xFFFFFFFFUL;
+	for(size_t i=0;i<size;i++)
+		crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return crc ^ 0xFFFFFFFFUL;
+}
+
+void pushBigEndian (vector<unsigned char>& out, unsigned long value)
+{
+	out.push_back((value >> 24) & 0xFF);
+	out.push_back((value >> 16) & 0xFF);
+	out.push_back((value >> 8) & 0xFF);
+	out.push_back(value & 0xFF);
+}
+
+void writePNGChunk (FILE* file, const char* type, const vector<unsigned char>& data)
+{
+	vector<unsigned char> chunk;
+	pushBigEndian(chunk, data.size());
+	chunk.insert(chunk.end(), type, type + 4);
+	chunk.insert(chunk.end(), data.begin(), data.end());
+	pushBigEndian(chunk, crc32Update(0, &chunk[4], chunk.size() - 4));
+	fwrite(&chunk[0], 1, chunk.size(), file);
+}
+
+/* Write 8-bit RGBA pixels, top row first */
+int writePNG (const char* path, const unsigned char* rgba, int width, int height)
+{
+	FILE* file = fopen(path, "wb");
+	if(!file)
+		return 0;
+	static const unsigned char signature[8] = {137, 'P', 'N', 'G', 13, 10, 26, 10};
+	fwrite(signature, 1, 8, file);
+
+	vector<unsigned char> header;
+	pushBigEndian(header, width);
+	pushBigEndian(header, height);
+	header.push_back(8);  // Bit depth
+	header.push_back(6);  // RGBA
+	header.push_back(0);  // Deflate
+	header.push_back(0);  // Adaptive filtering
+	header.push_back(0);  // No interlace
+	writePNGChunk(file, "IHDR", header);
+
+	// Every row starts with filter type 0
+	vector<unsigned char> raw;
+	raw.reserve((width*4 + 1) * height);
+	for(int y=0;y<height;y++){
+		raw.push_back(0);
+		raw.insert(raw.end(), rgba + y*width*4, rgba + (y+1)*width*4);
+	}
 
-	//Displaying wood logs
-	for(int i=1;i<=5;i++){
-		Matrices.model = glm::mat4(1.0f);
-		translateWoodlog = glm::translate(glm::vec3(woodlogs[i]->centerx + woodspx[i],woodlogs[i]->centery,0));
-		woodlogs[i]->centerx += woodspx[i];
-		woodspx[i] /= 1.02;
-		Matrices.model *= translateWoodlog;
-		MVP = VP * Matrices.model;
-		glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-		draw3DObject(woodlogs[i]);
-		if(i<=2&&woodlogs[i]->centerx + woodsizex[i] > pigs[i]->centerx - pigs[i]->radius){
-			pigspx[i] = woodspx[i]*0.95;
-			woodspx[i]=woodspx[i]*0.9;
-			pigs[i]->centerx = woodlogs[i]->centerx + woodsizex[i] + pigs[i]->radius;
+	vector<unsigned char> zlib;
+	zlib.push_back(0x78);
+	zlib.push_back(0x01);
+	unsigned long a = 1, b = 0;
+	for(size_t offset=0;offset<raw.size();){
+		size_t size = min((size_t)65535, raw.size() - offset);
+		zlib.push_back(offset + size == raw.size()); // Final block flag, stored
+		zlib.push_back(size & 0xFF);
+		zlib.push_back(size >> 8);
+		zlib.push_back(~size & 0xFF);
+		zlib.push_back((~size >> 8) & 0xFF);
+		for(size_t i=0;i<size;i++){
+			a = (a + raw[offset+i]) % 65521;
+			b = (b + a) % 65521;
 		}
+		zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + size);
+		offset += size;
 	}
+	pushBigEndian(zlib, (b << 16) | a);
+	writePNGChunk(file, "IDAT", zlib);
+	writePNGChunk(file, "IEND", vector<unsigned char>());
 
-	//Checking collisions between pigs and pigs
-	for(int i=0;i<4;i++) {
-		if(pig_wood[i]!=0){
-			int j = pig_wood[i];
-			
-			if(j==1){
-				if(pigs[i]->centerx+pigs[i]->radius<woodlogs[j]->centerx - woodsizex[j])
-					pigspy[i]+=gravity/3.0f;
-				if((pigs[i]->centery+pigs[i]->radius > woodlogs[j+1]->centery - woodsizey[j+1])
-						||pigs[i]->centery + pigs[i]->radius > 200){
-					pigs[i]->dead=1;
-					scoretimer[i][0] = pigs[i]->centerx; 
-					scoretimer[i][1] = pigs[i]->centery; 
-					scoretimer[i][2] = tim;
-				}
+	int ok = !ferror(file);
+	fclose(file);
+	return ok;
+}
 
-			}
-			if(j==2){
-				if(pigs[i]->centerx-pigs[i]->radius>woodlogs[j]->centerx + woodsizex[j])
-					pigspy[i]+=gravity/3.0f;
-				double x1 = pigs[i]->centerx, y1 = pigs[i]->centery, x2 = pigs[i+1]->centerx, y2 = pigs[i+1]->centery;
-				if(sqrt((x1-x2)*(x1-x2)+(y1-y2)*(y1-y2)) < pigs[i]->radius + pigs[i+1]->radius)
-				{
-					pigs[i]->dead=pigs[i+1]->dead = 1;
-					scoretimer[i][0] = pigs[i]->centerx; 
-					scoretimer[i][1] = pigs[i]->centery; 
-					scoretimer[i][2]=tim;
-					scoretimer[i+1][0] = pigs[i+1]->centerx; 
-					scoretimer[i+1][1] = pigs[i+1]->centery; 
-					scoretimer[i+1][2]=tim;
-				}
-				if(pigs[i]->centery+pigs[i]->radius>200){
-					pigs[i]->dead=1;
-					scoretimer[i][0] = pigs[i]->centerx; 
-					scoretimer[i][1] = pigs[i]->centery; 
-					scoretimer[i][2]=tim;
+/******************
+ * Video recorder *
+ ******************/
+
+/* Captured frames waiting for the writer thread */
+#define RECORD_QUEUE 8
+
+/* The GL thread copies finished captures into a fixed pool of frames and the
+   writer thread converts and writes them. One producer and one consumer,
+   so head and tail are the only shared state and no lock is needed */
+struct VideoRecorder {
+	const char* path;  // Output file, .y4m for YUV 4:2:0, anything else for raw RGB
+	FILE* file;
+	int y4m;
+	int width, height;
+	int recording;
+	std::atomic<int> toggle;  // Set by the R key, acted on by the GL thread
+	unsigned char* slots[RECORD_QUEUE];
+	std::atomic<unsigned> head; // Frames queued by the GL thread
+	std::atomic<unsigned> tail; // Frames written by the writer thread
+	std::atomic<int> writing;
+	std::thread writer;
+	long frames, dropped;
+	double overhead;   // Seconds the GL thread spent on recording
+	double started;    // gameTime of the first and the last capture
+	double lastCapture;
+} Recorder;
+
+/* Write one top-down RGBA frame as a Y4M FRAME, BT.601 studio range */
+void writeY4MFrame (FILE* file, const unsigned char* rgba, int width, int height, vector<unsigned char>& planes)
+{
+	int cw = (width + 1) / 2, ch = (height + 1) / 2;
+	planes.resize(width*height + 2*cw*ch);
+	unsigned char* Y = &planes[0];
+	unsigned char* U = Y + width*height;
+	unsigned char* V = U + cw*ch;
+	for(int i=0;i<width*height;i++){
+		const unsigned char* p = rgba + 4*i;
+		Y[i] = ((66*p[0] + 129*p[1] + 25*p[2] + 128) >> 8) + 16;
+	}
+	// Chroma from the average of each 2x2 block
+	for(int y=0;y<ch;y++){
+		for(int x=0;x<cw;x++){
+			int r = 0, g = 0, b = 0, n = 0;
+			for(int dy=0;dy<2;dy++){
+				for(int dx=0;dx<2;dx++){
+					int sx = 2*x + dx, sy = 2*y + dy;
+					if(sx >= width || sy >= height)
+						continue;
+					const unsigned char* p = rgba + 4*(sy*width + sx);
+					r += p[0]; g += p[1]; b += p[2]; n++;
 				}
-				
 			}
+			r /= n; g /= n; b /= n;
+			U[y*cw + x] = ((-38*r - 74*g + 112*b + 128) >> 8) + 128;
+			V[y*cw + x] = ((112*r - 94*g - 18*b + 128) >> 8) + 128;
 		}
 	}
+	fputs("FRAME\n", file);
+	fwrite(Y, 1, planes.size(), file);
+}
 
-	//Controlling bird using keyboard
-	if(keyboard_pressed_statex == 1){
-		keyboardy -= 2;
-		if(keyboardx < fireposx)
-			keyboardx += 2;
-		else if(keyboardx > fireposx)
-			keyboardx -= 2;
-		curx = keyboardx;
-		cury = keyboardy;
-	}
-	if(keyboard_pressed_statey == 1){
-		keyboardy += 2;
-		if(keyboardx < fireposx)
-			keyboardx -=2;
-		else if(keyboardx >fireposx)
-			keyboardx += 2;
-		curx = keyboardx;
-		cury = keyboardy;
+void writeRGBFrame (FILE* file, const unsigned char* rgba, int width, int height, vector<unsigned char>& rgb)
+{
+	rgb.resize(width*height*3);
+	for(int i=0;i<width*height;i++){
+		rgb[3*i] = rgba[4*i];
+		rgb[3*i+1] = rgba[4*i+1];
+		rgb[3*i+2] = rgba[4*i+2];
 	}
-		
-	//Limiting the power with which bird can be shot
-	if(pressed_state==1 || keyboard_pressed_statex == 1 || keyboard_pressed_statey == 1)
-		if(sqrt((curx-initx)*(curx-initx)+(cury-inity)*(cury-inity)) > 70){
-			double angle_present = -M_PI+atan2(inity-cury,initx-curx);
-			curx = initx + 70*cos(angle_present);
-			cury = inity + 70*sin(angle_present);
-		}
-	
-	//Displaying catapult
-	Matrices.model = glm::mat4(1.0f);
-	glm::mat4 translateCatapult = glm::translate(glm::vec3(-0.5, -4, 0));
-	glm::mat4 translateCatapult2 = glm::translate(glm::vec3(fireposx-10 , fireposy+10 , 0));
-	glm::mat4 rotateCatapult = glm::rotate((float)(atan2(-cury+fireposy+10 ,-curx+fireposx-10)), glm::vec3(0,0,1));
-	double scalelength2 = sqrt((fireposx-10 - curx)*(fireposx -10 -curx) + (fireposy+10 - cury)*(fireposy+10-cury));
-	glm::mat4 scaleCatapult = glm::scale(glm::vec3(scalelength2 , 1, 1));
-	if(pressed_state == 1 || keyboard_pressed_statex == 1 || keyboard_pressed_statey == 1)
-		Matrices.model *= (translateCatapult2 * rotateCatapult *  scaleCatapult * translateCatapult);
-	else
-		Matrices.model *= translateCatapult;
-	MVP = VP * Matrices.model;
-	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-	if(pressed_state==1)
-		draw3DObject(catapult);
+	fwrite(&rgb[0], 1, rgb.size(), file);
+}
 
-	//Displaying the bird
-	Matrices.model = glm::mat4(1.0f);
-	glm::mat4 translateRectangle;// = glm::translate (glm::vec3(curx, cury, 0));        // glTranslatef
-	glm::mat4 rotateRectangle; // rotate about vector (-1,1,1)
-	if(pressed_state==0 && keyboard_pressed_statex == 0 && keyboard_pressed_statey == 0){
-		translateRectangle = glm::translate (glm::vec3(fireposx, fireposy, 0));        // glTranslatef
-		cannonball->centerx = fireposx;
-		cannonball->centery = fireposy;
-		cannonball->radius = cannonball_size;
-	}
-	else if(pressed_state==1 || keyboard_pressed_statex == 1 || keyboard_pressed_statey == 1){
-		if(sqrt((curx-initx)*(curx-initx)+(cury-inity)*(cury-inity)) > 70){
-			double angle_present = -M_PI+atan2(inity-cury,initx-curx);
-			curx = initx + 70*cos(angle_present);
-			cury = inity + 70*sin(angle_present);
+/* Y4M header at a frame rate of rate per second. The rate field is padded to a
+   fixed width so stopRecording can write the measured rate over it */
+void writeY4MHeader (FILE* file, int width, int height, double rate)
+{
+	char frameRate[32];
+	snprintf(frameRate, sizeof(frameRate), "F%ld:1000", lround(rate*1000));
+	fprintf(file, "YUV4MPEG2 W%d H%d %-16s Ip A1:1 C420jpeg\n", width, height, frameRate);
+}
+
+void recorderThreadMain ()
+{
+	profileThreadName("recorder");
+	vector<unsigned char> scratch;
+	while(true){
+		unsigned tail = Recorder.tail.load(std::memory_order_relaxed);
+		if(tail == Recorder.head.load(std::memory_order_acquire)){
+			if(!Recorder.writing)
+				break;
+			usleep(1000);
+			continue;
 		}
-		power = sqrt((curx-initx)*(curx-initx) + (cury-inity)*(cury-inity));
-		translateRectangle = glm::translate (glm::vec3(curx, cury, 0));        // glTranslatef
-		cannonball->centerx = curx;
-		cannonball->centery = cury;
-		cannonball->radius = cannonball_size;
-	}
-	else {
-		translateRectangle = glm::translate (glm::vec3(initx, inity, 0));        // glTranslatef
-		cannonball->centerx = initx;
-		cannonball->centery = inity;
-		cannonball->radius = cannonball_size;
+		const unsigned char* rgba = Recorder.slots[tail % RECORD_QUEUE];
+		if(Recorder.y4m)
+			writeY4MFrame(Recorder.file, rgba, Recorder.width, Recorder.height, scratch);
+		else
+			writeRGBFrame(Recorder.file, rgba, Recorder.width, Recorder.height, scratch);
+		Recorder.tail.store(tail + 1, std::memory_order_release);
 	}
-	if(collision_state == 0 && cannonball->centerx >= -10 - cannonball_size && cannonball->centerx <= -10 + 20 + cannonball_size && cannonball->centery >= 140 - cannonball_size ){
-		collision_state=1;
-		angle[0] = 0.1;
-		angular_v[0] = speedx*0.2;
-		if(cannonball->centerx > 10){
-			pivotx = 10;
-			angle[0] = -0.1;
-			angular_v[0] = -speedx*0.2;
-		}
-		if(cannonball->centery < 140 && cannonball->centerx > -10 - cannonball_size/2 && (cannonball->centerx < 10 + cannonball_size/2)){
-			speedy = -0.5*speedy;
-			inity = 140 - cannonball_size - 1;
-		}
-		else{
-			speedx = -0.5*speedx;
-		}
+}
+
+/* Open the output and start the writer, must run on the GL thread */
+void startRecording (int width, int height)
+{
+	if(!Recorder.path)
+		Recorder.path = "gameplay.y4m";
+	Recorder.file = fopen(Recorder.path, "wb");
+	if(!Recorder.file){
+		cout << "Recorder: could not open " << Recorder.path << endl;
+		return;
 	}
+	size_t length = strlen(Recorder.path);
+	Recorder.y4m = length >= 4 && strcmp(Recorder.path + length - 4, ".y4m") == 0;
+	// 4:2:0 chroma needs even sizes
+	Recorder.width = Recorder.y4m ? width & ~1 : width;
+	Recorder.height = Recorder.y4m ? height & ~1 : height;
+	// Frames are captured as they are displayed, so the rate is only a guess until recording stops
+	if(Recorder.y4m)
+		writeY4MHeader(Recorder.file, Recorder.width, Recorder.height, Pacing.mode == PACING_CAP && Pacing.cap > 0 ? Pacing.cap : 60);
+
+	initFrameCapture(Recorder.width, Recorder.height);
+	for(int i=0;i<RECORD_QUEUE;i++)
+		Recorder.slots[i] = new unsigned char[Recorder.width*Recorder.height*4];
+	Recorder.head = Recorder.tail = 0;
+	Recorder.frames = Recorder.dropped = 0;
+	Recorder.overhead = 0;
+	Recorder.started = Recorder.lastCapture = -1;
+	Recorder.writing = 1;
+	Recorder.writer = std::thread(recorderThreadMain);
+	Recorder.recording = 1;
+	printf("Recorder: writing %dx%d %s to %s\n", Recorder.width, Recorder.height, Recorder.y4m ? "Y4M" : "raw RGB24", Recorder.path);
+}
 
-	for(int i=1;i<=5;i++){
-		double x = cannonball->centerx,y = cannonball->centery;
-		if(x >= woodlogs[i]->centerx - woodsizex[i] - cannonball_size && x <= woodlogs[i]->centerx + woodsizex[i] + cannonball_size && y >= woodlogs[i]->centery - woodsizey[i] - cannonball_size && y <= woodlogs[i]->centery + woodsizey[i]) {
-			if(cannonball->centery < woodlogs[i]->centery - woodsizey[i] && cannonball->centerx > woodlogs[i]->centerx - woodsizex[i] - cannonball_size/2 ){
-				speedy = -0.25*speedy, speedx = 0.25*speedx;
-				inity = woodlogs[i]->centery - woodsizey[i] - cannonball_size - 1;
-			}
-			else {
-				if(i==1){
-					woodspx[1] = speedx * 0.1;
-					woodspx[2] = woodspx[1] * 0.1;
-				}
-				else if(i==2){
-					woodspx[2] = speedx * 0.05;
-					woodspx[1] = woodspx[2] * 0.5;
-				}
-				speedx = -0.25*speedx, speedy = 0.25*speedy;
-				initx = woodlogs[i]->centerx - woodsizex[i] - cannonball_size - 1;
-			}
-			break;
+/* Move finished captures into the queue, a full queue drops the frame */
+void drainCaptures (int wait)
+{
+	long frame;
+	while(Capture.inFlight){
+		unsigned head = Recorder.head.load(std::memory_order_relaxed);
+		if(head - Recorder.tail.load(std::memory_order_acquire) == RECORD_QUEUE){
+			// Writer is behind, throw the capture away rather than wait for it
+			if(!collectFrameInto(NULL, &frame, wait))
+				return;
+			Recorder.dropped++;
+			continue;
 		}
+		if(!collectFrameInto(Recorder.slots[head % RECORD_QUEUE], &frame, wait))
+			return;
+		Recorder.head.store(head + 1, std::memory_order_release);
+		Recorder.frames++;
 	}
-	if(pressed_state==3) 
-		rotateRectangle = glm::rotate((float)(atan2(-prevy+inity,-prevx+initx)), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
-	else
-		rotateRectangle = glm::rotate((float)(atan2(-cury+inity,-curx+initx)), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
+}
 
-	if(pressed_state==3 || pressed_state==1 || keyboard_pressed_statex == 1 || keyboard_pressed_statey)  Matrices.model *= (translateRectangle * rotateRectangle);
-	else  Matrices.model *= (translateRectangle );
-	MVP = VP * Matrices.model;
-	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+/* Flush the captures still in flight and finish the file */
+void stopRecording ()
+{
+	if(!Recorder.recording)
+		return;
+	drainCaptures(1);
+	Recorder.writing = 0;
+	Recorder.writer.join();
+	long captures = Recorder.frames + Recorder.dropped + Capture.dropped;
+	if(Recorder.y4m && Recorder.frames > 0 && captures > 1 && Recorder.lastCapture > Recorder.started){
+		// The rate frames were actually written at over the time they cover, whatever the pacing
+		double period = (Recorder.lastCapture - Recorder.started)/(captures - 1);
+		fseek(Recorder.file, 0, SEEK_SET);
+		writeY4MHeader(Recorder.file, Recorder.width, Recorder.height, Recorder.frames/(captures*period));
+	}
+	fclose(Recorder.file);
+	for(int i=0;i<RECORD_QUEUE;i++)
+		delete[] Recorder.slots[i];
+	Recorder.recording = 0;
+	printf("Recorder: %ld frames written to %s, %ld dropped (%ld not captured), %.3f ms per frame on the GL thread\n",
+			Recorder.frames, Recorder.path, Recorder.dropped, Capture.dropped,
+			Recorder.frames ? 1000.0*Recorder.overhead/Recorder.frames : 0.0);
+}
 
-	// draw3DObject draws the VAO given to it using current MVP matrix
-	draw3DObject(cannonball);
+/* Called from the key handler on any thread */
+void toggleRecording ()
+{
+	Recorder.toggle = 1;
+}
 
+/* Capture the frame just drawn, call on the GL thread before presentFrame */
+void recordVideoFrame (int width, int height)
+{
+	if(Recorder.toggle.exchange(0)){
+		if(Recorder.recording)
+			stopRecording();
+		else
+			startRecording(width, height);
+	}
+	if(!Recorder.recording)
+		return;
+
+	double start = gameTime();
+	drainCaptures(0);
+	captureFrame(Recorder.frames + Recorder.dropped + Capture.inFlight);
+	if(Recorder.started < 0)
+		Recorder.started = start;
+	Recorder.lastCapture = start;
+	Recorder.overhead += gameTime() - start;
+}
 
-	//Displaying power
-	Matrices.model = glm::mat4(1.0f);
-	translateCatapult = glm::translate(glm::vec3(-0.5, -4, 0));
-	translateCatapult2 = glm::translate(glm::vec3(fireposx + 20, fireposy + 15, 0));
-	rotateCatapult = glm::rotate((float)(atan2(-cury+fireposy + 15,-curx+fireposx + 20)), glm::vec3(0,0,1));
-	double scalelength = sqrt((fireposx+20 - curx)*(fireposx + 20 -curx) + (fireposy+15 - cury)*(fireposy+15-cury));
-	scaleCatapult = glm::scale(glm::vec3(scalelength , 1, 1));
-	if(pressed_state == 1 || keyboard_pressed_statex == 1 || keyboard_pressed_statey == 1)
-		Matrices.model *= (translateCatapult2 * rotateCatapult *  scaleCatapult * translateCatapult);
-	else
-		Matrices.model *= translateCatapult;
-	MVP = VP * Matrices.model;
-	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-	if(pressed_state ==1) draw3DObject(catapult);
+/*******************
+ * Performance HUD *
+ *******************/
+
+/* H shows frame times and what the frame cost in the top left corner. The
+   GL thread samples every presented frame, the simulation thread turns the
+   samples into geometry when it records the frame. The text is averaged over
+   HUD_REFRESH, and only a line whose text changed is laid out again; the
+   text is kept in a buffer of its own and drawn from there every frame */
+#define HUD_GRAPH_FRAMES 120
+#define HUD_LINES 3
+#define HUD_REFRESH 0.25
+#define HUD_TEXT_SIZE 14      // Pixels
+#define HUD_GRAPH_HEIGHT 60   // Pixels for HUD_GRAPH_MS
+#define HUD_GRAPH_MS 33.3
+
+struct PerfHud {
+	std::atomic<int> visible; // Toggled on the input thread, read without the lock on the others
+	std::mutex lock;  // Guards the samples, written and read on different threads in --threaded
+	float frameMs[HUD_GRAPH_FRAMES];
+	int next;         // Oldest sample in frameMs
+	double frameSum, cpuSum, gpuSum;
+	int samples;      // Frames in the sums
+	int drawCalls;
+	long vertices;
+	double refreshed; // gameTime() the lines were last averaged
+	std::string lines[HUD_LINES];
+	vector<GLfloat> lineVertices[HUD_LINES]; // lines[i] in pixels from the top left corner, see appendText
+	vector<GLfloat> text;     // Every line, what vao draws
+	long version;             // Bumped with every change of text
+	long uploaded;            // Version in vao's buffer, GL thread only
+	GLsizeiptr capacity;      // Bytes allocated for vao's buffer
+	VAO* vao;                 // A createWidgetObject, drawn with the pixels to world matrix
+	int rebuilds;     // Lines whose text changed
+} Hud;
+
+/* GL thread, after every presented frame */
+void sampleHud (double frameSeconds, const RenderList& list)
+{
+	if(!Hud.visible)
+		return;
+	std::lock_guard<std::mutex> guard(Hud.lock);
+	Hud.frameMs[Hud.next] = 1000.0 * frameSeconds;
+	Hud.next = (Hud.next + 1) % HUD_GRAPH_FRAMES;
+	Hud.frameSum += 1000.0 * frameSeconds;
+	Hud.cpuSum += 1000.0 * list.cpuSeconds;
+	Hud.gpuSum += GpuTimers.last;
+	Hud.samples++;
+	Hud.drawCalls = Submitted.drawCalls;
+	Hud.vertices = Submitted.vertices;
+}
 
-	Matrices.model = glm::mat4(1.0f);
-	glm::mat4 scalePower = glm::scale(glm::vec3(power*6,1,1));
-	glm::mat4 translatePower = glm::translate(glm::vec3(-400 - ( 90 - power * 3), -240, 0));
-	Matrices.model *= ( translatePower * scalePower);
-	MVP = VP * Matrices.model;
-	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-	draw3DObject(powerelement);
+/* Pigs, logs and the bird that are still moving */
+int awakeBodies ()
+{
+	int awake = pressed_state == 3;
+	if(collision_state == 1 && fabs(angle[0]) < 90)
+		awake++;
+	for(int i=1;i<=5;i++)
+		if(fabs(woodspx[i]) > 0.01)
+			awake++;
+	for(int i=0;i<6;i++)
+		if(!pigs[i]->dead && (fabs(pigspx[i]) > 0.01 || fabs(pigspy[i]) > 0.01))
+			awake++;
+	return awake;
+}
 
+void toggleHud ()
+{
+	std::lock_guard<std::mutex> guard(Hud.lock);
+	Hud.visible ^= 1;
+	Hud.samples = 0;
+	Hud.frameSum = Hud.cpuSum = Hud.gpuSum = 0;
+	for(int i=0;i<HUD_GRAPH_FRAMES;i++)
+		Hud.frameMs[i] = 0;
+}
 
-	// Increment angles
-	float increments = 1;
+/* Two triangles in pixels from the top left corner, mapped by toWorld */
+void addHudRect (RenderList& list, const glm::mat4& toWorld, float x0, float y0, float x1, float y1, const glm::vec3& color, float depth)
+{
+	const float corners[6][2] = {{x0,y0}, {x1,y0}, {x1,y1}, {x1,y1}, {x0,y1}, {x0,y0}};
+	int first = list.streamVertices.size() / 6;
+	for(int i=0;i<6;i++){
+		glm::vec4 p = toWorld * glm::vec4(corners[i][0], corners[i][1], 0, 1);
+		list.streamVertices.push_back(p.x);
+		list.streamVertices.push_back(p.y);
+		list.streamVertices.push_back(p.z);
+		list.streamVertices.push_back(color.x);
+		list.streamVertices.push_back(color.y);
+		list.streamVertices.push_back(color.z);
+	}
+	RenderCommand& c = addRenderCommand(list, programID, streamVAO, glm::mat4(1.0f), LAYER_HUD, depth);
+	c.first = first;
+	c.count = 6;
+	c.mode = GL_TRIANGLES;
+}
 
-	if(pressed_state==3){
-		prevx=initx,prevy=inity;
-		initx=initx+speedx,inity=inity+speedy,speedy+=gravity;
-		inity=min(200-cannonball_size,inity);
-		if(inity==200-cannonball_size)
-			speedy=-0.8*speedy,speedx=0.7*speedx;
-		if(fabs(speedx)<=0.05&&fabs(speedy)<=0.05){
-				pressed_state=0;
-				gravity = 0.2;
-				power = 0;
-			
+/* Simulation thread, at the end of simulateFrame once list.VP is known */
+void recordPerfHud (RenderList& list)
+{
+	if(!Hud.visible || list.width <= 0)
+		return;
+	float frameMs[HUD_GRAPH_FRAMES];
+	int next;
+	{
+		std::lock_guard<std::mutex> guard(Hud.lock);
+		memcpy(frameMs, Hud.frameMs, sizeof(frameMs));
+		next = Hud.next;
+		double now = gameTime();
+		if(Hud.samples > 0 && now - Hud.refreshed >= HUD_REFRESH){
+			char line[HUD_LINES][96];
+			snprintf(line[0], sizeof(line[0]), "FRAME %.1f MS  CPU %.1f  GPU %.1f",
+					Hud.frameSum/Hud.samples, Hud.cpuSum/Hud.samples, Hud.gpuSum/Hud.samples);
+			snprintf(line[1], sizeof(line[1]), "DRAWS %d  VERTICES %ld", Hud.drawCalls, Hud.vertices);
+			snprintf(line[2], sizeof(line[2]), "BUFFERS %.2f MB  AWAKE %d", bufferBytes/1048576.0, awakeBodies());
+			int changed = 0;
+			for(int i=0;i<HUD_LINES;i++){
+				if(Hud.lines[i] != line[i]){
+					Hud.lines[i] = line[i];
+					float baseline = 8 + (i + 1)*(HUD_TEXT_SIZE + 6) - 6;
+					Hud.lineVertices[i].clear();
+					appendText(Hud.lineVertices[i], line[i], glm::vec3(1, 1, 1), glm::translate(glm::vec3(10, baseline, 0)) * glm::scale(glm::vec3(HUD_TEXT_SIZE, -HUD_TEXT_SIZE, 1)));
+					Hud.rebuilds++;
+					changed = 1;
+				}
+			}
+			if(changed){
+				Hud.text.clear();
+				for(int i=0;i<HUD_LINES;i++)
+					Hud.text.insert(Hud.text.end(), Hud.lineVertices[i].begin(), Hud.lineVertices[i].end());
+				Hud.version++;
+			}
+			Hud.samples = 0;
+			Hud.frameSum = Hud.cpuSum = Hud.gpuSum = 0;
+			Hud.refreshed = now;
 		}
 	}
 
-	//Rendering score
-	
-	// Render font on screen
-	static int fontScale = 1;
-	float fontScaleValue = 50 + 0.25*sinf(fontScale*M_PI/180.0f);
-	glm::vec3 fontColor = glm::vec3(228.0f/255.0f,142.0f/255.0f,57.0f/255.0f);//getRGBfromHue (fontScale);
-				
+	// Pixels from the top left corner to clip space, then back through the camera
+	// so the overlay ignores pan and zoom. The scene at z = 0 lands at -0.992,
+	// so the overlay goes just behind the near plane to stay in front of it
+	glm::mat4 toClip = glm::translate(glm::vec3(-1.0f, 1.0f, -0.999f)) * glm::scale(glm::vec3(2.0f/list.width, -2.0f/list.height, 1.0f));
+	glm::mat4 toWorld = glm::inverse(list.VP) * toClip;
+
+	float width = 2*HUD_GRAPH_FRAMES + 20;
+	float top = HUD_LINES*(HUD_TEXT_SIZE + 6) + 14;
+	addHudRect(list, toWorld, 0, 0, width, top + HUD_GRAPH_HEIGHT + 10, glm::vec3(0.1f, 0.1f, 0.12f), 0);
+	// One bar per frame, oldest on the left; green within 60 Hz, yellow within 30 Hz
+	for(int i=0;i<HUD_GRAPH_FRAMES;i++){
+		float ms = frameMs[(next + i) % HUD_GRAPH_FRAMES];
+		if(ms <= 0)
+			continue;
+		float h = min(ms, (float)HUD_GRAPH_MS) / HUD_GRAPH_MS * HUD_GRAPH_HEIGHT;
+		glm::vec3 color = ms <= 17.0f ? glm::vec3(0.3f, 0.9f, 0.3f) : ms <= 34.0f ? glm::vec3(0.95f, 0.85f, 0.2f) : glm::vec3(0.95f, 0.3f, 0.2f);
+		float x = 10 + 2*i;
+		addHudRect(list, toWorld, x, top + HUD_GRAPH_HEIGHT - h, x + 2, top + HUD_GRAPH_HEIGHT, color, 1);
+	}
+	// 16.7 ms line
+	float y60 = top + HUD_GRAPH_HEIGHT - 16.7f / HUD_GRAPH_MS * HUD_GRAPH_HEIGHT;
+	addHudRect(list, toWorld, 10, y60, width - 10, y60 + 1, glm::vec3(0.6f, 0.6f, 0.6f), 2);
 
+	// The text only changes with the lines, so it is kept in pixels and moved by toWorld
+	if(Hud.vao && !Hud.text.empty())
+		addRenderCommand(list, fontProgramID, Hud.vao, toWorld, LAYER_HUD, 3);
+}
 
+/* GL thread, at submit: the syncWidgets of the HUD text */
+void syncHud (RenderList& list)
+{
+	if(!Hud.vao)
+		return;
+	{
+		std::lock_guard<std::mutex> guard(Hud.lock);
+		if(Hud.uploaded != Hud.version){
+			uploadRetainedVertices(Hud.vao, Hud.text, Hud.capacity);
+			Hud.uploaded = Hud.version;
+		}
+	}
+	for(size_t i=0;i<list.commands.size();i++)
+		if(list.commands[i].vao == Hud.vao)
+			list.commands[i].count = Hud.vao->NumVertices;
+}
 
-	// Use font Shaders for next part of code
-	glUseProgram(fontProgramID);
-	Matrices.view = glm::lookAt(glm::vec3(0,0,3), glm::vec3(0,0,0), glm::vec3(0,1,0)); // Fixed camera for 2D (ortho) in XY plane
+/* Software rendering thread: copy the HUD text for this frame and return the object its draw uses */
+VAO* copyHudText (vector<GLfloat>& out)
+{
+	std::lock_guard<std::mutex> guard(Hud.lock);
+	out = Hud.text;
+	return Hud.vao;
+}
 
-	// Transform the text
-	Matrices.model = glm::mat4(1.0f);
-	glm::mat4 translateText = glm::translate(glm::vec3(400,-250,0));
-	glm::mat4 scaleText = glm::scale(glm::vec3(fontScaleValue,fontScaleValue,fontScaleValue));
-	glm::mat4 rotateText = glm::rotate((float)M_PI, glm::vec3(1,0,0));
-	Matrices.model *= (translateText * scaleText * rotateText);
-	MVP = Matrices.projection * Matrices.view * Matrices.model;
-	// send font's MVP and font color to fond shaders
-	glUniformMatrix4fv(GL3Font.fontMatrixID, 1, GL_FALSE, &MVP[0][0]);
-	glUniform3fv(GL3Font.fontColorID, 1, &fontColor[0]);
-	
-	score = cnt * 100;
-	//string str = to_string(score);
-	char str[10];
-	sprintf(str,"SCORE: %d",score);
-	// Render font
-	GL3Font.font->Render(str);
-	for(int i=0;i<6;i++){
-		if(scoretimer[i][3]>0){
-			Matrices.model = glm::mat4(1.0f);
-			//cout<<scoretimer[i][0]<<" "<<scoretimer[i][1]<<endl;
-			glm::mat4 translateText = glm::translate(glm::vec3(400,0,0));
-			Matrices.model *=  ( translateText *scaleText * rotateText);
-			MVP = Matrices.projection * Matrices.view * Matrices.model;
-			glUniformMatrix4fv(GL3Font.fontMatrixID, 1, GL_FALSE, &MVP[0][0]);
-			glUniform3fv(GL3Font.fontColorID, 1, &fontColor[0]);
-	//		GL3Font.font->Render("100");
+/*****************
+ * Render thread *
+ *****************/
+
+/* Lists handed from the simulation to the render thread. The simulation records
+   into its own list and swaps it into pending; the render thread swaps pending
+   into drawing. A published list is never written again by the simulation */
+struct FrameHandoff {
+	std::mutex lock;
+	RenderList pending;
+	RenderList drawing;
+	int fresh;               // pending holds a list the render thread has not taken yet
+	std::atomic<int> running;
+	std::thread renderer;
+} Handoff;
+
+/* Frame time and input-to-display latency of whichever thread swaps buffers */
+struct FrameTiming {
+	const char* mode;
+	double lastSwap;
+	double frameSum;
+	int frames;
+	double latencySum;
+	int latencies;
+	long drawn, culled; // Objects recorded and culled over the frames
+	double lastInput;  // inputTime already accounted for
+	double lastReport;
+} Timing;
+
+/* Moves every member, so the vectors keep their capacity and nothing is copied */
+void swapRenderLists (RenderList& a, RenderList& b)
+{
+	std::swap(a, b);
+}
+
+void reportFrameTiming ()
+{
+	if(Timing.frames == 0)
+		return;
+	printf("%s: frame %.2f ms, input-to-display %.2f ms over %d frames, %d static layer redraws, %d widget rebuilds\n", Timing.mode,
+			1000.0*Timing.frameSum/Timing.frames,
+			Timing.latencies ? 1000.0*Timing.latencySum/Timing.latencies : 0.0, Timing.frames, StaticLayer.redraws, (int)Widgets.rebuilds);
+	printf("%s: %.1f objects drawn, %.1f culled per frame\n", Timing.mode,
+			(double)Timing.drawn/Timing.frames, (double)Timing.culled/Timing.frames);
+	reportGpuTimers(Timing.mode);
+	reportOverdraw(Timing.mode);
+	reportSoftware(Timing.mode);
+	reportFramePacing(Timing.mode);
+	StaticLayer.redraws = 0;
+	Widgets.rebuilds = 0;
+	Timing.drawn = Timing.culled = 0;
+	Timing.frameSum = Timing.latencySum = 0;
+	Timing.frames = Timing.latencies = 0;
+}
+
+/* Call right after presentFrame with the list that was shown */
+void recordFrameTiming (const RenderList& list)
+{
+	double now = gameTime();
+	double inputTime = list.inputTime;
+	if(Timing.lastSwap > 0){
+		sampleHud(now - Timing.lastSwap, list);
+		Timing.frameSum += now - Timing.lastSwap;
+		Timing.frames++;
+		Timing.drawn += list.drawn;
+		Timing.culled += list.culled;
+	}
+	Timing.lastSwap = now;
+	if(inputTime > Timing.lastInput){
+		Timing.latencySum += now - inputTime;
+		Timing.latencies++;
+		Timing.lastInput = inputTime;
+	}
+	if(now - Timing.lastReport >= 5.0){
+		reportFrameTiming();
+		Timing.lastReport = now;
+	}
+}
+
+void renderThreadMain (GLFWwindow* window)
+{
+	profileThreadName("render");
+	makeContextCurrent(window);
+	while(Handoff.running){
+		{
+			std::lock_guard<std::mutex> guard(Handoff.lock);
+			if(Handoff.fresh){
+				swapRenderLists(Handoff.pending, Handoff.drawing);
+				Handoff.fresh = 0;
+			}
 		}
+		// Until the first list arrives only the clear colour is shown
+		interpolateBodies(Handoff.drawing, (gameTime() - Handoff.drawing.stepTime)/SIM_TICK);
+		submitRenderList(Handoff.drawing);
+		recordVideoFrame(Handoff.drawing.width, Handoff.drawing.height);
+		presentFrame(window);
+		recordFrameTiming(Handoff.drawing);
 	}
+	stopRecording();
+	releaseContext(window);
+}
+
+/* Hand the GL context to a new render thread, the calling thread keeps input and simulation */
+void startRenderThread (GLFWwindow* window)
+{
+	clearRenderList(Handoff.pending);
+	clearRenderList(Handoff.drawing);
+	Handoff.fresh = 0;
+	Handoff.running = 1;
+	releaseContext(window);
+	Handoff.renderer = std::thread(renderThreadMain, window);
+}
+
+void stopRenderThread ()
+{
+	if(!Handoff.running)
+		return;
+	Handoff.running = 0;
+	Handoff.renderer.join();
+	reportFrameTiming();
+}
+
+/* Make list the next one to be drawn; list gets back an older one to record into */
+void publishRenderList (RenderList& list)
+{
+	std::lock_guard<std::mutex> guard(Handoff.lock);
+	swapRenderLists(list, Handoff.pending);
+	Handoff.fresh = 1;
 }
 
 /* Initialise glfw window, I/O callbacks and the renderer to use */
@@ -1509,6 +5465,8 @@ GLFWwindow* initGLFW (int width, int height)
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	// The overdraw view counts fragments in the stencil
+	glfwWindowHint(GLFW_STENCIL_BITS, 8);
 
 	window = glfwCreateWindow(width, height, "Angry birds", NULL, NULL);
 
@@ -1519,7 +5477,7 @@ GLFWwindow* initGLFW (int width, int height)
 
 	glfwMakeContextCurrent(window);
 	gladLoadGLLoader((GLADloadproc) glfwGetProcAddress);
-	glfwSwapInterval( 1 );
+	glfwSwapInterval( pacingSwapInterval() );
 
 	/* --- register callbacks with GLFW --- */
 
@@ -1543,32 +5501,293 @@ GLFWwindow* initGLFW (int width, int height)
 	return window;
 }
 
-/* Initialize the OpenGL rendering properties */
-/* Add all the models to be created here */
-void initGL (GLFWwindow* window, int width, int height)
+/****************
+ * Asset loader *
+ ****************/
+
+/* Seconds of GL uploads allowed per placeholder frame while assets come in */
+#define ASSET_FRAME_BUDGET 0.004
+#define ASSET_JOBS 7
+
+double startupBegin; // monotonicTime() when main started
+
+/* File reads and decoding run on worker threads, the GL half of each asset
+   is done by the main thread between placeholder frames */
+struct AssetJob {
+	const char* paths[3];
+	void (*read)(AssetJob*);     // Worker thread, no GL calls
+	void (*finish)(AssetJob*);   // Main thread
+	std::string sources[2];      // Vertex and fragment source of a program
+	std::string error;           // Why the sources could not be put together
+	vector<unsigned char> bytes; // Font file
+	AtlasPixels atlas;
+	std::atomic<int> ready;
+	int finished;
+};
+
+struct AssetLoader {
+	AssetJob jobs[ASSET_JOBS];
+	int count;
+	std::atomic<int> next;  // Next job for a worker to take
+	vector<std::thread> workers;
+	int finished;
+	int done;
+	double firstFrame;
+} Assets;
+
+void readAtlasJob (AssetJob* job)
 {
-	// Load Textures
-	// Enable Texture0 as current texture memory
-	glActiveTexture(GL_TEXTURE0);
-	
-	// load an image file directly as a new OpenGL texture
-	// GLuint texID = SOIL_load_OGL_texture ("beach.png", SOIL_LOAD_AUTO, SOIL_CREATE_NEW_ID, SOIL_FLAG_TEXTURE_REPEATS); // Buggy for OpenGL3
-	GLuint textureID = createTexture("background.png");
-	
-	// check for an error during the load process
-	if(textureID == 0 )
-		cout << "SOIL loading error: '" << SOIL_last_result() << "'" << endl;
+	readSpriteAtlas(job->paths[0], job->paths[1], job->paths[2], &job->atlas);
+}
+
+/* paths[0] names the program variant, paths[1] holds its defines */
+void readProgramJob (AssetJob* job)
+{
+	job->sources[0] = shaderVariantSource("scene.vert", job->paths[1], &job->error);
+	if(job->error.empty())
+		job->sources[1] = shaderVariantSource("scene.frag", job->paths[1], &job->error);
+}
+
+void readFontJob (AssetJob* job)
+{
+	readProgramJob(job);
+	std::ifstream font(job->paths[2], std::ios::in | std::ios::binary);
+	if(font.is_open())
+		job->bytes.assign(std::istreambuf_iterator<char>(font), std::istreambuf_iterator<char>());
+	if(!buildGlyphAtlas(job->bytes, &Glyphs) && job->error.empty())
+		job->error = string("could not load font `") + job->paths[2] + "'";
+}
+
+void finishAtlasJob (AssetJob* job)
+{
+	finishSpriteAtlas(&job->atlas);
+}
 
+/* An asset the game cannot run without failed. Runs in pumpAssetLoader, so the
+   workers are joined first: exit must not destroy threads that are still joinable */
+void failAssetLoading (const string& message)
+{
+	cout << "Error: " << message << endl;
+	joinAssetWorkers();
+	closeDisplay(NULL);
+	exit(EXIT_FAILURE);
+}
+
+/* The game cannot run without any of its programs */
+GLuint programFromJob (AssetJob* job)
+{
+	GLuint ProgramID = 0;
+	if(job->error.empty())
+		ProgramID = loadProgram(job->paths[0], job->sources[0], job->sources[1]);
+	if(!ProgramID)
+		failAssetLoading(string("could not build the ") + job->paths[0] + " shader program" + (job->error.empty() ? "" : ": " + job->error));
+	return ProgramID;
+}
+
+void finishTextureProgramJob (AssetJob* job)
+{
 	// Create and compile our GLSL program from the texture shaders
-	textureProgramID = LoadShaders( "TextureRender.vert", "TextureRender.frag" );
-	// Get a handle for our "MVP" uniform
-	Matrices.TexMatrixID = glGetUniformLocation(textureProgramID, "MVP");
+	textureProgramID = programFromJob(job);
+	// Hook the program up to the Camera/Models blocks and get a handle for "modelIndex"
+	Matrices.TexModelIndexID = bindTransformBlocks(textureProgramID);
+	// Sprites always sample texture unit 0
+	glUseProgram(textureProgramID);
+	glUniform1i(glGetUniformLocation(textureProgramID, "texSampler"), 0);
+}
+
+void finishColorProgramJob (AssetJob* job)
+{
+	// Create and compile our GLSL program from the shaders
+	programID = programFromJob(job);
+	// Hook the program up to the Camera/Models blocks and get a handle for "modelIndex"
+	Matrices.ModelIndexID = bindTransformBlocks(programID);
+}
+
+void finishInstancedProgramJob (AssetJob* job)
+{
+	instancedProgramID = programFromJob(job);
+	Matrices.InstancedModelIndexID = bindTransformBlocks(instancedProgramID);
+}
+
+void finishEllipseProgramJob (AssetJob* job)
+{
+	ellipseProgramID = programFromJob(job);
+	Matrices.EllipseModelIndexID = bindTransformBlocks(ellipseProgramID);
+}
+
+void finishGroundProgramJob (AssetJob* job)
+{
+	groundProgramID = programFromJob(job);
+	Matrices.GroundModelIndexID = bindTransformBlocks(groundProgramID);
+}
 
+void finishFontJob (AssetJob* job)
+{
+	// A font that did not load, or font shader sources that could not be put together
+	if(!job->error.empty())
+		failAssetLoading(job->error);
+	// Create and compile our GLSL program from the font shaders
+	fontProgramID = programFromJob(job);
+	Glyphs.modelIndexID = bindTransformBlocks(fontProgramID);
+	glUseProgram(fontProgramID);
+	glUniform1i(glGetUniformLocation(fontProgramID, "texSampler"), 0);
+	uploadGlyphAtlas(&Glyphs);
+}
+
+/* --software: no program to build, the glyphs are sampled where buildGlyphAtlas left them */
+void finishSoftwareFontJob (AssetJob* job)
+{
+	if(!job->error.empty())
+		failAssetLoading(job->error);
+	keepSoftwareGlyphs();
+	printf("Glyph atlas (%dx%d): %d glyphs built in %.2f ms\n", Glyphs.width, Glyphs.height, GLYPH_COUNT, 1000.0*Glyphs.seconds);
+}
+
+void addAssetJob (void (*read)(AssetJob*), void (*finish)(AssetJob*), const char* path0, const char* path1, const char* path2)
+{
+	AssetJob& job = Assets.jobs[Assets.count++];
+	job.paths[0] = path0;
+	job.paths[1] = path1;
+	job.paths[2] = path2;
+	job.read = read;
+	job.finish = finish;
+	job.ready = 0;
+	job.finished = 0;
+}
+
+void assetWorkerMain ()
+{
+	profileThreadName("asset loader");
+	int i;
+	while((i = Assets.next++) < Assets.count){
+		ProfileScope scope(Assets.jobs[i].paths[0], "load");
+		Assets.jobs[i].read(&Assets.jobs[i]);
+		Assets.jobs[i].ready = 1;
+	}
+}
+
+/* Queue every asset and start the workers, returns at once */
+void startAssetLoading ()
+{
+	Assets.count = Assets.finished = Assets.done = 0;
+	Assets.next = 0;
+	// Every sprite lives in one atlas texture, built by atlaspack from the Makefile
+	addAssetJob(readAtlasJob, finishAtlasJob, "atlas.tga", "atlas.uv", "background.png");
+	if(softwareRendering){
+		// The software rasterizer shades a command by which of these names it carries
+		programID = softwareName();
+		textureProgramID = softwareName();
+		instancedProgramID = softwareName();
+		ellipseProgramID = softwareName();
+		groundProgramID = softwareName();
+		fontProgramID = softwareName();
+		addAssetJob(readFontJob, finishSoftwareFontJob, "font", "FONT", "arial.ttf");
+	}
+	else{
+		// Shader variants: name (also the program cache file) and defines
+		addAssetJob(readProgramJob, finishTextureProgramJob, "texture", "TEXTURED", NULL);
+		addAssetJob(readProgramJob, finishColorProgramJob, "color", "", NULL);
+		addAssetJob(readProgramJob, finishInstancedProgramJob, "instanced", "INSTANCED", NULL);
+		addAssetJob(readProgramJob, finishEllipseProgramJob, "ellipse", "ELLIPSE", NULL);
+		addAssetJob(readProgramJob, finishGroundProgramJob, "ground", "GROUND", NULL);
+		addAssetJob(readFontJob, finishFontJob, "font", "FONT", "arial.ttf");
+	}
+
+	int workers = min((int)std::thread::hardware_concurrency(), Assets.count);
+	for(int i=0;i<max(workers, 1);i++)
+		Assets.workers.push_back(std::thread(assetWorkerMain));
+}
+
+void joinAssetWorkers ()
+{
+	for(size_t i=0;i<Assets.workers.size();i++)
+		Assets.workers[i].join();
+	Assets.workers.clear();
+}
+
+/* Do the GL half of the assets that are read, for at most budget seconds
+   (at least one asset). Returns 1 once everything is loaded */
+int pumpAssetLoader (double budget)
+{
+	if(Assets.done)
+		return 1;
+	double start = monotonicTime();
+	for(int i=0;i<Assets.count;i++){
+		AssetJob& job = Assets.jobs[i];
+		if(job.finished || !job.ready)
+			continue;
+		ProfileScope scope(job.paths[0], "upload");
+		job.finish(&job);
+		job.finished = 1;
+		Assets.finished++;
+		if(monotonicTime() - start >= budget)
+			break;
+	}
+	if(Assets.finished < Assets.count)
+		return 0;
+
+	joinAssetWorkers();
+	Assets.done = 1;
+	printf("Startup: assets ready after %.1f ms, textures %.1f ms (%d from cache, %d %s), programs %.1f ms (%d from cache, %d compiled)\n",
+			1000.0*(monotonicTime() - startupBegin), 1000.0*TextureCache.seconds, TextureCache.hits, TextureCache.misses,
+			TextureCache.enabled ? "baked" : "decoded from PNG", 1000.0*ProgramCache.seconds, ProgramCache.hits, ProgramCache.misses);
+	return 1;
+}
+
+/* Block until everything is loaded, for the modes that need all assets up front */
+void finishAssetLoading ()
+{
+	while(!pumpAssetLoader(1e9))
+		usleep(500);
+}
+
+/* Shown until the assets are in: just the sky colour */
+void drawPlaceholderFrame ()
+{
+	if(softwareRendering)
+		return;
+	glViewport (0, 0, (GLsizei) framebufferWidth, (GLsizei) framebufferHeight);
+	glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+/* Call after every presented frame during startup */
+void noteStartupFrame (const char* what)
+{
+	if(Assets.firstFrame == 0){
+		Assets.firstFrame = monotonicTime();
+		printf("Startup: first frame (%s) after %.1f ms\n", what, 1000.0*(Assets.firstFrame - startupBegin));
+	}
+}
+
+/* Initialize the OpenGL rendering properties */
+/* Add all the models to be created here */
+void initGL (GLFWwindow* window, int width, int height)
+{
+	if(softwareRendering){
+		// No GL: only names for the atlases, the rasterizer finds their pixels by them
+		Atlas.texture = softwareName();
+		Glyphs.texture = softwareName();
+	}
+	else{
+		// Camera and model uniform buffers shared by all programs
+		initTransformBuffers();
+
+		// Load Textures
+		// Enable Texture0 as current texture memory
+		glActiveTexture(GL_TEXTURE0);
+
+		// load an image file directly as a new OpenGL texture
+		// GLuint texID = SOIL_load_OGL_texture ("beach.png", SOIL_LOAD_AUTO, SOIL_CREATE_NEW_ID, SOIL_FLAG_TEXTURE_REPEATS); // Buggy for OpenGL3
+		// Textures, shaders and the font are read on worker threads, see startAssetLoading.
+		// The atlas names exist now so spriteVAO and textVAO can point at them
+		glGenTextures(1, &Atlas.texture);
+		glGenTextures(1, &Glyphs.texture);
+	}
+	startAssetLoading();
 
 	/* Objects should be created before any other gl function and shaders */
 	// Create the models
 	// Generate the VAO, VBOs, vertices data & copy into the array buffer
-	createBackground (textureID);
 	createCannonball ();
 	createGameFloor ();
 	createWoodLogs();
@@ -1576,16 +5795,17 @@ void initGL (GLFWwindow* window, int width, int height)
 	createPowerBoard();
 	createPowerElement();
 	createCatapult();
+	streamVAO = createStreamedObject(GL_TRIANGLES, GAME_WOOD_HORIZONTAL);
+	spriteVAO = createStreamedSpriteObject(Atlas.texture);
+	textVAO = createStreamedTextObject(Glyphs.texture);
+	Widgets.vao = createWidgetObject(Glyphs.texture);
+	Hud.vao = createWidgetObject(Glyphs.texture);
 	createtemp();
 	//createCatapult2();
 
-	// Create and compile our GLSL program from the shaders
-	programID = LoadShaders( "Sample_GL.vert", "Sample_GL.frag" );
-	// Get a handle for our "MVP" uniform
-	Matrices.MatrixID = glGetUniformLocation(programID, "MVP");
-
-
 	reshapeWindow (window, width, height);
+	if(softwareRendering)
+		return;
 
 	// Background color of the scene
 	glClearColor(156.0/255.0f,205.0f/255.0f,237.0f/255.0f,0.0f);// (0.3f, 0.3f, 0.3f, 0.0f); // R, G, B, A
@@ -1593,33 +5813,8 @@ void initGL (GLFWwindow* window, int width, int height)
 
 	glEnable (GL_DEPTH_TEST);
 	glDepthFunc (GL_LEQUAL);
-	
-	// Initialise FTGL stuff
-	//const char* fontfile = "UpsideDown.ttf";
-	const char* fontfile = "arial.ttf";
-	GL3Font.font = new FTExtrudeFont(fontfile); // 3D extrude style rendering
-
-	if(GL3Font.font->Error())
-	{
-		cout << "Error: Could not load font `" << fontfile << "'" << endl;
-		glfwTerminate();
-		exit(EXIT_FAILURE);
-	}
-
-	// Create and compile our GLSL program from the font shaders
-	fontProgramID = LoadShaders( "fontrender.vert", "fontrender.frag" );
-	GLint fontVertexCoordAttrib, fontVertexNormalAttrib, fontVertexOffsetUniform;
-	fontVertexCoordAttrib = glGetAttribLocation(fontProgramID, "vertexPosition");
-	fontVertexNormalAttrib = glGetAttribLocation(fontProgramID, "vertexNormal");
-	fontVertexOffsetUniform = glGetUniformLocation(fontProgramID, "pen");
-	GL3Font.fontMatrixID = glGetUniformLocation(fontProgramID, "MVP");
-	GL3Font.fontColorID = glGetUniformLocation(fontProgramID, "fontColor");
-
-	GL3Font.font->ShaderLocations(fontVertexCoordAttrib, fontVertexNormalAttrib, fontVertexOffsetUniform);
-	GL3Font.font->FaceSize(1);
-	GL3Font.font->Depth(0);
-	GL3Font.font->Outset(0, 0);
-	GL3Font.font->CharMap(ft_encoding_unicode);
+	// Only the ellipse program blends, see queueRenderCommand
+	glBlendFunc (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
 	cout << "VENDOR: " << glGetString(GL_VENDOR) << endl;
 	cout << "RENDERER: " << glGetString(GL_RENDERER) << endl;
@@ -1627,20 +5822,640 @@ void initGL (GLFWwindow* window, int width, int height)
 	cout << "GLSL: " << glGetString(GL_SHADING_LANGUAGE_VERSION) << endl;
 }
 
+/* Compare per-object CPU submission cost of the old CPU-side MVP path against the uniform buffer path */
+void benchmarkTransforms (GLFWwindow* window, int objects)
+{
+	// The pre-UBO vertex shader, kept here only as the baseline
+	static const char* legacyVertex =
+		"#version 330 core\n"
+		"layout (location = 0) in vec3 vertexPosition;\n"
+		"layout (location = 1) in vec3 vertexColor;\n"
+		"uniform mat4 MVP;\n"
+		"out vec3 fragColor;\n"
+		"void main () { fragColor = vertexColor; gl_Position = MVP * vec4(vertexPosition, 1); }\n";
+	static const char* legacyFragment =
+		"#version 330 core\n"
+		"in vec3 fragColor;\n"
+		"out vec3 color;\n"
+		"void main () { color = fragColor; }\n";
+	GLuint legacyProgramID = CompileShaders(legacyVertex, legacyFragment, "legacy MVP vertex", "legacy MVP fragment");
+	GLint legacyMatrixID = glGetUniformLocation(legacyProgramID, "MVP");
+
+	vector<glm::mat4> models(objects);
+	for(int i=0;i<objects;i++)
+		models[i] = glm::translate(glm::vec3(-600 + (i*37)%1200, -300 + (i*11)%600, 0)) * glm::rotate((float)(i*0.01), glm::vec3(0,0,1));
+
+	Matrices.view = glm::lookAt(glm::vec3(0,0,3), glm::vec3(0,0,0), glm::vec3(0,1,0));
+	glm::mat4 VP = Matrices.projection * Matrices.view;
+	const int frames = 120;
+	double cpu[3] = {0, 0, 0};
+	for(int path=0;path<3;path++){
+		for(int f=0;f<frames;f++){
+			glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			double start = gameTime();
+			if(path == 0){
+				glUseProgram(legacyProgramID);
+				for(int i=0;i<objects;i++){
+					glm::mat4 MVP = VP * models[i];
+					glUniformMatrix4fv(legacyMatrixID, 1, GL_FALSE, &MVP[0][0]);
+					draw3DObject(catapult);
+				}
+			}
+			else if(path == 1){
+				clearRenderList(frameList);
+				frameList.VP = VP;
+				for(int i=0;i<objects;i++)
+					recordDraw(frameList, programID, catapult, models[i], LAYER_LOGS);
+				submitRenderList(frameList);
+			}
+			else{
+				// Same mesh every time, so one instanced draw per filled Models range
+				beginStreamFrame();
+				setCameraTransform(VP);
+				glUseProgram(instancedProgramID);
+				glUniform1i(Matrices.InstancedModelIndexID, 0);
+				glBindVertexArray(catapult->VertexArrayID);
+				for(int i=0;i<objects;i+=MODEL_BLOCK_SLOTS){
+					int count = min(MODEL_BLOCK_SLOTS, objects - i);
+					GLintptr offset = streamAlloc(&UniformStream, Transforms.blockStride, Transforms.alignment);
+					if(offset < 0)
+						break;
+					streamUpload(&UniformStream, offset, &models[i][0][0], count * sizeof(glm::mat4));
+					glBindBufferRange(GL_UNIFORM_BUFFER, UBO_MODELS_BINDING, UniformStream.BufferID, offset, MODEL_BLOCK_SLOTS * sizeof(glm::mat4));
+					glDrawArraysInstanced(catapult->PrimitiveMode, 0, catapult->NumVertices, count);
+				}
+				endStreamFrame();
+			}
+			cpu[path] += gameTime() - start;
+			presentFrame(window);
+		}
+	}
+	glDeleteProgram(legacyProgramID);
+
+	printf("Transform benchmark, %d objects, %d frames per path\n", objects, frames);
+	printf("  CPU MVP + glUniformMatrix4fv : %.3f ms/frame\n", 1000.0*cpu[0]/frames);
+	printf("  Camera UBO + model ring      : %.3f ms/frame\n", 1000.0*cpu[1]/frames);
+	printf("  Instanced variant, UBO ranges: %.3f ms/frame\n", 1000.0*cpu[2]/frames);
+	printf("  Saved                        : %.3f ms/frame\n", 1000.0*(cpu[0]-cpu[1])/frames);
+}
+
+/* Stream vertex data every frame through a persistent ring and through glBufferData orphaning */
+void benchmarkStreaming (GLFWwindow* window)
+{
+	const int vertices = 43690; // ~1MB of interleaved position/colour per frame
+	const int frames = 300;
+	vector<GLfloat> data(6*vertices, 0.0f); // Degenerate triangles, the cost is in the transfer
+	GLsizeiptr bytes = vertices * STREAM_VERTEX_STRIDE;
+
+	StreamBuffer bench;
+	initStreamBuffer(&bench, GL_ARRAY_BUFFER, bytes);
+	VAO* streamed = new VAO();
+	streamed->PrimitiveMode = GL_TRIANGLES;
+	streamed->FillMode = GL_FILL;
+	streamed->VertexBuffer = streamed->ColorBuffer = bench.BufferID;
+	glGenVertexArrays(1, &streamed->VertexArrayID);
+	glBindVertexArray(streamed->VertexArrayID);
+	glBindBuffer(GL_ARRAY_BUFFER, bench.BufferID);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, STREAM_VERTEX_STRIDE, (void*)0);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, STREAM_VERTEX_STRIDE, (void*)(3*sizeof(GLfloat)));
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+
+	VAO* orphaned = new VAO();
+	orphaned->PrimitiveMode = GL_TRIANGLES;
+	orphaned->FillMode = GL_FILL;
+	glGenBuffers(1, &orphaned->VertexBuffer);
+	orphaned->ColorBuffer = orphaned->VertexBuffer;
+	glGenVertexArrays(1, &orphaned->VertexArrayID);
+	glBindVertexArray(orphaned->VertexArrayID);
+	glBindBuffer(GL_ARRAY_BUFFER, orphaned->VertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, STREAM_VERTEX_STRIDE, (void*)0);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, STREAM_VERTEX_STRIDE, (void*)(3*sizeof(GLfloat)));
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+
+	Matrices.view = glm::lookAt(glm::vec3(0,0,3), glm::vec3(0,0,0), glm::vec3(0,1,0));
+	double elapsed[2] = {0, 0};
+	for(int path=0;path<2;path++){
+		glFinish();
+		double start = gameTime();
+		for(int f=0;f<frames;f++){
+			glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			VAO* target = orphaned;
+			if(path == 0){
+				beginStreamRegion(&bench);
+				GLintptr offset = streamAlloc(&bench, bytes, STREAM_VERTEX_STRIDE);
+				streamUpload(&bench, offset, &data[0], bytes);
+				streamed->FirstVertex = offset / STREAM_VERTEX_STRIDE;
+				target = streamed;
+			}
+			else {
+				glBindBuffer(GL_ARRAY_BUFFER, orphaned->VertexBuffer);
+				glBufferData(GL_ARRAY_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+				glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, &data[0]);
+			}
+			target->NumVertices = vertices;
+			clearRenderList(frameList);
+			frameList.VP = Matrices.projection * Matrices.view;
+			recordDraw(frameList, programID, target, glm::mat4(1.0f), LAYER_LOGS);
+			submitRenderList(frameList);
+			if(path == 0)
+				endStreamRegion(&bench);
+			presentFrame(window);
+		}
+		glFinish();
+		elapsed[path] = gameTime() - start;
+	}
+
+	double megabytes = (double)bytes * frames / (1024.0*1024.0);
+	printf("Streaming benchmark, %.2f MB per frame, %d frames per path (%s)\n", bytes/(1024.0*1024.0), frames, bench.mapped ? "persistent mapping" : "unsynchronized mapping");
+	printf("  Fenced ring buffer  : %8.1f MB/s, %ld stalls\n", megabytes/elapsed[0], bench.stalls);
+	printf("  glBufferData orphan : %8.1f MB/s\n", megabytes/elapsed[1]);
+}
+
+/* Draw the same strings through FTGL's per glyph meshes and through the glyph atlas */
+void benchmarkText (GLFWwindow* window)
+{
+	// The shader the game drew FTGL text with before the glyph atlas, kept here only as the baseline
+	static const char* ftglVertex =
+		"#version 330 core\n"
+		"in vec3 vertexPosition;\n"
+		"in vec3 vertexNormal;\n"
+		"uniform vec3 pen;\n"
+		"uniform mat4 MVP;\n"
+		"void main () { gl_Position = MVP * vec4(vertexPosition + pen, 1); }\n";
+	static const char* ftglFragment =
+		"#version 330 core\n"
+		"uniform vec3 fontColor;\n"
+		"out vec3 color;\n"
+		"void main () { color = fontColor; }\n";
+	GLuint ftglProgramID = CompileShaders(ftglVertex, ftglFragment, "FTGL vertex", "FTGL fragment");
+	GLint ftglMatrixID = glGetUniformLocation(ftglProgramID, "MVP");
+	GLint ftglColorID = glGetUniformLocation(ftglProgramID, "fontColor");
+	FTExtrudeFont font("arial.ttf");
+	if(!ftglProgramID || font.Error()){
+		printf("Text benchmark: could not set up FTGL with arial.ttf\n");
+		return;
+	}
+	font.ShaderLocations(glGetAttribLocation(ftglProgramID, "vertexPosition"), glGetAttribLocation(ftglProgramID, "vertexNormal"), glGetUniformLocation(ftglProgramID, "pen"));
+	font.FaceSize(1);
+	font.Depth(0);
+	font.Outset(0, 0);
+	font.CharMap(ft_encoding_unicode);
+
+	const int strings = 100;
+	const int frames = 120;
+	vector<string> text(strings);
+	vector<glm::mat4> models(strings);
+	long glyphs = 0;
+	for(int i=0;i<strings;i++){
+		char line[64];
+		snprintf(line, sizeof(line), "SCORE: %05d  frame %5.2f ms  %d pigs left", i*100, 16.67f + i*0.01f, i%6);
+		text[i] = line;
+		glyphs += text[i].size();
+		models[i] = glm::translate(glm::vec3(-580, -280 + i*5.6f, 0)) * glm::scale(glm::vec3(12, 12, 1));
+	}
+
+	Matrices.view = glm::lookAt(glm::vec3(0,0,3), glm::vec3(0,0,0), glm::vec3(0,1,0));
+	glm::mat4 VP = Matrices.projection * Matrices.view;
+	glm::vec3 color(1, 1, 1);
+	double elapsed[2] = {0, 0};
+	for(int path=0;path<2;path++){
+		glFinish();
+		double start = gameTime();
+		for(int f=0;f<frames;f++){
+			glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			if(path == 0){
+				glUseProgram(ftglProgramID);
+				glUniform3fv(ftglColorID, 1, &color[0]);
+				for(int i=0;i<strings;i++){
+					glm::mat4 MVP = VP * models[i];
+					glUniformMatrix4fv(ftglMatrixID, 1, GL_FALSE, &MVP[0][0]);
+					font.Render(text[i].c_str());
+				}
+			}
+			else{
+				clearRenderList(frameList);
+				frameList.VP = VP;
+				for(int i=0;i<strings;i++)
+					recordText(frameList, text[i].c_str(), color, models[i], LAYER_WIDGETS);
+				submitRenderList(frameList);
+			}
+			presentFrame(window);
+		}
+		glFinish();
+		elapsed[path] = gameTime() - start;
+	}
+	glDeleteProgram(ftglProgramID);
+
+	printf("Text benchmark, %ld glyphs per frame, %d frames per path\n", glyphs, frames);
+	printf("  FTGL extruded meshes : %8.1f glyphs/ms\n", glyphs*frames / (1000.0*elapsed[0]));
+	printf("  Distance field atlas : %8.1f glyphs/ms\n", glyphs*frames / (1000.0*elapsed[1]));
+}
+
+/* Draw a crowd of pigs as triangle fans and as ellipse quads, small so the
+   vertices dominate and large so the filled pixels do */
+void benchmarkCircles (GLFWwindow* window)
+{
+	const int objects = 2000;
+	const int frames = 120;
+	const float scales[2] = {0.25f, 4.0f};
+	Matrices.view = glm::lookAt(glm::vec3(0,0,3), glm::vec3(0,0,0), glm::vec3(0,1,0));
+	glm::mat4 VP = Matrices.projection * Matrices.view;
+
+	printf("Circle benchmark, %d pigs, %d frames per case\n", objects, frames);
+	for(int s=0;s<2;s++){
+		vector<glm::mat4> models(objects);
+		for(int i=0;i<objects;i++)
+			models[i] = glm::translate(glm::vec3(-580 + (i*37)%1160, -280 + (i*11)%560, 0)) * glm::scale(glm::vec3(scales[s], scales[s], 1));
+		for(int path=0;path<2;path++){
+			long vertices = 0;
+			glFinish();
+			double start = gameTime();
+			for(int f=0;f<frames;f++){
+				clearRenderList(frameList);
+				frameList.VP = VP;
+				for(int i=0;i<objects;i++){
+					VAO* pig = path == 0 ? pigFans[i%6] : pigs[i%6];
+					recordDraw(frameList, path == 0 ? programID : ellipseProgramID, pig, models[i], LAYER_PIGS);
+					if(f == 0)
+						vertices += pig->NumVertices;
+				}
+				submitRenderList(frameList);
+				presentFrame(window);
+			}
+			glFinish();
+			double elapsed = gameTime() - start;
+			printf("  %-14s x%-4.2f: %7.3f ms/frame, %7ld vertices/frame, %8.1f Mvertices/s\n", path == 0 ? "triangle fans" : "ellipse quads",
+					scales[s], 1000.0*elapsed/frames, vertices, vertices*frames / (1e6*elapsed));
+		}
+	}
+}
+
+/* Fill the screen with floors drawn as the old overlapping strips and as the ground quad */
+void benchmarkFloor (GLFWwindow* window)
+{
+	const int floors = 40;
+	const int frames = 120;
+	Matrices.view = glm::lookAt(glm::vec3(0,0,3), glm::vec3(0,0,0), glm::vec3(0,1,0));
+	glm::mat4 VP = Matrices.projection * Matrices.view;
+	// Shaded fragments are counted with an occlusion query, which the overdraw view would be using
+	int overdraw = Overdraw.enabled;
+	Overdraw.enabled = 0;
+	GLuint query;
+	glGenQueries(1, &query);
+
+	printf("Floor benchmark, %d floors per frame, %d frames per path\n", floors, frames);
+	for(int path=0;path<2;path++){
+		VAO* mesh = path == 0 ? floorStrips : gameFloor;
+		glFinish();
+		double start = gameTime();
+		// Everything is at z = 0 with GL_LEQUAL, so every fragment shaded passes and is counted
+		glBeginQuery(GL_SAMPLES_PASSED, query);
+		for(int f=0;f<frames;f++){
+			clearRenderList(frameList);
+			frameList.VP = VP;
+			// Stacked down the screen, dynamic layer so the static layer cache stays out of it
+			for(int i=0;i<floors;i++)
+				recordDraw(frameList, path == 0 ? programID : groundProgramID, mesh, glm::translate(glm::vec3(0, -500 + (i*17)%560, 0)), LAYER_PIGS);
+			submitRenderList(frameList);
+			presentFrame(window);
+		}
+		glEndQuery(GL_SAMPLES_PASSED);
+		glFinish();
+		double elapsed = gameTime() - start;
+		GLuint64 samples = 0;
+		glGetQueryObjectui64v(query, GL_QUERY_RESULT, &samples);
+		double fragments = (double)samples / frames;
+		printf("  %-12s: %7.3f ms/frame, %6.2f Mfragments/frame, %8.1f Mfragments/s\n", path == 0 ? "20 strips" : "ground quad",
+				1000.0*elapsed/frames, fragments/1e6, fragments*frames / (1e6*elapsed));
+	}
+	glDeleteQueries(1, &query);
+	Overdraw.enabled = overdraw;
+}
+
+/* Apply held pan and zoom keys to the visible region */
+void updateCamera (GLFWwindow* window, int width, int height)
+{
+	if(panleft == 1 && screenleft >= -600 + 5){
+		screenleft -= 5;
+		screenright -= 5;
+	}
+	if(panright == 1 && screenright <= 600 - 5){
+		screenleft += 5;
+		screenright += 5;
+	}
+	if(panup == 1 && screentop >= -300 + 5){
+		screentop -= 5;
+		screenbotton -= 5;
+	}
+	if(pandown == 1 && screenbotton <= 300 - 5){
+		screentop += 5;
+		screenbotton += 5;
+	}
+
+	if(zoominstate == 1 && screenright-screenleft > 800) {
+			screenleft /= 1.02;
+			screenright /= 1.02;
+			screentop /= 1.02;
+			screenbotton /= 1.02;
+	}
+	if(zoomoutstate == 1 && screenright - screenleft < 1200) {
+		if(screenleft >= -600.0f/1.02f)
+			screenleft *= 1.02;
+		if(screenright <= 600.0f/1.02f)
+			screenright *= 1.02;
+		if(screentop >= -300.0f/1.02f)
+			screentop *= 1.02;
+		if(screenbotton <= 300.0f/1.02f)
+			screenbotton *= 1.02;
+	}
+	if(zoominstate == 1 || zoomoutstate == 1 || panleft == 1 || panright == 1 || panup == 1 || pandown == 1)
+		reshapeWindow(window, width, height);
+}
+
+/*****************
+ * Golden images *
+ *****************/
+
+/* Frames of the scripted run compared against DIR/<name>.png */
+struct GoldenFrame {
+	const char* name;
+	int frame;
+};
+
+static const GoldenFrame goldenFrames[] = {
+	{"initial", 1},
+	{"aiming", 25},
+	{"midflight", 50},
+};
+#define GOLDEN_FRAMES (int)(sizeof(goldenFrames)/sizeof(goldenFrames[0]))
+
+/* The fixed shot: grab the bird, pull it back for 15 frames and let go */
+void scriptGoldenInput (int frame)
+{
+	// Window pixels, the bird rests at (-380, 130) which is (220, 430) on a 1200x600 window
+	if(frame == 10){
+		cursor_position_callback(NULL, 220, 430);
+		mouseButton(NULL, GLFW_MOUSE_BUTTON_LEFT, GLFW_PRESS, 0);
+	}
+	if(frame > 10 && frame <= 25)
+		cursor_position_callback(NULL, 220 - 2*(frame-10), 430 + (frame-10));
+	if(frame == 30)
+		mouseButton(NULL, GLFW_MOUSE_BUTTON_LEFT, GLFW_RELEASE, 0);
+}
+
+/* Store or compare one captured frame, returns 1 on a mismatch */
+int checkGoldenFrame (const char* dir, long frame, const vector<unsigned char>& rgba, int record, int tolerance)
+{
+	const char* name = NULL;
+	for(int i=0;i<GOLDEN_FRAMES;i++)
+		if(goldenFrames[i].frame == frame)
+			name = goldenFrames[i].name;
+	if(!name)
+		return 0;
+
+	string path = string(dir) + "/" + name + ".png";
+	if(record){
+		if(!writePNG(path.c_str(), &rgba[0], Capture.width, Capture.height)){
+			cout << "Golden: could not write " << path << endl;
+			return 1;
+		}
+		cout << "Golden: recorded " << path << endl;
+		return 0;
+	}
+
+	int width, height, channels;
+	unsigned char* golden = SOIL_load_image(path.c_str(), &width, &height, &channels, SOIL_LOAD_RGBA);
+	if(!golden){
+		cout << "Golden: FAIL " << name << ", could not load " << path << endl;
+		return 1;
+	}
+	if(width != Capture.width || height != Capture.height){
+		cout << "Golden: FAIL " << name << ", golden is " << width << "x" << height << ", frame is " << Capture.width << "x" << Capture.height << endl;
+		SOIL_free_image_data(golden);
+		return 1;
+	}
+
+	// Alpha is left out, the window's alpha is whatever the clear colour says
+	int bad = 0, worst = 0;
+	for(int i=0;i<width*height;i++){
+		int diff = 0;
+		for(int c=0;c<3;c++)
+			diff = max(diff, abs((int)golden[4*i+c] - (int)rgba[4*i+c]));
+		if(diff > tolerance)
+			bad++;
+		worst = max(worst, diff);
+	}
+	SOIL_free_image_data(golden);
+
+	if(bad){
+		string actual = string(dir) + "/" + name + ".actual.png";
+		writePNG(actual.c_str(), &rgba[0], Capture.width, Capture.height);
+		printf("Golden: FAIL %s, %d pixels differ by more than %d (worst %d), see %s\n", name, bad, tolerance, worst, actual.c_str());
+		return 1;
+	}
+	printf("Golden: ok %s (worst difference %d)\n", name, worst);
+	return 0;
+}
+
+/* Play the scripted frames and record or check the goldens, returns the number of failures */
+int runGoldenFrames (GLFWwindow* window, const char* dir, int record, int tolerance)
+{
+	if(record && mkdir(dir, 0755) != 0 && errno != EEXIST){
+		cout << "Golden: could not create " << dir << endl;
+		return 1;
+	}
+	initFrameCapture(framebufferWidth, framebufferHeight);
+	Interpolate.fixedTick = 0; // The script steps once per frame whatever the clock says
+
+	int failures = 0, next = 0, compared = 0;
+	int last = goldenFrames[GOLDEN_FRAMES-1].frame;
+	vector<unsigned char> rgba;
+	for(int frame=0;frame<=last;frame++){
+		scriptGoldenInput(frame);
+		draw();
+		if(next < GOLDEN_FRAMES && goldenFrames[next].frame == frame){
+			if(!captureFrame(frame))
+				cout << "Golden: could not capture " << goldenFrames[next].name << endl;
+			next++;
+		}
+		presentFrame(window);
+
+		long captured;
+		while(collectFrame(rgba, &captured, frame == last)){
+			failures += checkGoldenFrame(dir, captured, rgba, record, tolerance);
+			compared++;
+		}
+	}
+	// A frame that was not captured or not read back was never compared, which is a failure too
+	if(compared < GOLDEN_FRAMES){
+		printf("Golden: FAIL %d of %d frames were not %s\n", GOLDEN_FRAMES - compared, GOLDEN_FRAMES, record ? "recorded" : "compared");
+		failures += GOLDEN_FRAMES - compared;
+	}
+	return failures;
+}
+
 int main (int argc, char** argv)
 {
+	startupBegin = monotonicTime();
+	profileThreadName("main");
 	int width = 1200;
 	int height = 600;
+	int benchTransforms = 0, benchStreaming = 0, benchText = 0, benchCircles = 0, benchFloor = 0, threaded = 0;
+	int headless = 0, maxFrames = 0;
+	const char* goldenDir = NULL;
+	int goldenRecord = 0, goldenTolerance = 2;
+
+	for(int i=1;i<argc;i++){
+		if(strcmp(argv[i], "--bench-transforms") == 0)
+			benchTransforms = 10000;
+		else if(strcmp(argv[i], "--bench-stream") == 0)
+			benchStreaming = 1;
+		else if(strcmp(argv[i], "--bench-text") == 0)
+			benchText = 1;
+		else if(strcmp(argv[i], "--bench-circles") == 0)
+			benchCircles = 1;
+		else if(strcmp(argv[i], "--bench-floor") == 0)
+			benchFloor = 1;
+		else if(strcmp(argv[i], "--threaded") == 0)
+			threaded = 1;
+		else if(strcmp(argv[i], "--fixed-tick") == 0)
+			Interpolate.fixedTick = 1;
+		else if(strcmp(argv[i], "--no-interpolation") == 0)
+			Interpolate.enabled = 0;
+		else if(strcmp(argv[i], "--no-static-cache") == 0)
+			StaticLayer.enabled = 0;
+		else if(strcmp(argv[i], "--headless") == 0){
+			headless = 1;
+			// Optional resolution, e.g. --headless 1920x1080
+			if(i+1 < argc && sscanf(argv[i+1], "%dx%d", &width, &height) == 2)
+				i++;
+		}
+		else if(strcmp(argv[i], "--software") == 0){
+			softwareRendering = 1;
+			headless = 1;
+			if(i+1 < argc && sscanf(argv[i+1], "%dx%d", &width, &height) == 2)
+				i++;
+		}
+		else if(strcmp(argv[i], "--software-threads") == 0 && i+1 < argc)
+			Software.threads = atoi(argv[++i]);
+		else if(strcmp(argv[i], "--frames") == 0 && i+1 < argc)
+			maxFrames = atoi(argv[++i]);
+		else if(strcmp(argv[i], "--golden-record") == 0 && i+1 < argc){
+			goldenDir = argv[++i];
+			goldenRecord = 1;
+		}
+		else if(strcmp(argv[i], "--golden-check") == 0 && i+1 < argc)
+			goldenDir = argv[++i];
+		else if(strcmp(argv[i], "--golden-tolerance") == 0 && i+1 < argc)
+			goldenTolerance = atoi(argv[++i]);
+		else if(strcmp(argv[i], "--no-texture-cache") == 0)
+			TextureCache.enabled = 0;
+		else if(strcmp(argv[i], "--no-program-cache") == 0)
+			ProgramCache.enabled = 0;
+		else if(strcmp(argv[i], "--trace") == 0 && i+1 < argc){
+			Profiler.path = argv[++i];
+			Profiler.enabled = 1;
+		}
+		else if(strcmp(argv[i], "--trace-seconds") == 0 && i+1 < argc)
+			Profiler.seconds = atof(argv[++i]);
+		else if(strcmp(argv[i], "--pacing") == 0 && i+1 < argc){
+			const char* mode = argv[++i];
+			int found = 0;
+			for(int m=PACING_VSYNC;m<=PACING_CAP;m++){
+				if(strcmp(mode, pacingNames[m]) == 0){
+					Pacing.mode = m;
+					found = 1;
+				}
+			}
+			if(!found)
+				printf("Unknown pacing mode %s, use vsync, adaptive, uncapped or cap\n", mode);
+		}
+		else if(strcmp(argv[i], "--fps-cap") == 0 && i+1 < argc){
+			Pacing.mode = PACING_CAP;
+			Pacing.cap = atof(argv[++i]);
+		}
+		else if(strcmp(argv[i], "--hud") == 0)
+			Hud.visible = 1;
+		else if(strcmp(argv[i], "--overdraw") == 0)
+			Overdraw.enabled = 1;
+		else if(strcmp(argv[i], "--no-gpu-timers") == 0)
+			GpuTimers.enabled = 0;
+		else if(strcmp(argv[i], "--shader-dir") == 0 && i+1 < argc)
+			ShaderDir = argv[++i];
+		else if(strcmp(argv[i], "--record") == 0 && i+1 < argc){
+			Recorder.path = argv[++i];
+			toggleRecording();
+		}
+	}
+
+	// Checked before anything is initialised, the asset workers must not be running when this exits
+	if(softwareRendering && (benchTransforms || benchStreaming || benchText || benchCircles || benchFloor)){
+		cout << "The benchmarks time OpenGL paths, run them without --software" << endl;
+		exit(EXIT_FAILURE);
+	}
 
-	GLFWwindow* window = initGLFW(width, height);
+	GLFWwindow* window = NULL;
+	if(headless){
+		if(softwareRendering)
+			initSoftwareRenderer(width, height);
+		else if(!initHeadless(width, height))
+			exit(EXIT_FAILURE);
+		// Nobody is there to close the window
+		if(maxFrames == 0)
+			maxFrames = 600;
+	}
+	else
+		window = initGLFW(width, height);
 
 	initGL (window, width, height);
 
-	double last_update_time = glfwGetTime(), current_time;
+	if(goldenDir){
+		finishAssetLoading();
+		int failures = runGoldenFrames(window, goldenDir, goldenRecord, goldenTolerance);
+		closeDisplay(window);
+		exit(failures ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
+	if(benchTransforms || benchStreaming || benchText || benchCircles || benchFloor){
+		finishAssetLoading();
+		// No frame has set the viewport yet and a surfaceless context starts at 0x0
+		glViewport (0, 0, (GLsizei) framebufferWidth, (GLsizei) framebufferHeight);
+		if(benchTransforms)
+			benchmarkTransforms(window, benchTransforms);
+		if(benchStreaming)
+			benchmarkStreaming(window);
+		if(benchText)
+			benchmarkText(window);
+		if(benchCircles)
+			benchmarkCircles(window);
+		if(benchFloor)
+			benchmarkFloor(window);
+		closeDisplay(window);
+		exit(EXIT_SUCCESS);
+	}
+
+	double last_update_time = gameTime(), current_time;
 	
 	
-	pid = fork();
-	if(pid==0){
+	/* Placeholder frames while the assets are read and uploaded */
+	while(!pumpAssetLoader(ASSET_FRAME_BUDGET)){
+		if(window && glfwWindowShouldClose(window)){
+			finishAssetLoading();
+			break;
+		}
+		drawPlaceholderFrame();
+		presentFrame(window);
+		noteStartupFrame("placeholder");
+		pollEvents(window);
+	}
+
+	// No music on headless runs, there is nobody to hear it. Forked once the asset
+	// workers are joined, the child must not start out as a copy of a threaded process
+	pid = headless ? 0 : fork();
+	if(!headless && pid==0){
 		while(1){
 		mpg123_handle *mh;
 		unsigned char *buffer;
@@ -1692,61 +6507,59 @@ int main (int argc, char** argv)
 		_exit(0);
 	}
 
-	/* Draw in loop */
-	while (!glfwWindowShouldClose(window)) {
-
-		if(panleft == 1 && screenleft >= -600 + 5){
-			screenleft -= 5;
-			screenright -= 5;
-		}
-		if(panright == 1 && screenright <= 600 - 5){
-			screenleft += 5;
-			screenright += 5;
-		}
-		if(panup == 1 && screentop >= -300 + 5){
-			screentop -= 5;
-			screenbotton -= 5;
-		}
-		if(pandown == 1 && screenbotton <= 300 - 5){
-			screentop += 5;
-			screenbotton += 5;
+	Timing.mode = threaded ? "threaded" : "single thread";
+	double next_tick = gameTime();
+	if(threaded)
+		startRenderThread(window);
+
+	/* Draw in loop, --frames or headless runs stop after maxFrames simulation steps */
+	for (int frame = 0; !(window && glfwWindowShouldClose(window)) && !(maxFrames && frame >= maxFrames); frame++) {
+
+		if(threaded){
+			// Simulation and input on this thread at a fixed rate, GL and swaps on the render thread
+			pollEvents(window);
+			updateCamera(window, width, height);
+			simulateFrame(frameList);
+			publishRenderList(frameList);
+
+			next_tick += SIM_TICK;
+			double wait = next_tick - gameTime();
+			if(wait > 0)
+				usleep((useconds_t)(wait*1e6));
+			else if(wait < -0.25)
+				next_tick = gameTime(); // Fell far behind, do not try to catch up
+			continue;
 		}
 
-		if(zoominstate == 1 && screenright-screenleft > 800) {
-				screenleft /= 1.02;
-				screenright /= 1.02;
-				screentop /= 1.02;
-				screenbotton /= 1.02;
-		}
-		if(zoomoutstate == 1 && screenright - screenleft < 1200) {
-			if(screenleft >= -600.0f/1.02f)
-				screenleft *= 1.02;
-			if(screenright <= 600.0f/1.02f)
-				screenright *= 1.02;
-			if(screentop >= -300.0f/1.02f)
-				screentop *= 1.02;
-			if(screenbotton <= 300.0f/1.02f)
-				screenbotton *= 1.02;
-		}
-		if(zoominstate == 1 || zoomoutstate == 1 || panleft == 1 || panright == 1 || panup == 1 || pandown == 1)
-			reshapeWindow(window, width, height);
+		updateCamera(window, width, height);
 		// OpenGL Dramands
 		draw();
 
+		recordVideoFrame(frameList.width, frameList.height);
+
 		// Swap Frame Buffer in double buffering
-		glfwSwapBuffers(window);
+		presentFrame(window);
+		recordFrameTiming(frameList);
+		if(frame == 0)
+			printf("Startup: first game frame after %.1f ms\n", 1000.0*(monotonicTime() - startupBegin));
+		noteStartupFrame("game");
 
 		// Poll for Keyboard and mouse events
-		glfwPollEvents();
+		pollEvents(window);
 
 		// Control based on time (Time based transformation like 5 degrees rotation every 0.5s)
-		current_time = glfwGetTime(); // Time in seconds
+		current_time = gameTime(); // Time in seconds
 		if ((current_time - last_update_time) >= 0.5) { // atleast 0.5s elapsed since last frame
 			// do something every 0.5 seconds ..
 			last_update_time = current_time;
 		}
 	}
 
-	glfwTerminate();
+	stopRenderThread();
+	stopRecording();
+	writeTraceAtExit();
+	closeDisplay(window);
+	if(pid > 0)
+		kill(pid,SIGKILL);
 	exit(EXIT_SUCCESS);
 }
@@ -0,0 +1,59 @@
+#version 330 core
+
+// Variants as in scene.vert, INSTANCED changes nothing here
+
+// Interpolated values from the vertex shaders
+#if defined(TEXTURED) || defined(FONT) || defined(ELLIPSE)
+in vec2 fragTexCoord;
+#endif
+#if defined(TEXTURED) || defined(FONT)
+// Texture sample for the whole mesh
+uniform sampler2D texSampler;
+#endif
+#ifndef TEXTURED
+in vec3 fragColor;
+#endif
+#ifdef GROUND
+in float groundY;
+#endif
+
+// output data, ellipses put their edge coverage in alpha
+#ifdef ELLIPSE
+out vec4 color;
+#else
+out vec3 color;
+#endif
+
+void main()
+{
+#ifdef TEXTURED
+    vec4 texel = texture( texSampler, fragTexCoord );
+
+    // Sprites are cut out by their alpha, the depth test does not allow blending
+    if (texel.a < 0.5)
+        discard;
+    color = texel.rgb;
+#elif defined(FONT)
+    // The field is 0.5 on the outline and grows inwards, cut out like the sprites
+    if (texture( texSampler, fragTexCoord ).r < 0.5)
+        discard;
+    color = fragColor;
+#elif defined(ELLIPSE)
+    // Distance to the edge in pixels, through the screen space derivative of the
+    // distance in the unit circle. Flat triangles sit at its centre, fully covered
+    float d = length(fragTexCoord) - 1.0;
+    float coverage = clamp(0.5 - d / max(fwidth(d), 1e-5), 0.0, 1.0);
+    if (coverage <= 0.0)
+        discard;
+    color = vec4(fragColor, coverage);
+#elif defined(GROUND)
+    // The floor was 20 strips 10 high and 5 apart from y = 200, each one redder and
+    // greener than the last and drawn over it. A pixel takes the last strip at its height
+    float band = clamp(floor((groundY - 200.0) / 5.0), 0.0, 19.0);
+    color = min(vec3(133.0 + 2.5*band, 183.0 + 10.0*band, 52.0) / 255.0, vec3(1.0));
+#else
+    // Output color = color specified in the vertex shader,
+    // interpolated between all 3 surrounding vertices of the triangle
+    color = fragColor;
+#endif
+}
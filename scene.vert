@@ -0,0 +1,62 @@
+#version 330 core
+
+// One source for every program, shaderVariantSource in mycode.cpp puts
+// the variant's defines right after #version:
+//   (none)     flat colour per vertex
+//   TEXTURED   sprites sampled from the atlas
+//   FONT       distance field glyphs from the glyph atlas, colour per vertex
+//   INSTANCED  flat colour, one model matrix per instance
+//   ELLIPSE    quads cut into ellipses, colour per vertex
+//   GROUND     the floor, coloured in bands by height
+
+#include "transforms.glsl"
+
+// Glyphs and ellipses pack their colour into one float, see packColor
+#if defined(FONT) || defined(ELLIPSE)
+#define PACKED_COLOR
+#endif
+
+// input data : sent from main program
+layout (location = 0) in vec3 vertexPosition;
+#if defined(TEXTURED) || defined(FONT) || defined(ELLIPSE)
+layout (location = 2) in vec2 vertexTexCoord; // Position in the unit circle for ELLIPSE
+#endif
+#if defined(PACKED_COLOR)
+layout (location = 1) in float vertexColor; // 0xRRGGBB
+#elif !defined(TEXTURED)
+layout (location = 1) in vec3 vertexColor;
+#endif
+
+// output data : used by fragment shader
+#if defined(TEXTURED) || defined(FONT) || defined(ELLIPSE)
+out vec2 fragTexCoord;
+#endif
+#ifndef TEXTURED
+out vec3 fragColor;
+#endif
+#ifdef GROUND
+out float groundY; // Height in the floor mesh
+#endif
+
+void main ()
+{
+    vec4 v = vec4(vertexPosition, 1); // Transform an homogeneous 4D vector
+
+    // The color or texture coord of each vertex will be interpolated
+    // to produce the color of each fragment
+#if defined(TEXTURED) || defined(FONT) || defined(ELLIPSE)
+    fragTexCoord = vertexTexCoord;
+#endif
+#if defined(PACKED_COLOR)
+    // Whole numbers below 2^24 are exact in a float
+    fragColor = vec3(floor(vertexColor / 65536.0), mod(floor(vertexColor / 256.0), 256.0), mod(vertexColor, 256.0)) / 255.0;
+#elif !defined(TEXTURED)
+    fragColor = vertexColor;
+#endif
+#ifdef GROUND
+    groundY = vertexPosition.y;
+#endif
+
+    // Output position of the vertex, in clip space : VP * M * position
+    gl_Position = VP * modelMatrix() * v;
+}
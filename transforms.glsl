@@ -0,0 +1,23 @@
+// Shared by every vertex shader through #include "transforms.glsl"
+
+// View-projection, uploaded once per frame
+layout (std140) uniform Camera {
+    mat4 VP;
+};
+
+// Model matrices of the current draw batch (MODEL_BLOCK_SLOTS in mycode.cpp)
+layout (std140) uniform Models {
+    mat4 model[256];
+};
+
+uniform int modelIndex;
+
+mat4 modelMatrix ()
+{
+#ifdef INSTANCED
+    // One draw for a run of objects, each instance takes the next slot
+    return model[modelIndex + gl_InstanceID];
+#else
+    return model[modelIndex];
+#endif
+}